@@ -36,11 +36,14 @@
  ***/
 
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <assert.h>
 
 #include "atem_ggo.h"
 #include "config.h"
 #include "metastock.h"
+#include "stats.h"
 
 #ifdef _WIN32
 	#include <fcntl.h>
@@ -59,13 +62,19 @@ static gengetopt_args_info args_info;
 COLUMNS may be a list of strings, e.g. 'symbol,date,close'. Prepend '+' or\n\
 '-' to in/exclude, e.g. 'all,-time' (or just '-time' to get the defaults but\n\
 not time). Default is symbol and all date dependent columns (resp. all date\n\
-independent ones if used with --symbols).\n\
+independent ones if used with --symbols). The column 'timestamp' combines\n\
+date and time, see --timestamp. It is not included in 'all'.\n\
 \n\
 BITSET controls the output columns. Specifying octal numbers (digits 0-7 and\n\
 leading 0) is recommended. The first 3 octal digits (9 bits) are used for\n\
 time series columns (date dependent). They are ignored if -s is used. All\n\
 higher bits are used for symbol info (date independent).\n\
 \n\
+DATA_DIR may also be a tar (plain, xz or gzip compressed) or zip archive. To\n\
+choose one of several directories inside append it to the path, e.g.\n\
+'data.tar.xz/msdir'. Or a columnar archive written by\n\
+--output-format=columnar.\n\
+\n\
 Report bugs to sweet_f_a@gmx.de\n\
 Homepage: https://github.com/rudimeier/atem/\n"
 
@@ -114,6 +123,7 @@ int main(int argc, char *argv[])
 	/* never write CRLF line feeds */
 	_setmode(_fileno(stderr),_O_BINARY);
 	_setmode(_fileno(stdout),_O_BINARY);
+	_setmode(_fileno(stdin),_O_BINARY);
 #endif
 
 	atexit( gengetopt_free );
@@ -125,15 +135,38 @@ int main(int argc, char *argv[])
 
 	check_display_args();
 
-	if( args_info.inputs_num == 1 ) {
+	if( args_info.inputs_num == 1 && !args_info.stdin_given ) {
 		ms_dirp = args_info.inputs[0];
-	} else if( args_info.inputs_num > 1 ) {
+	} else if( args_info.inputs_num > 0 ) {
 		fprintf( stderr, "error: bad usage\n" );
 		ret = 2;
 		goto end;
 	}
 
+	if( args_info.stats_given ) {
+		if( args_info.stats_slowest_arg < 0 ) {
+			fprintf( stderr, "error: bad usage\n" );
+			ret = 2;
+			goto end;
+		}
+		stats_init( args_info.stats_slowest_arg );
+	}
+	if( args_info.trace_given ) {
+		if( !trace_init( args_info.trace_arg ) ) {
+			fprintf( stderr, "error: %s: %s\n", args_info.trace_arg,
+				strerror(errno) );
+			ret = 2;
+			goto end;
+		}
+	}
+
 	ret = ms2csv( ms_dirp );
+	stats_print( stderr );
+	if( !trace_write() ) {
+		fprintf( stderr, "error: %s: %s\n", args_info.trace_arg,
+			strerror(errno) );
+		ret = 2;
+	}
 
 end:
 	/* TODO teach Metastock::setError() to distinguish usage and other errors */
@@ -160,7 +193,12 @@ static int ms2csv( const char *ms_dirp )
 		goto ms_error;
 	}
 
-	if( ! ms.setDir( ms_dirp ) ) {
+	if( args_info.stdin_given ) {
+		if( ! ms.setStdin( args_info.stdin_fields_given ?
+				args_info.stdin_fields_arg : NULL ) ) {
+			goto ms_error;
+		}
+	} else if( ! ms.setDir( ms_dirp ) ) {
 		goto ms_error;
 	}
 
@@ -182,6 +220,36 @@ static int ms2csv( const char *ms_dirp )
 		goto ms_error;
 	}
 
+	if( args_info.shortest_given ) {
+		if( !ms.setShortest( args_info.shortest_arg ) ) {
+			goto ms_error;
+		}
+	}
+
+	if( args_info.precision_given ) {
+		if( !ms.setPrecision( args_info.precision_arg ) ) {
+			goto ms_error;
+		}
+	}
+
+	if( args_info.scaled_given ) {
+		if( !ms.setScaled( args_info.scaled_arg ) ) {
+			goto ms_error;
+		}
+	}
+
+	if( args_info.timestamp_given ) {
+		if( !ms.setTimestamp( args_info.timestamp_arg ) ) {
+			goto ms_error;
+		}
+	}
+
+	if( args_info.output_format_given ) {
+		if( !ms.setOutputFormat( args_info.output_format_arg ) ) {
+			goto ms_error;
+		}
+	}
+
 	if( args_info.fdat_given ) {
 		if( ! ms.incudeFile( args_info.fdat_arg ) ) {
 			goto ms_error;
@@ -194,6 +262,50 @@ static int ms2csv( const char *ms_dirp )
 		}
 	}
 
+	if( args_info.where_given ) {
+		if( !ms.setWhere( args_info.where_arg ) ) {
+			goto ms_error;
+		}
+	}
+
+	if( args_info.trust_master_dates_given ) {
+		ms.setTrustMasterDates();
+	}
+
+	if( args_info.resample_given ) {
+		if( !ms.setResample( args_info.resample_arg ) ) {
+			goto ms_error;
+		}
+	}
+
+	if( args_info.threads_given ) {
+		ms.setThreads( args_info.threads_arg );
+	}
+
+	if( args_info.cache_dir_given ) {
+		if( !ms.setCacheDir( args_info.cache_dir_arg ) ) {
+			goto ms_error;
+		}
+	}
+
+	if( args_info.zone_map_dir_given ) {
+		if( !ms.setZoneMapDir( args_info.zone_map_dir_arg ) ) {
+			goto ms_error;
+		}
+	}
+
+	if( args_info.merge_by_time_given ) {
+		if( !ms.setMergeByTime() ) {
+			goto ms_error;
+		}
+	}
+
+	if( args_info.snapshot_given ) {
+		if( !ms.setSnapshot( args_info.snapshot_arg ) ) {
+			goto ms_error;
+		}
+	}
+
 	if( args_info.exclude_older_than_given ) {
 		if( !ms.excludeFiles( args_info.exclude_older_than_arg ) ) {
 			goto ms_error;
@@ -220,6 +332,31 @@ static int ms2csv( const char *ms_dirp )
 		}
 	}
 
+	if( args_info.scan_given ) {
+		dumpdata = false;
+		if( ! ms.scanData() ) {
+			goto ms_error;
+		}
+	}
+
+	if( args_info.verify_given ) {
+		dumpdata = false;
+		long long findings;
+		if( ! ms.verifyData( &findings ) ) {
+			goto ms_error;
+		}
+		if( findings > 0 ) {
+			return 1;
+		}
+	}
+
+	if( args_info.summary_given ) {
+		dumpdata = false;
+		if( ! ms.dumpSummary() ) {
+			goto ms_error;
+		}
+	}
+
 	if( dumpdata ) {
 		if( ! ms.dumpData() ) {
 			goto ms_error;
@@ -0,0 +1,305 @@
+/*** bench_kernels.cpp -- microbenchmarks for formatting and decoding
+ *
+ * Copyright (C) 2010-2016 Ruediger Meier
+ *
+ * Author:  Ruediger Meier <sweet_f_a@gmx.de>
+ *
+ * This file is part of atem.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of any contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ***/
+
+
+/* like verify_xtoa.cpp we include the sources to reach static functions */
+#include "util.cpp"
+#include "ms_file.cpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#if ! defined _WIN32
+#include <sys/time.h>
+#endif
+
+
+#if ! defined BENCH_VARIANT
+	#define BENCH_VARIANT "default"
+#endif
+
+/* values per data set, repeated until MIN_SECONDS elapsed */
+#define N_VALUES 65536
+#define MIN_SECONDS 0.25
+#define BUF_LEN 512
+
+/* keeps the compiler from dropping results */
+static volatile long sink;
+
+
+
+static double now()
+{
+#if defined CLOCK_MONOTONIC
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+	struct timeval tv;
+	gettimeofday( &tv, NULL );
+	return tv.tv_sec + tv.tv_usec / 1e6;
+#endif
+}
+
+
+/* small LCG, benchmarks should see the same values on all platforms */
+static uint32_t rnd_state = 2463534242u;
+
+static uint32_t rnd()
+{
+	rnd_state = rnd_state * 1664525u + 1013904223u;
+	return rnd_state >> 8;
+}
+
+/* uniform in [0,1) */
+static double rnd_unit()
+{
+	return rnd() / 16777216.0;
+}
+
+
+/**
+ * inverse of readFloat(), IEEE float to little endian MBF bytes
+ */
+static void write_mbf( char *dst, float f )
+{
+	union {
+		uint32_t L;
+		float F;
+	} x;
+	x.F = f;
+
+	uint32_t mbf = 0;
+	if( (x.L & 0x7fffffff) != 0 ) {
+		uint32_t s = (x.L >> 8) & 0x00800000;
+		uint32_t e = ((x.L >> 23) & 0xff) + 2;
+		mbf = (e << 24) | s | (x.L & 0x007fffff);
+	}
+	mbf = htole32( mbf );
+	memcpy( dst, &mbf, 4 );
+}
+
+
+static float prices[N_VALUES];
+static float volumes[N_VALUES];
+static int ints[N_VALUES];
+static long longs[N_VALUES];
+static unsigned int dates[N_VALUES];
+static unsigned int times[N_VALUES];
+static char mbf_prices[4 * N_VALUES];
+
+#define REC_FIELDS 7
+#define REC_LEN (4 * REC_FIELDS)
+static char records[REC_LEN * N_VALUES];
+#define N_MR 1024
+static master_record mrs[N_MR];
+
+
+/**
+ * Prices are log-uniform from 0.01 to 100000 with cents or ticks, volumes
+ * log-uniform up to 1e8, dates are consecutive week days from 1980 on and
+ * times are minute bars of a trading day.
+ */
+static void init_data()
+{
+	for( int i = 0; i < N_VALUES; i++ ) {
+		double p = exp( log(0.01) + rnd_unit() * (log(100000.0) - log(0.01)) );
+		double tick = (p < 10.0) ? 10000.0 : 100.0;
+		prices[i] = floor( p * tick + 0.5 ) / tick;
+		volumes[i] = floor( exp( rnd_unit() * log(1e8) ) );
+		ints[i] = (int) rnd() - (1 << 23);
+		longs[i] = (long) rnd() * (sizeof(long) > 4 ? (long) rnd() : 1);
+		write_mbf( mbf_prices + 4 * i, prices[i] );
+	}
+
+	/* 1980-01-01 was a Tuesday */
+	int y = 1980, m = 1, d = 1, wday = 2;
+	static const int mdays[] = {31,28,31,30,31,30,31,31,30,31,30,31};
+	for( int i = 0; i < N_VALUES; ) {
+		if( wday != 0 && wday != 6 ) {
+			dates[i++] = y * 10000 + m * 100 + d;
+		}
+		wday = (wday + 1) % 7;
+		int leap = (y % 4 == 0 && (y % 100 != 0 || y % 400 == 0));
+		if( ++d > mdays[m - 1] + (m == 2 ? leap : 0) ) {
+			d = 1;
+			if( ++m > 12 ) {
+				m = 1;
+				y++;
+			}
+		}
+	}
+
+	for( int i = 0; i < N_VALUES; i++ ) {
+		int min = (9 * 60 + 30) + i % 390;
+		times[i] = (min / 60) * 10000 + (min % 60) * 100;
+	}
+
+	for( int i = 0; i < N_VALUES; i++ ) {
+		char *r = records + i * REC_LEN;
+		float o = prices[i];
+		write_mbf( r, dates[i] - 19000000 );
+		write_mbf( r + 4, o );
+		write_mbf( r + 8, o * 1.01f );
+		write_mbf( r + 12, o * 0.99f );
+		write_mbf( r + 16, o * 1.005f );
+		write_mbf( r + 20, volumes[i] );
+		write_mbf( r + 24, 0.0f );
+	}
+
+	for( int i = 0; i < N_MR; i++ ) {
+		master_record *mr = &mrs[i];
+		memset( mr, 0, sizeof(*mr) );
+		mr->record_number = i + 1;
+		mr->kind = 'X';
+		mr->file_number = 256 + i;
+		mr->field_bitset = 0x7f;
+		mr->barsize = 'D';
+		snprintf( mr->c_symbol, sizeof(mr->c_symbol), "SYM%d.L", i );
+		snprintf( mr->c_long_name, sizeof(mr->c_long_name),
+			"Some Company %d Holding PLC", i );
+		snprintf( mr->file_name, sizeof(mr->file_name), "F%d.MWD", 256 + i );
+		mr->from_date = 19800102;
+		mr->to_date = 20161230;
+	}
+}
+
+
+/**
+ * run one pass over all values of a data set, returns bytes produced
+ * (or consumed for decoders)
+ */
+typedef long (*bench_pass)();
+
+static void report( const char *name, bench_pass pass, int n_per_pass )
+{
+	long bytes = 0;
+	long values = 0;
+	double start = now();
+	double elapsed;
+	do {
+		bytes += pass();
+		values += n_per_pass;
+		elapsed = now() - start;
+	} while( elapsed < MIN_SECONDS );
+
+	printf( "%s\t%.2f\t%.3f\n", name, elapsed * 1e9 / values,
+		bytes / elapsed / 1e9 );
+}
+
+
+#define BENCH_FORMAT( _name_, _func_, _values_ ) \
+	static long _name_() \
+	{ \
+		char buf[BUF_LEN]; \
+		long bytes = 0; \
+		for( int i = 0; i < N_VALUES; i++ ) { \
+			bytes += _func_( buf, _values_[i] ); \
+		} \
+		sink += buf[0]; \
+		return bytes; \
+	}
+
+BENCH_FORMAT( bench_ftoa, ftoa, prices )
+BENCH_FORMAT( bench_ftoa_prec_f0, ftoa_prec_f0, volumes )
+BENCH_FORMAT( bench_ftoa_fixed2, ftoa_fixed<2>, prices )
+BENCH_FORMAT( bench_ftoa_scaled4, ftoa_scaled<4>, prices )
+BENCH_FORMAT( bench_ftoa_shortest, ftoa_shortest, prices )
+BENCH_FORMAT( bench_itoa, itoa, ints )
+BENCH_FORMAT( bench_ltoa, ltoa, longs )
+BENCH_FORMAT( bench_itodatestr, itodatestr, dates )
+BENCH_FORMAT( bench_itotimestr, itotimestr, times )
+
+#undef BENCH_FORMAT
+
+
+static long bench_readFloat()
+{
+	float sum = 0;
+	for( int i = 0; i < N_VALUES; i++ ) {
+		sum += readFloat( mbf_prices, 4 * i );
+	}
+	sink += (long) sum;
+	return 4 * N_VALUES;
+}
+
+
+static long bench_record_to_string()
+{
+	char buf[BUF_LEN];
+	long bytes = 0;
+	FDat fdat( records, sizeof(records), 0x7f );
+	for( int i = 0; i < N_VALUES; i++ ) {
+		bytes += fdat.record_to_string( records + i * REC_LEN, buf );
+	}
+	sink += buf[0];
+	return bytes;
+}
+
+
+static long bench_mr_record_to_string()
+{
+	char buf[MAX_SIZE_MR_STRING + 1];
+	long bytes = 0;
+	for( int i = 0; i < N_MR; i++ ) {
+		bytes += mr_record_to_string( buf, &mrs[i], 0xffff, '\t' );
+	}
+	sink += buf[0];
+	return bytes;
+}
+
+
+int main()
+{
+	init_data();
+
+	printf( "kernel\t" BENCH_VARIANT " ns/value\t" BENCH_VARIANT " GB/s\n" );
+	report( "ftoa", bench_ftoa, N_VALUES );
+	report( "ftoa_prec_f0", bench_ftoa_prec_f0, N_VALUES );
+	report( "ftoa_fixed<2>", bench_ftoa_fixed2, N_VALUES );
+	report( "ftoa_scaled<4>", bench_ftoa_scaled4, N_VALUES );
+	report( "ftoa_shortest", bench_ftoa_shortest, N_VALUES );
+	report( "itoa", bench_itoa, N_VALUES );
+	report( "ltoa", bench_ltoa, N_VALUES );
+	report( "itodatestr", bench_itodatestr, N_VALUES );
+	report( "itotimestr", bench_itotimestr, N_VALUES );
+	report( "readFloat", bench_readFloat, N_VALUES );
+	report( "record_to_string", bench_record_to_string, N_VALUES );
+	report( "mr_record_to_string", bench_mr_record_to_string, N_MR );
+	return 0;
+}
@@ -103,6 +103,30 @@
 # endif
 #endif	/* !htole32 */
 
+#if !defined htole16
+# if defined WORDS_BIGENDIAN
+#  define htole16(x)	__bswap_16(x)
+# else
+#  define htole16(x)	(x)
+# endif
+#endif	/* !htole16 */
+
+#if !defined htobe16
+# if defined WORDS_BIGENDIAN
+#  define htobe16(x)	(x)
+# else
+#  define htobe16(x)	__bswap_16(x)
+# endif
+#endif	/* !htobe16 */
+
+#if !defined htobe64
+# if defined WORDS_BIGENDIAN
+#  define htobe64(x)	(x)
+# else
+#  define htobe64(x)	__bswap_64(x)
+# endif
+#endif	/* !htobe64 */
+
 /* we could technically include byteswap.h and to the swap ourselves
  * in the missing cases.  Instead we'll just leave it as is and wait
  * for bug reports. */
@@ -0,0 +1,843 @@
+/*** col_archive.cpp -- compressed columnar archives of decoded dat files
+ *
+ * Copyright (C) 2010-2016 Ruediger Meier
+ *
+ * Author:  Ruediger Meier <sweet_f_a@gmx.de>
+ *
+ * This file is part of atem.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of any contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ***/
+
+#include "col_archive.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "stats.h"
+#include "boobs.h"
+#include "config.h"
+
+
+
+struct col_block
+{
+	int file_number;
+	int records;
+	int min_date;
+	int max_date;
+	long long offset;
+	long long size; /* not stored, from the next offset */
+};
+
+
+/* columns in dat record order, dates and times are ints */
+static const struct {
+	unsigned int field;
+	size_t offset;
+	bool is_int;
+} col_fields[8] = {
+	{ D_DAT, offsetof(ms_bar, date), true },
+	{ D_TIM, offsetof(ms_bar, time), true },
+	{ D_OPE, offsetof(ms_bar, open), false },
+	{ D_HIG, offsetof(ms_bar, high), false },
+	{ D_LOW, offsetof(ms_bar, low), false },
+	{ D_CLO, offsetof(ms_bar, close), false },
+	{ D_VOL, offsetof(ms_bar, volume), false },
+	{ D_OPI, offsetof(ms_bar, openint), false }
+};
+
+
+
+static inline void put_le32( char *dest, uint32_t n )
+{
+	n = htole32( n );
+	memcpy( dest, &n, 4 );
+}
+
+static inline void put_le64( char *dest, uint64_t n )
+{
+	put_le32( dest, (uint32_t)n );
+	put_le32( dest + 4, (uint32_t)(n >> 32) );
+}
+
+static inline uint32_t get_le32( const char *src )
+{
+	uint32_t n;
+	memcpy( &n, src, 4 );
+	return le32toh( n );
+}
+
+static inline uint64_t get_le64( const char *src )
+{
+	return get_le32( src ) | ((uint64_t)get_le32( src + 4 ) << 32);
+}
+
+static inline int clz32( uint32_t x )
+{
+#if defined __GNUC__
+	return __builtin_clz( x );
+#else
+	int n = 0;
+	for( ; !(x & 0x80000000u); x <<= 1 ) {
+		n++;
+	}
+	return n;
+#endif
+}
+
+static inline int ctz32( uint32_t x )
+{
+#if defined __GNUC__
+	return __builtin_ctz( x );
+#else
+	int n = 0;
+	for( ; !(x & 1); x >>= 1 ) {
+		n++;
+	}
+	return n;
+#endif
+}
+
+
+
+/* bits are written MSB first, the last byte is padded with zeros */
+struct bit_writer
+{
+	unsigned char *p;
+	uint64_t acc;
+	int n;
+};
+
+/* put up to 32 bits */
+static inline void put_bits( bit_writer *w, uint32_t v, int bits )
+{
+	w->acc = (w->acc << bits) | v;
+	w->n += bits;
+	while( w->n >= 8 ) {
+		w->n -= 8;
+		*w->p++ = (unsigned char)(w->acc >> w->n);
+	}
+}
+
+static inline void flush_bits( bit_writer *w )
+{
+	if( w->n > 0 ) {
+		*w->p++ = (unsigned char)(w->acc << (8 - w->n));
+		w->n = 0;
+	}
+}
+
+struct bit_reader
+{
+	const unsigned char *p;
+	const unsigned char *end;
+	uint64_t acc;
+	int n;
+	bool overrun;
+};
+
+/* get up to 32 bits, zeros behind the end */
+static inline uint32_t get_bits( bit_reader *r, int bits )
+{
+	while( r->n < bits ) {
+		if( r->p < r->end ) {
+			r->acc = (r->acc << 8) | *r->p++;
+		} else {
+			r->acc <<= 8;
+			r->overrun = true;
+		}
+		r->n += 8;
+	}
+	r->n -= bits;
+	return (uint32_t)(r->acc >> r->n) & (uint32_t)((1ULL << bits) - 1);
+}
+
+
+/**
+ * Delta-of-delta coding of int columns, the first value is stored as is.
+ * Zigzag coded dods are prefixed by 0 (dod 0), 10 (7 bits), 110 (12 bits),
+ * 1110 (20 bits) or 1111 (36 bits).
+ */
+static void put_dod( bit_writer *w, const uint32_t *col, int cnt )
+{
+	put_bits( w, col[0], 32 );
+	int64_t prev = (int32_t)col[0];
+	int64_t prev_delta = 0;
+	for( int i = 1; i < cnt; i++ ) {
+		int64_t v = (int32_t)col[i];
+		int64_t delta = v - prev;
+		int64_t dod = delta - prev_delta;
+		uint64_t zz = ((uint64_t)dod << 1) ^ (uint64_t)(dod >> 63);
+		if( zz == 0 ) {
+			put_bits( w, 0, 1 );
+		} else if( zz < (1 << 7) ) {
+			put_bits( w, 2, 2 );
+			put_bits( w, zz, 7 );
+		} else if( zz < (1 << 12) ) {
+			put_bits( w, 6, 3 );
+			put_bits( w, zz, 12 );
+		} else if( zz < (1 << 20) ) {
+			put_bits( w, 14, 4 );
+			put_bits( w, zz, 20 );
+		} else {
+			put_bits( w, 15, 4 );
+			put_bits( w, (uint32_t)(zz >> 32), 4 );
+			put_bits( w, (uint32_t)zz, 32 );
+		}
+		prev = v;
+		prev_delta = delta;
+	}
+}
+
+static void get_dod( bit_reader *r, uint32_t *col, int cnt )
+{
+	col[0] = get_bits( r, 32 );
+	int64_t prev = (int32_t)col[0];
+	int64_t prev_delta = 0;
+	for( int i = 1; i < cnt; i++ ) {
+		uint64_t zz;
+		if( get_bits( r, 1 ) == 0 ) {
+			zz = 0;
+		} else if( get_bits( r, 1 ) == 0 ) {
+			zz = get_bits( r, 7 );
+		} else if( get_bits( r, 1 ) == 0 ) {
+			zz = get_bits( r, 12 );
+		} else if( get_bits( r, 1 ) == 0 ) {
+			zz = get_bits( r, 20 );
+		} else {
+			zz = (uint64_t)get_bits( r, 4 ) << 32;
+			zz |= get_bits( r, 32 );
+		}
+		int64_t dod = (int64_t)(zz >> 1) ^ -(int64_t)(zz & 1);
+		prev_delta += dod;
+		prev += prev_delta;
+		col[i] = (uint32_t)prev;
+	}
+}
+
+/**
+ * XOR coding of float columns against the previous value. Prefix 0 means
+ * equal, 10 reuses the previous window of meaningful bits, 11 is followed
+ * by 5 bits leading zeros, 5 bits length - 1 and the meaningful bits.
+ */
+static void put_xor( bit_writer *w, const uint32_t *col, int cnt )
+{
+	put_bits( w, col[0], 32 );
+	uint32_t prev = col[0];
+	int prev_lz = -1;
+	int prev_tz = 0;
+	for( int i = 1; i < cnt; i++ ) {
+		uint32_t x = col[i] ^ prev;
+		if( x == 0 ) {
+			put_bits( w, 0, 1 );
+		} else {
+			int lz = clz32( x );
+			int tz = ctz32( x );
+			if( prev_lz >= 0 && lz >= prev_lz && tz >= prev_tz ) {
+				put_bits( w, 2, 2 );
+				put_bits( w, x >> prev_tz, 32 - prev_lz - prev_tz );
+			} else {
+				int len = 32 - lz - tz;
+				put_bits( w, 3, 2 );
+				put_bits( w, lz, 5 );
+				put_bits( w, len - 1, 5 );
+				put_bits( w, x >> tz, len );
+				prev_lz = lz;
+				prev_tz = tz;
+			}
+		}
+		prev = col[i];
+	}
+}
+
+static void get_xor( bit_reader *r, uint32_t *col, int cnt )
+{
+	col[0] = get_bits( r, 32 );
+	uint32_t prev = col[0];
+	int prev_lz = -1;
+	int prev_tz = 0;
+	for( int i = 1; i < cnt; i++ ) {
+		if( get_bits( r, 1 ) == 0 ) {
+			col[i] = prev;
+			continue;
+		}
+		if( get_bits( r, 1 ) == 0 ) {
+			if( prev_lz < 0 ) {
+				/* corrupt, no window yet */
+				r->overrun = true;
+				return;
+			}
+			prev ^= get_bits( r, 32 - prev_lz - prev_tz ) << prev_tz;
+		} else {
+			int lz = get_bits( r, 5 );
+			int len = get_bits( r, 5 ) + 1;
+			if( lz + len > 32 ) {
+				r->overrun = true;
+				return;
+			}
+			prev_lz = lz;
+			prev_tz = 32 - lz - len;
+			prev ^= get_bits( r, len ) << prev_tz;
+		}
+		col[i] = prev;
+	}
+}
+
+
+
+ColWriter::ColWriter( void *_out ) :
+	out( _out ),
+	offset( 0 ),
+	bars( (ms_bar*) malloc( COL_BLOCK_RECORDS * sizeof(ms_bar) ) ),
+	bars_len( 0 ),
+	data( (char*) malloc( COL_SIZE_BLOCK_HEADER + COL_MAX_BLOCK_DATA ) ),
+	sym_len( 0 ),
+	sym_size( 0 ),
+	symbols( NULL ),
+	idx_len( 0 ),
+	idx_size( 0 ),
+	index( NULL )
+{
+	memset( &cur, 0, sizeof(cur) );
+}
+
+ColWriter::~ColWriter()
+{
+	free( index );
+	free( symbols );
+	free( data );
+	free( bars );
+}
+
+
+bool ColWriter::write( const char *buf, long long len )
+{
+	size_t written = fwrite( buf, 1, len, (FILE*)out );
+	stats_count( SC_BYTES_WRITTEN, written );
+	offset += written;
+	return (long long)written == len;
+}
+
+
+bool ColWriter::begin()
+{
+	char buf[COL_SIZE_HEADER];
+	memset( buf, 0, sizeof(buf) );
+	strcpy( buf, COL_MAGIC );
+	put_le32( buf + 8, COL_VERSION );
+	put_le32( buf + 12, COL_BLOCK_RECORDS );
+	return write( buf, sizeof(buf) );
+}
+
+
+/**
+ * start a new symbol, its bars have the columns of mr->field_bitset
+ */
+void ColWriter::beginSymbol( const master_record *mr )
+{
+	assert( bars_len == 0 );
+	if( sym_len >= sym_size ) {
+		sym_size += 256;
+		symbols = (master_record*) realloc( symbols,
+			sym_size * sizeof(master_record) );
+	}
+	cur = *mr;
+	symbols[sym_len++] = cur;
+}
+
+
+bool ColWriter::addBars( const ms_bar *b, long long cnt )
+{
+	while( cnt > 0 ) {
+		int n = COL_BLOCK_RECORDS - bars_len;
+		if( n > cnt ) {
+			n = cnt;
+		}
+		memcpy( bars + bars_len, b, n * sizeof(ms_bar) );
+		bars_len += n;
+		b += n;
+		cnt -= n;
+		if( bars_len == COL_BLOCK_RECORDS && !flushBlock() ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+bool ColWriter::endSymbol()
+{
+	return (bars_len == 0) || flushBlock();
+}
+
+
+/**
+ * encode and write the buffered bars of the current symbol as one block
+ */
+bool ColWriter::flushBlock()
+{
+	uint32_t col[COL_BLOCK_RECORDS];
+	bit_writer w = { (unsigned char*)data + COL_SIZE_BLOCK_HEADER, 0, 0 };
+	int min_date = 0;
+	int max_date = 0;
+
+	for( int f = 0; f < 8; f++ ) {
+		if( !(cur.field_bitset & col_fields[f].field) ) {
+			continue;
+		}
+		for( int i = 0; i < bars_len; i++ ) {
+			memcpy( &col[i], (const char*)&bars[i] + col_fields[f].offset, 4 );
+		}
+		if( col_fields[f].is_int ) {
+			put_dod( &w, col, bars_len );
+		} else {
+			put_xor( &w, col, bars_len );
+		}
+		flush_bits( &w );
+	}
+
+	if( cur.field_bitset & D_DAT ) {
+		min_date = max_date = bars[0].date;
+		for( int i = 1; i < bars_len; i++ ) {
+			if( bars[i].date < min_date ) {
+				min_date = bars[i].date;
+			} else if( bars[i].date > max_date ) {
+				max_date = bars[i].date;
+			}
+		}
+	}
+
+	int data_len = (char*)w.p - data - COL_SIZE_BLOCK_HEADER;
+	assert( data_len <= COL_MAX_BLOCK_DATA );
+	put_le32( data, cur.file_number );
+	put_le32( data + 4, bars_len );
+	put_le32( data + 8, data_len );
+	put_le32( data + 12, cur.field_bitset );
+
+	if( idx_len >= idx_size ) {
+		idx_size += 1024;
+		index = (col_block*) realloc( index, idx_size * sizeof(col_block) );
+	}
+	col_block *cb = &index[idx_len++];
+	cb->file_number = cur.file_number;
+	cb->records = bars_len;
+	cb->min_date = min_date;
+	cb->max_date = max_date;
+	cb->offset = offset;
+	cb->size = COL_SIZE_BLOCK_HEADER + data_len;
+
+	bars_len = 0;
+	return write( data, cb->size );
+}
+
+
+/**
+ * write symbols, index and footer
+ */
+bool ColWriter::finish()
+{
+	char buf[COL_SIZE_SYMBOL];
+	const long long sym_offset = offset;
+
+	assert( bars_len == 0 );
+	for( int s = 0; s < sym_len; s++ ) {
+		const master_record *mr = &symbols[s];
+		memset( buf, 0, sizeof(buf) );
+		buf[0] = mr->file_number & 0xff;
+		buf[1] = mr->file_number >> 8;
+		buf[2] = mr->record_number & 0xff;
+		buf[3] = mr->record_number >> 8;
+		put_le32( buf + 4, mr->from_date );
+		put_le32( buf + 8, mr->to_date );
+		buf[12] = mr->field_bitset;
+		buf[13] = mr->barsize;
+		buf[14] = mr->kind;
+		strcpy( buf + 16, mr->c_symbol );
+		strcpy( buf + 32, mr->c_long_name );
+		strcpy( buf + 80, mr->file_name );
+		if( !write( buf, COL_SIZE_SYMBOL ) ) {
+			return false;
+		}
+	}
+
+	const long long idx_offset = offset;
+	for( int b = 0; b < idx_len; b++ ) {
+		const col_block *cb = &index[b];
+		put_le32( buf, cb->file_number );
+		put_le32( buf + 4, cb->records );
+		put_le32( buf + 8, cb->min_date );
+		put_le32( buf + 12, cb->max_date );
+		put_le64( buf + 16, cb->offset );
+		if( !write( buf, COL_SIZE_INDEX ) ) {
+			return false;
+		}
+	}
+
+	put_le64( buf, sym_offset );
+	put_le32( buf + 8, sym_len );
+	put_le32( buf + 12, idx_len );
+	put_le64( buf + 16, idx_offset );
+	memcpy( buf + 24, COL_END_MAGIC, 8 );
+	if( !write( buf, COL_SIZE_FOOTER ) ) {
+		return false;
+	}
+	return fflush( (FILE*)out ) == 0;
+}
+
+
+
+
+static long long col_pread( int fd, char *dst, long long len, long long off )
+{
+	long long done = 0;
+	if( lseek( fd, off, SEEK_SET ) < 0 ) {
+		return -1;
+	}
+	while( done < len ) {
+		ssize_t tmp = read( fd, dst + done, len - done );
+		if( tmp < 0 ) {
+			return -1;
+		} else if( tmp == 0 ) {
+			break;
+		}
+		done += tmp;
+	}
+	stats_count( SC_BYTES_READ, done );
+	return done;
+}
+
+static int col_open( const char *path )
+{
+#if defined _WIN32
+	return ::open( path, _O_RDONLY | _O_BINARY );
+#else
+	return ::open( path, O_RDONLY );
+#endif
+}
+
+
+ColArchive::ColArchive() :
+	fd( -1 ),
+	path( NULL ),
+	ar_mtime( 0 ),
+	ar_size( 0 ),
+	sym_len( 0 ),
+	symbols( NULL ),
+	idx_len( 0 ),
+	index( NULL ),
+	data( NULL ),
+	bars( NULL )
+{
+	error[0] = '\0';
+}
+
+ColArchive::~ColArchive()
+{
+	if( fd >= 0 ) {
+		close( fd );
+	}
+	free( bars );
+	free( data );
+	free( index );
+	free( symbols );
+	free( path );
+}
+
+
+/**
+ * returns true if path is a regular file starting with our magic
+ */
+bool ColArchive::isColArchive( const char *path )
+{
+	char magic[8];
+	int f = col_open( path );
+	if( f < 0 ) {
+		return false;
+	}
+	bool ret = read( f, magic, 8 ) == 8
+		&& memcmp( magic, COL_MAGIC, sizeof(COL_MAGIC) ) == 0;
+	close( f );
+	return ret;
+}
+
+
+bool ColArchive::open( const char *_path )
+{
+	char buf[COL_SIZE_SYMBOL];
+	struct stat s;
+
+	path = strdup( _path );
+	fd = col_open( path );
+	if( fd < 0 || fstat( fd, &s ) < 0 ) {
+		setError( path, strerror(errno) );
+		return false;
+	}
+	ar_mtime = s.st_mtime;
+	ar_size = s.st_size;
+
+	if( ar_size < COL_SIZE_HEADER + COL_SIZE_FOOTER
+			|| col_pread( fd, buf, COL_SIZE_HEADER, 0 ) != COL_SIZE_HEADER
+			|| memcmp( buf, COL_MAGIC, sizeof(COL_MAGIC) ) != 0 ) {
+		setError( path, "not a columnar archive" );
+		return false;
+	}
+	if( get_le32( buf + 8 ) != COL_VERSION
+			|| get_le32( buf + 12 ) > COL_BLOCK_RECORDS ) {
+		setError( path, "unsupported columnar archive version" );
+		return false;
+	}
+
+	if( col_pread( fd, buf, COL_SIZE_FOOTER, ar_size - COL_SIZE_FOOTER )
+			!= COL_SIZE_FOOTER
+			|| memcmp( buf + 24, COL_END_MAGIC, 8 ) != 0 ) {
+		setError( path, "columnar archive truncated" );
+		return false;
+	}
+	const long long sym_offset = get_le64( buf );
+	sym_len = get_le32( buf + 8 );
+	idx_len = get_le32( buf + 12 );
+	const long long idx_offset = get_le64( buf + 16 );
+	if( sym_offset < COL_SIZE_HEADER || sym_len < 0 || idx_len < 0
+			|| sym_offset + (long long)sym_len * COL_SIZE_SYMBOL != idx_offset
+			|| idx_offset + (long long)idx_len * COL_SIZE_INDEX
+				!= ar_size - COL_SIZE_FOOTER ) {
+		setError( path, "columnar archive corrupt" );
+		return false;
+	}
+
+	symbols = (master_record*) calloc( sym_len + 1, sizeof(master_record) );
+	for( int i = 0; i < sym_len; i++ ) {
+		if( col_pread( fd, buf, COL_SIZE_SYMBOL,
+				sym_offset + (long long)i * COL_SIZE_SYMBOL )
+				!= COL_SIZE_SYMBOL ) {
+			setError( path, strerror(errno) );
+			return false;
+		}
+		master_record *mr = &symbols[i];
+		mr->file_number = (unsigned char)buf[0]
+			| ((unsigned char)buf[1] << 8);
+		if( mr->file_number == 0 ) {
+			setError( path, "columnar archive corrupt" );
+			return false;
+		}
+		mr->record_number = (unsigned char)buf[2]
+			| ((unsigned char)buf[3] << 8);
+		mr->from_date = get_le32( buf + 4 );
+		mr->to_date = get_le32( buf + 8 );
+		mr->field_bitset = buf[12];
+		mr->barsize = buf[13];
+		mr->kind = buf[14];
+		memcpy( mr->c_symbol, buf + 16, MAX_LEN_MR_SYMBOL );
+		memcpy( mr->c_long_name, buf + 32, MAX_LEN_MR_LNAME );
+		memcpy( mr->file_name, buf + 80, MAX_LEN_MR_FILENAME );
+	}
+
+	index = (col_block*) calloc( idx_len + 1, sizeof(col_block) );
+	for( int b = 0; b < idx_len; b++ ) {
+		if( col_pread( fd, buf, COL_SIZE_INDEX,
+				idx_offset + (long long)b * COL_SIZE_INDEX )
+				!= COL_SIZE_INDEX ) {
+			setError( path, strerror(errno) );
+			return false;
+		}
+		col_block *cb = &index[b];
+		cb->file_number = get_le32( buf );
+		cb->records = get_le32( buf + 4 );
+		cb->min_date = get_le32( buf + 8 );
+		cb->max_date = get_le32( buf + 12 );
+		cb->offset = get_le64( buf + 16 );
+		if( b > 0 ) {
+			index[b - 1].size = cb->offset - index[b - 1].offset;
+		}
+	}
+	if( idx_len > 0 ) {
+		index[idx_len - 1].size = sym_offset - index[idx_len - 1].offset;
+	}
+
+	for( int b = 0; b < idx_len; b++ ) {
+		const col_block *cb = &index[b];
+		if( cb->records <= 0 || cb->records > COL_BLOCK_RECORDS
+				|| cb->size < COL_SIZE_BLOCK_HEADER
+				|| cb->size > COL_SIZE_BLOCK_HEADER + COL_MAX_BLOCK_DATA
+				|| (b > 0 && cb->file_number < index[b - 1].file_number) ) {
+			setError( path, "columnar archive index corrupt" );
+			return false;
+		}
+	}
+
+	data = (char*) malloc( COL_SIZE_BLOCK_HEADER + COL_MAX_BLOCK_DATA );
+	bars = (ms_bar*) malloc( COL_BLOCK_RECORDS * sizeof(ms_bar) );
+	return true;
+}
+
+
+int ColArchive::countSymbols() const
+{
+	return sym_len;
+}
+
+const master_record* ColArchive::symbol( int s ) const
+{
+	return &symbols[s];
+}
+
+/* there are no member times, all symbols have the archive's mtime */
+time_t ColArchive::mtime() const
+{
+	return ar_mtime;
+}
+
+int ColArchive::countBlocks() const
+{
+	return idx_len;
+}
+
+/**
+ * first block of a file or -1, the blocks of a file are consecutive
+ */
+int ColArchive::firstBlock( int file_number ) const
+{
+	int lo = 0;
+	int hi = idx_len;
+	while( lo < hi ) {
+		int mid = (lo + hi) / 2;
+		if( index[mid].file_number < file_number ) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return (lo < idx_len && index[lo].file_number == file_number) ? lo : -1;
+}
+
+int ColArchive::blockFile( int b ) const
+{
+	return index[b].file_number;
+}
+
+int ColArchive::blockRecords( int b ) const
+{
+	return index[b].records;
+}
+
+int ColArchive::blockMinDate( int b ) const
+{
+	return index[b].min_date;
+}
+
+int ColArchive::blockMaxDate( int b ) const
+{
+	return index[b].max_date;
+}
+
+long long ColArchive::blockSize( int b ) const
+{
+	return index[b].size;
+}
+
+
+/**
+ * Read and decode a block, bars points to an internal buffer which is valid
+ * until the next call. Returns the number of bars or -1 on error.
+ */
+int ColArchive::readBlock( int b, ms_bar **_bars ) const
+{
+	const col_block *cb = &index[b];
+	uint32_t col[COL_BLOCK_RECORDS];
+
+	if( col_pread( fd, data, cb->size, cb->offset ) != cb->size ) {
+		setError( path, "columnar archive truncated" );
+		return -1;
+	}
+	const int cnt = get_le32( data + 4 );
+	const unsigned int fields = get_le32( data + 12 );
+	if( (int)get_le32( data ) != cb->file_number || cnt != cb->records
+			|| (long long)get_le32( data + 8 ) != cb->size - COL_SIZE_BLOCK_HEADER
+			|| fields > 0xff ) {
+		setError( path, "columnar archive block corrupt" );
+		return -1;
+	}
+
+	for( int i = 0; i < cnt; i++ ) {
+		ms_bar *bar = &bars[i];
+		bar->date = bar->time = 0;
+		bar->open = bar->high = bar->low = bar->close = -0.0;
+		bar->volume = bar->openint = -0.0;
+	}
+
+	bit_reader r = { (const unsigned char*)data + COL_SIZE_BLOCK_HEADER,
+		(const unsigned char*)data + cb->size, 0, 0, false };
+	for( int f = 0; f < 8; f++ ) {
+		if( !(fields & col_fields[f].field) ) {
+			continue;
+		}
+		if( col_fields[f].is_int ) {
+			get_dod( &r, col, cnt );
+		} else {
+			get_xor( &r, col, cnt );
+		}
+		/* columns start at byte boundaries */
+		r.n = 0;
+		for( int i = 0; i < cnt; i++ ) {
+			memcpy( (char*)&bars[i] + col_fields[f].offset, &col[i], 4 );
+		}
+	}
+	if( r.overrun ) {
+		setError( path, "columnar archive block corrupt" );
+		return -1;
+	}
+
+	*_bars = bars;
+	return cnt;
+}
+
+
+const char* ColArchive::lastError() const
+{
+	return error;
+}
+
+void ColArchive::setError( const char* e1, const char* e2 ) const
+{
+	if( e2 == NULL || *e2 == '\0' ) {
+		snprintf( error, COL_ERROR_LENGTH, "%s", e1);
+	} else {
+		snprintf( error, COL_ERROR_LENGTH, "%s: %s", e1, e2 );
+	}
+}
@@ -0,0 +1,161 @@
+/*** col_archive.h -- compressed columnar archives of decoded dat files
+ *
+ * Copyright (C) 2010-2016 Ruediger Meier
+ *
+ * Author:  Ruediger Meier <sweet_f_a@gmx.de>
+ *
+ * This file is part of atem.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of any contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ***/
+
+#ifndef ATEM_COL_ARCHIVE_H
+#define ATEM_COL_ARCHIVE_H
+
+#include <time.h>
+
+#include "ms_file.h"
+
+
+/* Columnar archive, all numbers are little endian:
+   header:  char magic[8], uint32 version, max records per block
+   blocks:  uint32 file number, records, data length, field bitset
+            + data, the present columns one after another as bit streams
+   symbols: n x COL_SIZE_SYMBOL, the master records
+   index:   n x { uint32 file number, records, int32 min date, max date,
+            uint64 block offset }, ordered by file number
+   footer:  uint64 symbols offset, uint32 n symbols, n blocks,
+            uint64 index offset, char magic[8]
+   Dates and times are delta-of-delta coded, floats are XOR coded against
+   the previous value of the column (like Facebook's Gorilla). */
+#define COL_MAGIC "ATEMCOL"
+#define COL_END_MAGIC "ATEMCEND"
+#define COL_VERSION 1
+#define COL_BLOCK_RECORDS 4096
+#define COL_SIZE_HEADER 16
+#define COL_SIZE_BLOCK_HEADER 16
+#define COL_SIZE_SYMBOL ( 16 + 16 + 48 + 12 )
+#define COL_SIZE_INDEX 24
+#define COL_SIZE_FOOTER 32
+/* at most 44 bits per value (float with new window) and 8 columns */
+#define COL_MAX_BLOCK_DATA ( COL_BLOCK_RECORDS * 44 + 64 )
+#define COL_ERROR_LENGTH 256
+
+struct col_block;
+
+
+/**
+ * Writes bars symbol by symbol. Blocks are written as soon as they are
+ * full, symbols and index are kept until finish().
+ */
+class ColWriter
+{
+	public:
+		ColWriter( void *out );
+		~ColWriter();
+
+		bool begin();
+		void beginSymbol( const master_record *mr );
+		bool addBars( const ms_bar *bars, long long cnt );
+		bool endSymbol();
+		bool finish();
+
+	private:
+		bool write( const char *buf, long long len );
+		bool flushBlock();
+
+		void *out;
+		long long offset;
+
+		master_record cur;
+		ms_bar *bars;
+		int bars_len;
+		char *data;
+
+		int sym_len;
+		int sym_size;
+		master_record *symbols;
+
+		int idx_len;
+		int idx_size;
+		col_block *index;
+};
+
+
+/**
+ * Read only view of a columnar archive, blocks are read on demand.
+ */
+class ColArchive
+{
+	public:
+		ColArchive();
+		~ColArchive();
+
+		static bool isColArchive( const char *path );
+
+		bool open( const char *path );
+
+		int countSymbols() const;
+		const master_record* symbol( int s ) const;
+		time_t mtime() const;
+
+		int countBlocks() const;
+		int firstBlock( int file_number ) const;
+		int blockFile( int b ) const;
+		int blockRecords( int b ) const;
+		int blockMinDate( int b ) const;
+		int blockMaxDate( int b ) const;
+		long long blockSize( int b ) const;
+		int readBlock( int b, ms_bar **bars ) const;
+
+		const char* lastError() const;
+
+	private:
+		void setError( const char* e1, const char* e2 = "" ) const;
+
+		int fd;
+		char *path;
+		time_t ar_mtime;
+		long long ar_size;
+
+		int sym_len;
+		master_record *symbols;
+
+		int idx_len;
+		col_block *index;
+
+		char *data;
+		ms_bar *bars;
+
+		mutable char error[COL_ERROR_LENGTH];
+};
+
+
+
+#endif
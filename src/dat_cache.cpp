@@ -0,0 +1,433 @@
+/*** dat_cache.cpp -- cache of decoded dat files
+ *
+ * Copyright (C) 2010-2016 Ruediger Meier
+ *
+ * Author:  Ruediger Meier <sweet_f_a@gmx.de>
+ *
+ * This file is part of atem.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of any contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ***/
+
+#include "dat_cache.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <limits.h>
+#include <math.h>
+
+#include <fcntl.h>
+#if ! defined _WIN32
+# include <sys/mman.h>
+#endif
+
+#include "stats.h"
+#include "config.h"
+
+
+
+struct dc_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t item_size;
+	uint32_t bom;
+	uint32_t fields;
+	int64_t size;
+	int64_t mtime;
+	int64_t records;
+	uint32_t path_len;
+};
+
+/* path and items start at 8 byte boundaries */
+#define DC_PAD8( _n_ ) ( ((_n_) + 7) & ~7 )
+
+
+DatCache::DatCache( const char *_suffix, int _item_size ) :
+	suffix( _suffix ),
+	item_size( _item_size ),
+	dir( NULL ),
+	key( NULL ),
+	cache_file( NULL ),
+	map( NULL ),
+	map_len( 0 ),
+	tmp_file( NULL ),
+	tmp_fd( -1 ),
+	tmp_cnt( 0 )
+{
+	error[0] = '\0';
+}
+
+DatCache::~DatCache()
+{
+	abortStore();
+	release();
+	free( cache_file );
+	free( key );
+	free( dir );
+}
+
+
+/**
+ * use (and create) the cache directory dir
+ */
+bool DatCache::setDir( const char *d )
+{
+	struct stat s;
+#if defined _WIN32
+	int ret = mkdir( d );
+#else
+	int ret = mkdir( d, 0777 );
+#endif
+	if( (ret < 0 && errno != EEXIST) || stat( d, &s ) < 0 ) {
+		setError( d, strerror(errno) );
+		return false;
+	}
+	if( !S_ISDIR(s.st_mode) ) {
+		setError( d, strerror(ENOTDIR) );
+		return false;
+	}
+
+	int len = strlen( d );
+	dir = (char*) realloc( dir, len + 2 );
+	strcpy( dir, d );
+	if( len > 0 && dir[len - 1] != '/' ) {
+		strcpy( dir + len, "/" );
+	}
+	return true;
+}
+
+
+/**
+ * set the real path of a dat file as key and the matching cache file name,
+ * a 64 bit FNV-1a hash of the key
+ */
+bool DatCache::setKey( const char *path )
+{
+	free( key );
+#if defined _WIN32
+	key = _fullpath( NULL, path, 0 );
+#else
+	key = realpath( path, NULL );
+#endif
+	if( key == NULL ) {
+		setError( path, strerror(errno) );
+		return false;
+	}
+
+	uint64_t h = 14695981039346656037ULL;
+	for( const char *c = key; *c != '\0'; c++ ) {
+		h ^= (unsigned char)*c;
+		h *= 1099511628211ULL;
+	}
+
+	free( cache_file );
+	cache_file = (char*) malloc( strlen(dir) + 16 + strlen(suffix) + 1 );
+	sprintf( cache_file, "%s%016llx%s", dir, (unsigned long long)h, suffix );
+	return true;
+}
+
+
+/**
+ * Look up the items of the dat file path. Returns the number of items or -1
+ * if the cache has no valid entry for its current size and mtime. The items
+ * may be modified and are valid until release().
+ */
+long long DatCache::load( const char *path, const struct stat *s,
+	unsigned char fields, void **items )
+{
+	struct stat cs;
+	dc_header h;
+
+	release();
+	if( !setKey( path ) ) {
+		return -1;
+	}
+
+#if defined _WIN32
+	int fd = open( cache_file, _O_RDONLY | _O_BINARY );
+#else
+	int fd = open( cache_file, O_RDONLY );
+#endif
+	if( fd < 0 ) {
+		return -1;
+	}
+	if( fstat( fd, &cs ) < 0 || cs.st_size < DC_SIZE_HEADER ) {
+		close( fd );
+		return -1;
+	}
+
+	map_len = cs.st_size;
+#if defined _WIN32
+	map = (char*) malloc( map_len );
+	if( read( fd, map, map_len ) != map_len ) {
+		free( map );
+		map = NULL;
+	}
+#else
+	map = (char*) mmap( NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		fd, 0 );
+	if( map == MAP_FAILED ) {
+		map = NULL;
+	}
+#endif
+	close( fd );
+	if( map == NULL ) {
+		return -1;
+	}
+
+	memcpy( &h, map, sizeof(h) );
+	const long long items_off = DC_SIZE_HEADER + DC_PAD8( h.path_len + 1 );
+	if( memcmp( h.magic, DC_MAGIC, sizeof(DC_MAGIC) ) != 0
+			|| h.version != DC_VERSION
+			|| h.item_size != (uint32_t)item_size
+			|| h.bom != DC_BOM
+			|| h.fields != fields
+			|| h.size != (int64_t)s->st_size
+			|| h.mtime != (int64_t)s->st_mtime
+			|| h.path_len != strlen( key )
+			|| items_off + h.records * item_size != map_len
+			|| memcmp( map + DC_SIZE_HEADER, key, h.path_len + 1 ) != 0 ) {
+		/* stale or from another machine, will be replaced */
+		release();
+		return -1;
+	}
+
+	stats_count( SC_BYTES_READ, map_len );
+	*items = map + items_off;
+	return h.records;
+}
+
+void DatCache::release()
+{
+	if( map != NULL ) {
+#if defined _WIN32
+		free( map );
+#else
+		munmap( map, map_len );
+#endif
+		map = NULL;
+		map_len = 0;
+	}
+}
+
+
+/**
+ * Start a new cache entry for dat file path. The entry is written to a
+ * temporary file which replaces the old entry in commitStore().
+ */
+bool DatCache::beginStore( const char *path, const struct stat *s,
+	unsigned char fields )
+{
+	char buf[DC_SIZE_HEADER];
+	dc_header h;
+
+	assert( tmp_fd < 0 );
+	if( !setKey( path ) ) {
+		return false;
+	}
+
+	/* unique per process, a leftover of a crashed process is replaced */
+	tmp_file = (char*) malloc( strlen(cache_file) + 32 );
+	sprintf( tmp_file, "%s.%ld.tmp", cache_file, (long)getpid() );
+	unlink( tmp_file );
+#if defined _WIN32
+	tmp_fd = open( tmp_file, _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY,
+		_S_IREAD | _S_IWRITE );
+#else
+	tmp_fd = open( tmp_file, O_WRONLY | O_CREAT | O_EXCL, 0666 );
+#endif
+	if( tmp_fd < 0 ) {
+		setError( tmp_file, strerror(errno) );
+		free( tmp_file );
+		tmp_file = NULL;
+		return false;
+	}
+	tmp_cnt = 0;
+
+	memset( &h, 0, sizeof(h) );
+	memcpy( h.magic, DC_MAGIC, sizeof(DC_MAGIC) );
+	h.version = DC_VERSION;
+	h.item_size = item_size;
+	h.bom = DC_BOM;
+	h.fields = fields;
+	h.size = s->st_size;
+	h.mtime = s->st_mtime;
+	h.records = 0;
+	h.path_len = strlen( key );
+
+	assert( sizeof(h) <= DC_SIZE_HEADER );
+	memset( buf, 0, sizeof(buf) );
+	memcpy( buf, &h, sizeof(h) );
+
+	/* path with zero padding */
+	const int path_size = DC_PAD8( h.path_len + 1 );
+	char path_buf[path_size];
+	memset( path_buf, 0, path_size );
+	memcpy( path_buf, key, h.path_len );
+
+	if( !write( buf, DC_SIZE_HEADER ) || !write( path_buf, path_size ) ) {
+		abortStore();
+		return false;
+	}
+	return true;
+}
+
+bool DatCache::storing() const
+{
+	return tmp_fd >= 0;
+}
+
+bool DatCache::storeItems( const void *items, long long cnt )
+{
+	if( !write( items, cnt * item_size ) ) {
+		abortStore();
+		return false;
+	}
+	tmp_cnt += cnt;
+	return true;
+}
+
+/**
+ * set the number of items and replace the old entry atomically
+ */
+bool DatCache::commitStore()
+{
+	int64_t records = tmp_cnt;
+	bool ok = lseek( tmp_fd, offsetof(dc_header, records), SEEK_SET ) >= 0
+		&& ::write( tmp_fd, &records, sizeof(records) ) == sizeof(records);
+	if( close( tmp_fd ) < 0 ) {
+		ok = false;
+	}
+	tmp_fd = -1;
+#if defined _WIN32
+	/* rename does not replace existing files */
+	if( ok ) {
+		unlink( cache_file );
+	}
+#endif
+	if( !ok || rename( tmp_file, cache_file ) < 0 ) {
+		setError( tmp_file, strerror(errno) );
+		unlink( tmp_file );
+		ok = false;
+	}
+	free( tmp_file );
+	tmp_file = NULL;
+	return ok;
+}
+
+void DatCache::abortStore()
+{
+	if( tmp_fd >= 0 ) {
+		close( tmp_fd );
+		tmp_fd = -1;
+		unlink( tmp_file );
+	}
+	free( tmp_file );
+	tmp_file = NULL;
+}
+
+
+void zm_init( zm_block *z )
+{
+	memset( z, 0, sizeof(*z) );
+}
+
+/* a NaN in a block makes its range infinite, it never prunes */
+static inline void zm_range( float v, float *min, float *max, bool first )
+{
+	if( v != v ) {
+		*min = -HUGE_VALF;
+		*max = HUGE_VALF;
+	} else if( first ) {
+		*min = *max = v;
+	} else if( v < *min ) {
+		*min = v;
+	} else if( v > *max ) {
+		*max = v;
+	}
+}
+
+/**
+ * extend block z by cnt bars
+ */
+void zm_add( zm_block *z, const ms_bar *bars, long long cnt )
+{
+	for( long long i = 0; i < cnt; i++ ) {
+		const ms_bar *b = &bars[i];
+		const bool first = z->records == 0;
+		if( first ) {
+			z->min_date = z->max_date = b->date;
+		} else if( b->date < z->min_date ) {
+			z->min_date = b->date;
+		} else if( b->date > z->max_date ) {
+			z->max_date = b->date;
+		}
+		zm_range( b->close, &z->min_close, &z->max_close, first );
+		zm_range( b->volume, &z->min_volume, &z->max_volume, first );
+		z->records++;
+	}
+}
+
+
+bool DatCache::write( const void *buf, long long len )
+{
+	const char *p = (const char*)buf;
+	while( len > 0 ) {
+		ssize_t tmp = ::write( tmp_fd, p, len );
+		if( tmp < 0 ) {
+			setError( tmp_file, strerror(errno) );
+			return false;
+		}
+		p += tmp;
+		len -= tmp;
+	}
+	return true;
+}
+
+
+const char* DatCache::lastError() const
+{
+	return error;
+}
+
+void DatCache::setError( const char* e1, const char* e2 ) const
+{
+	if( e2 == NULL || *e2 == '\0' ) {
+		snprintf( error, DC_ERROR_LENGTH, "%s", e1);
+	} else {
+		snprintf( error, DC_ERROR_LENGTH, "%s: %s", e1, e2 );
+	}
+}
@@ -0,0 +1,134 @@
+/*** dat_cache.h -- cache of decoded dat files
+ *
+ * Copyright (C) 2010-2016 Ruediger Meier
+ *
+ * Author:  Ruediger Meier <sweet_f_a@gmx.de>
+ *
+ * This file is part of atem.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of any contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ***/
+
+#ifndef ATEM_DAT_CACHE_H
+#define ATEM_DAT_CACHE_H
+
+#include <sys/stat.h>
+
+#include "ms_file.h"
+
+
+/* Cache files are named by a hash of the dat file's real path. They are in
+   host byte order and not meant to be copied to other machines:
+   header:  char magic[8], uint32 version, item size, byte order mark,
+            field bitset, int64 dat file size, mtime, number of items,
+            uint32 path length, pad to DC_SIZE_HEADER
+   path:    the real path of the dat file, padded to 8 bytes
+   items:   n x ms_bar, all records of the dat file unfiltered (.adc)
+            or n x zm_block, the zone map of the dat file (.azm) */
+#define DC_MAGIC "ATEMDC"
+#define DC_VERSION 1
+#define DC_BOM 0x01020304
+#define DC_SIZE_HEADER 64
+#define DC_SUFFIX_BARS ".adc"
+#define DC_SUFFIX_ZONES ".azm"
+#define DC_ERROR_LENGTH 256
+
+/* records per zone map block */
+#define ZM_BLOCK_RECORDS 4096
+
+/* min and max of some columns of a block of dat file records, missing
+   columns are 0 */
+struct zm_block
+{
+	int records;
+	int min_date;
+	int max_date;
+	float min_close;
+	float max_close;
+	float min_volume;
+	float max_volume;
+};
+
+void zm_init( zm_block *z );
+void zm_add( zm_block *z, const ms_bar *bars, long long cnt );
+
+
+/**
+ * Directory of decoded dat files or their zone maps, depending on suffix and
+ * item size. Cache hits are mapped copy-on-write, so the bars may be
+ * filtered in place. New entries are written to a temporary
+ * file first and renamed when complete, so concurrent processes never see
+ * partial entries.
+ */
+class DatCache
+{
+	public:
+		DatCache( const char *suffix, int item_size );
+		~DatCache();
+
+		bool setDir( const char *dir );
+
+		long long load( const char *path, const struct stat *s,
+			unsigned char fields, void **items );
+		void release();
+
+		bool beginStore( const char *path, const struct stat *s,
+			unsigned char fields );
+		bool storing() const;
+		bool storeItems( const void *items, long long cnt );
+		bool commitStore();
+		void abortStore();
+
+		const char* lastError() const;
+
+	private:
+		bool setKey( const char *path );
+		bool write( const void *buf, long long len );
+		void setError( const char* e1, const char* e2 = "" ) const;
+
+		const char * const suffix;
+		const int item_size;
+
+		char *dir;
+		char *key;
+		char *cache_file;
+
+		char *map;
+		long long map_len;
+
+		char *tmp_file;
+		int tmp_fd;
+		long long tmp_cnt;
+
+		mutable char error[DC_ERROR_LENGTH];
+};
+
+
+
+#endif
@@ -40,7 +40,6 @@
 
 
 
-#define PRECISION 5
 #define DO_ROUNDING
 // #define NO_TRAIL_NULL
 /* PRECISION_IS_SIGNIFICANT whithout NO_TRAIL_NULL is not supported */
@@ -54,7 +53,13 @@ typedef union {
 } LF_t;
 
 
-int ftoa( char *outbuf, float f )
+/**
+ * ftoa_fixed: print floats like sprintf "%.<PRECISION>f" for |f| < 2^64,
+ * +-ULONG_MAX is printed when |f| >= 2^64 or +-inf or nan. The precision is
+ * a template parameter to get a specialized instance for each precision.
+ */
+template <int PRECISION>
+int ftoa_fixed( char *outbuf, float f )
 {
 	uint64_t mantissa, int_part, frac_part;
 	int safe_shift;
@@ -197,7 +202,11 @@ END:
 	return p - outbuf;
 }
 
-#undef PRECISION
+
+int ftoa( char *outbuf, float f )
+{
+	return ftoa_fixed<5>( outbuf, f );
+}
 
 
 
@@ -0,0 +1,355 @@
+/*** ftoa_shortest.c -- shortest round-trip printing of floats
+ *
+ * Copyright (C) 2010-2016 Ruediger Meier
+ *
+ * Author:  Ruediger Meier <sweet_f_a@gmx.de>
+ *
+ * This file is part of atem.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of any contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ***/
+
+/*
+ * The shortest decimal digits which read back as the same float are found
+ * like Ulf Adams' Ryu does (PLDI 2018): the interval of decimals rounding to
+ * the float is scaled by 5^q and 2^k using 64 bit multipliers from the
+ * tables below, then digits are removed as long as the interval bounds still
+ * differ. The decimal is printed in plain notation, never with an exponent.
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+
+#define FLT_MANTISSA_BITS 23
+#define FLT_EXP_BIAS 127
+
+/* floor(2^(bits(5^i) - 1 + 59) / 5^i) + 1 */
+#define POW5_INV_BITCOUNT 59
+static const uint64_t pow5_inv_split[31] = {
+	576460752303423489ULL, 461168601842738791ULL,
+	368934881474191033ULL, 295147905179352826ULL,
+	472236648286964522ULL, 377789318629571618ULL,
+	302231454903657294ULL, 483570327845851670ULL,
+	386856262276681336ULL, 309485009821345069ULL,
+	495176015714152110ULL, 396140812571321688ULL,
+	316912650057057351ULL, 507060240091291761ULL,
+	405648192073033409ULL, 324518553658426727ULL,
+	519229685853482763ULL, 415383748682786211ULL,
+	332306998946228969ULL, 531691198313966350ULL,
+	425352958651173080ULL, 340282366920938464ULL,
+	544451787073501542ULL, 435561429658801234ULL,
+	348449143727040987ULL, 557518629963265579ULL,
+	446014903970612463ULL, 356811923176489971ULL,
+	570899077082383953ULL, 456719261665907162ULL,
+	365375409332725730ULL,
+};
+
+/* 5^i normalized to 61 bits */
+#define POW5_BITCOUNT 61
+static const uint64_t pow5_split[47] = {
+	1152921504606846976ULL, 1441151880758558720ULL,
+	1801439850948198400ULL, 2251799813685248000ULL,
+	1407374883553280000ULL, 1759218604441600000ULL,
+	2199023255552000000ULL, 1374389534720000000ULL,
+	1717986918400000000ULL, 2147483648000000000ULL,
+	1342177280000000000ULL, 1677721600000000000ULL,
+	2097152000000000000ULL, 1310720000000000000ULL,
+	1638400000000000000ULL, 2048000000000000000ULL,
+	1280000000000000000ULL, 1600000000000000000ULL,
+	2000000000000000000ULL, 1250000000000000000ULL,
+	1562500000000000000ULL, 1953125000000000000ULL,
+	1220703125000000000ULL, 1525878906250000000ULL,
+	1907348632812500000ULL, 1192092895507812500ULL,
+	1490116119384765625ULL, 1862645149230957031ULL,
+	1164153218269348144ULL, 1455191522836685180ULL,
+	1818989403545856475ULL, 2273736754432320594ULL,
+	1421085471520200371ULL, 1776356839400250464ULL,
+	2220446049250313080ULL, 1387778780781445675ULL,
+	1734723475976807094ULL, 2168404344971008868ULL,
+	1355252715606880542ULL, 1694065894508600678ULL,
+	2117582368135750847ULL, 1323488980084844279ULL,
+	1654361225106055349ULL, 2067951531382569187ULL,
+	1292469707114105741ULL, 1615587133892632177ULL,
+	2019483917365790221ULL,
+};
+
+
+/* ceil(log2(5^e)) for 0 < e < 3529, and 1 for e == 0 */
+static inline int pow5bits( int e )
+{
+	return (int)(((uint32_t)e * 1217359) >> 19) + 1;
+}
+
+/* floor(log10(2^e)) for 0 <= e <= 1650 */
+static inline uint32_t log10_pow2( int e )
+{
+	return ((uint32_t)e * 78913) >> 18;
+}
+
+/* floor(log10(5^e)) for 0 <= e <= 2620 */
+static inline uint32_t log10_pow5( int e )
+{
+	return ((uint32_t)e * 732923) >> 20;
+}
+
+static inline bool multiple_of_pow5( uint32_t v, uint32_t p )
+{
+	uint32_t cnt = 0;
+	while( v % 5 == 0 ) {
+		v /= 5;
+		cnt++;
+	}
+	return cnt >= p;
+}
+
+static inline bool multiple_of_pow2( uint32_t v, uint32_t p )
+{
+	return (v & ((1u << p) - 1)) == 0;
+}
+
+/* (m * factor) >> shift, shift > 32 */
+static inline uint32_t mul_shift( uint32_t m, uint64_t factor, int shift )
+{
+	uint64_t lo = (uint64_t)m * (uint32_t)factor;
+	uint64_t hi = (uint64_t)m * (uint32_t)(factor >> 32);
+	return (uint32_t)(((lo >> 32) + hi) >> (shift - 32));
+}
+
+
+/**
+ * Compute the shortest digits of a finite float != 0, its value is
+ * *digits * 10^*exp10.
+ */
+static void float_to_decimal( uint32_t ieee_mant, uint32_t ieee_exp,
+	uint32_t *digits, int *exp10 )
+{
+	int e2;
+	uint32_t m2;
+	if( ieee_exp == 0 ) {
+		/* subnormal */
+		e2 = 1 - FLT_EXP_BIAS - FLT_MANTISSA_BITS - 2;
+		m2 = ieee_mant;
+	} else {
+		e2 = (int)ieee_exp - FLT_EXP_BIAS - FLT_MANTISSA_BITS - 2;
+		m2 = (1u << FLT_MANTISSA_BITS) | ieee_mant;
+	}
+	/* round to even while reading decimals means bounds are included */
+	const bool accept_bounds = (m2 & 1) == 0;
+
+	/* the value and the interval bounds, scaled by 4 */
+	const uint32_t mv = 4 * m2;
+	const uint32_t mp = 4 * m2 + 2;
+	const uint32_t mm_shift = ieee_mant != 0 || ieee_exp <= 1;
+	const uint32_t mm = 4 * m2 - 1 - mm_shift;
+
+	uint32_t vr, vp, vm;
+	int e10;
+	bool vm_trailing_zeros = false;
+	bool vr_trailing_zeros = false;
+	uint32_t last_removed = 0;
+
+	if( e2 >= 0 ) {
+		const uint32_t q = log10_pow2( e2 );
+		const int k = POW5_INV_BITCOUNT + pow5bits( q ) - 1;
+		const int i = -e2 + (int)q + k;
+		e10 = q;
+		vr = mul_shift( mv, pow5_inv_split[q], i );
+		vp = mul_shift( mp, pow5_inv_split[q], i );
+		vm = mul_shift( mm, pow5_inv_split[q], i );
+		if( q != 0 && (vp - 1) / 10 <= vm / 10 ) {
+			/* we need the digit removed by the scaling */
+			const int l = POW5_INV_BITCOUNT + pow5bits( q - 1 ) - 1;
+			last_removed = mul_shift( mv, pow5_inv_split[q - 1],
+				-e2 + (int)q - 1 + l ) % 10;
+		}
+		if( q <= 9 ) {
+			/* only one of mp, mv and mm can be a multiple of 5 */
+			if( mv % 5 == 0 ) {
+				vr_trailing_zeros = multiple_of_pow5( mv, q );
+			} else if( accept_bounds ) {
+				vm_trailing_zeros = multiple_of_pow5( mm, q );
+			} else {
+				vp -= multiple_of_pow5( mp, q );
+			}
+		}
+	} else {
+		const uint32_t q = log10_pow5( -e2 );
+		const int i = -e2 - (int)q;
+		const int k = pow5bits( i ) - POW5_BITCOUNT;
+		int j = (int)q - k;
+		e10 = (int)q + e2;
+		vr = mul_shift( mv, pow5_split[i], j );
+		vp = mul_shift( mp, pow5_split[i], j );
+		vm = mul_shift( mm, pow5_split[i], j );
+		if( q != 0 && (vp - 1) / 10 <= vm / 10 ) {
+			j = (int)q - 1 - (pow5bits( i + 1 ) - POW5_BITCOUNT);
+			last_removed = mul_shift( mv, pow5_split[i + 1], j ) % 10;
+		}
+		if( q <= 1 ) {
+			/* mv = 4 * m2 has at least two trailing zero bits */
+			vr_trailing_zeros = true;
+			if( accept_bounds ) {
+				vm_trailing_zeros = mm_shift == 1;
+			} else {
+				--vp;
+			}
+		} else if( q < 31 ) {
+			vr_trailing_zeros = multiple_of_pow2( mv, q - 1 );
+		}
+	}
+
+	/* remove digits while the interval still contains a shorter decimal */
+	int removed = 0;
+	uint32_t output;
+	if( vm_trailing_zeros || vr_trailing_zeros ) {
+		/* rare, exact values need care */
+		while( vp / 10 > vm / 10 ) {
+			vm_trailing_zeros &= vm % 10 == 0;
+			vr_trailing_zeros &= last_removed == 0;
+			last_removed = vr % 10;
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+			removed++;
+		}
+		if( vm_trailing_zeros ) {
+			while( vm % 10 == 0 ) {
+				vr_trailing_zeros &= last_removed == 0;
+				last_removed = vr % 10;
+				vr /= 10;
+				vp /= 10;
+				vm /= 10;
+				removed++;
+			}
+		}
+		if( vr_trailing_zeros && last_removed == 5 && vr % 2 == 0 ) {
+			/* exactly .5, round to even */
+			last_removed = 4;
+		}
+		output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros))
+			|| last_removed >= 5);
+	} else {
+		while( vp / 10 > vm / 10 ) {
+			last_removed = vr % 10;
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+			removed++;
+		}
+		output = vr + (vr == vm || last_removed >= 5);
+	}
+
+	*digits = output;
+	*exp10 = e10 + removed;
+}
+
+
+/**
+ * ftoa_shortest: print the shortest decimal which reads back (strtof) as
+ * the same float, like "79.7" instead of "79.70000", "7718.84" instead of
+ * "7718.83984". Plain notation, without exponent and without trailing zeros
+ * or point. Up to 48 chars ("-0." and 45 digits for the smallest
+ * subnormals), "nan", "inf" and "-inf" for non-finite floats.
+ */
+int ftoa_shortest( char *outbuf, float f )
+{
+	union {
+		uint32_t L;
+		float F;
+	} x;
+	x.F = f;
+
+	char *p = outbuf;
+	const uint32_t ieee_mant = x.L & ((1u << FLT_MANTISSA_BITS) - 1);
+	const uint32_t ieee_exp = (x.L >> FLT_MANTISSA_BITS) & 0xff;
+
+	if( ieee_exp == 0xff && ieee_mant != 0 ) {
+		memcpy( p, "nan", 4 );
+		return 3;
+	}
+	if( x.L >> 31 ) {
+		*p++ = '-';
+	}
+	if( ieee_exp == 0xff ) {
+		memcpy( p, "inf", 4 );
+		return p + 3 - outbuf;
+	}
+	if( ieee_exp == 0 && ieee_mant == 0 ) {
+		*p++ = '0';
+		*p = '\0';
+		return p - outbuf;
+	}
+
+	uint32_t digits;
+	int exp10;
+	float_to_decimal( ieee_mant, ieee_exp, &digits, &exp10 );
+	while( digits % 10 == 0 ) {
+		digits /= 10;
+		exp10++;
+	}
+
+	/* at most 9 digits, written backwards */
+	char dig[10];
+	int n = 0;
+	do {
+		dig[9 - n++] = '0' + digits % 10;
+		digits /= 10;
+	} while( digits != 0 );
+	const char *d = dig + 10 - n;
+
+	if( exp10 >= 0 ) {
+		memcpy( p, d, n );
+		p += n;
+		memset( p, '0', exp10 );
+		p += exp10;
+	} else if( n + exp10 > 0 ) {
+		/* point within the digits */
+		int int_len = n + exp10;
+		memcpy( p, d, int_len );
+		p += int_len;
+		*p++ = '.';
+		memcpy( p, d + int_len, -exp10 );
+		p += -exp10;
+	} else {
+		*p++ = '0';
+		*p++ = '.';
+		memset( p, '0', -exp10 - n );
+		p += -exp10 - n;
+		memcpy( p, d, n );
+		p += n;
+	}
+	*p = '\0';
+	return p - outbuf;
+}
+
+#undef FLT_MANTISSA_BITS
+#undef FLT_EXP_BIAS
+#undef POW5_INV_BITCOUNT
+#undef POW5_BITCOUNT
@@ -53,11 +53,19 @@
 #include <limits.h>
 
 #include "ms_file.h"
+#include "ms_archive.h"
+#include "col_archive.h"
+#include "dat_cache.h"
+#include "where.h"
+#include "workers.h"
+#include "stats.h"
 #include "util.h"
 
 
 
 #define READ_BLCKSZ 16384
+/* dat files are decoded in chunks of about this size */
+#define DAT_CHUNK_SIZE (64 * READ_BLCKSZ)
 
 
 class FileBuf
@@ -69,19 +77,21 @@ class FileBuf
 		bool hasName() const;
 		const char* constName() const;
 		const char* constBuf() const;
-		int len() const;
+		long long len() const;
 
 		void setName( const char* file_name );
 
 		int readFile( int fildes );
+		long long readChunk( int fildes, long long len );
+		int readArchive( const MsArchive *ar, int member );
 
 	private:
-		void resize( int size );
+		void resize( long long size );
 
 		char name[MAX_LEN_MR_FILENAME + 1];
 		char *buf;
-		int buf_len;
-		int buf_size;
+		long long buf_len;
+		long long buf_size;
 };
 
 FileBuf::FileBuf() :
@@ -112,7 +122,7 @@ const char* FileBuf::constBuf() const
 	return buf;
 }
 
-int FileBuf::len() const
+long long FileBuf::len() const
 {
 	return buf_len;
 }
@@ -127,23 +137,67 @@ int FileBuf::readFile( int fildes )
 {
 	char *cp = buf;
 	buf_len = 0;
-	int tmp_len;
+	ssize_t tmp_len;
 	do {
 		if( buf_len + READ_BLCKSZ > buf_size ) {
 			resize( buf_size + READ_BLCKSZ );
 			cp = buf + buf_len;
 		}
 		tmp_len = read( fildes, cp, READ_BLCKSZ );
-		buf_len += tmp_len;
-		cp += tmp_len;
+		if( tmp_len > 0 ) {
+			buf_len += tmp_len;
+			cp += tmp_len;
+		}
 	} while( tmp_len > 0 );
+	stats_count( SC_BYTES_READ, buf_len );
 
 	// tmp_len < 0 is an error with errno set
 	return tmp_len;
 }
 
+/**
+ * Replace buffer by the next len bytes from fildes. Returns less than len
+ * only at EOF or -1 on error (errno set).
+ */
+long long FileBuf::readChunk( int fildes, long long len )
+{
+	if( len > buf_size ) {
+		resize( len );
+	}
+
+	buf_len = 0;
+	while( buf_len < len ) {
+		ssize_t tmp_len = read( fildes, buf + buf_len, len - buf_len );
+		if( tmp_len < 0 ) {
+			return -1;
+		} else if( tmp_len == 0 ) {
+			break;
+		}
+		buf_len += tmp_len;
+	}
+	stats_count( SC_BYTES_READ, buf_len );
+	return buf_len;
+}
+
+
+int FileBuf::readArchive( const MsArchive *ar, int member )
+{
+	buf_len = 0;
+	if( ar->memberSize( member ) > buf_size ) {
+		resize( ar->memberSize( member ) );
+	}
+
+	long long ret = ar->readMember( member, buf );
+	if( ret < 0 ) {
+		return -1;
+	}
+	buf_len = ret;
+	stats_count( SC_BYTES_READ, buf_len );
+	return 0;
+}
+
 
-void FileBuf::resize( int size )
+void FileBuf::resize( long long size )
 {
 	buf = (char*) realloc( buf, size );
 	buf_size = size;
@@ -156,13 +210,26 @@ bool Metastock::print_header = true;
 char Metastock::print_sep = '\t';
 unsigned short Metastock::use_master_files = MF_ALL;
 unsigned short Metastock::prnt_master_fields = 0xFFFF;
-unsigned char Metastock::prnt_data_fields = 0xFF;
+unsigned short Metastock::prnt_data_fields = 0xFF;
 unsigned short Metastock::prnt_data_mr_fields = M_SYM;
+unsigned int Metastock::auto_prec_fields = 0;
+output_format Metastock::out_fmt = OF_TEXT;
 
 
 Metastock::Metastock() :
 	print_date_from(0),
+	stdin_fields(0),
 	ms_dir(NULL),
+	ms_ar(NULL),
+	col_ar(NULL),
+	dat_cache(NULL),
+	zone_maps(NULL),
+	where(NULL),
+	threads( default_threads() ),
+	trust_master_dates(false),
+	resampling(false),
+	merge_by_time(false),
+	snapshot_date(0),
 	m_buf( new FileBuf() ),
 	e_buf( new FileBuf() ),
 	x_buf( new FileBuf() ),
@@ -195,6 +262,11 @@ Metastock::~Metastock()
 	delete( x_buf );
 	delete( e_buf );
 	delete( m_buf );
+	delete( where );
+	delete( zone_maps );
+	delete( dat_cache );
+	delete( col_ar );
+	delete( ms_ar );
 	free( ms_dir );
 
 	/* out is either stdout or a real file which was opened in set_outfile() */
@@ -204,46 +276,79 @@ Metastock::~Metastock()
 }
 
 
+/* return dat file number if name looks like F*.DAT or F*.MWD, else 0 */
+static long int datfile_number( const char *name )
+{
+	if( ( name[0] == 'F' || name[0] == 'f') &&
+		name[1] >= '1' && name[1] <= '9') {
+		const char *c_number = name + 1;
+		char *end;
+		long int number = strtol( c_number, &end, 10 );
+		assert( number > 0 && c_number != end );
+		if( (strcasecmp(end, ".MWD") == 0 || strcasecmp(end, ".DAT") == 0)
+				&& number <= MAX_DAT_NUM ) {
+			return number;
+		}
+	}
+	return 0;
+}
+
+/* archive filter, we want to see master and dat files only */
+static bool is_ms_file( const char *name )
+{
+	return datfile_number( name ) > 0
+		|| strcasecmp( name, "MASTER" ) == 0
+		|| strcasecmp( name, "EMASTER" ) == 0
+		|| strcasecmp( name, "XMASTER" ) == 0;
+}
+
+
 #define CHECK_MASTER( _file_buf_, _gen_name_, _master_type_ ) \
 	if( (_master_type_ & use_master_files) \
-			&& strcasecmp(_gen_name_, dirp->d_name) == 0 ) { \
+			&& strcasecmp(_gen_name_, name) == 0 ) { \
 		assert( !_file_buf_->hasName() ); \
-		_file_buf_->setName( dirp->d_name ); \
+		_file_buf_->setName( name ); \
 	}
 
+void Metastock::addFile( const char *name )
+{
+	long int number = datfile_number( name );
+	if( number > 0 ) {
+		add_mr_list_datfile( number, name );
+	} else {
+		CHECK_MASTER( m_buf, "MASTER", MF_MASTER );
+		CHECK_MASTER( e_buf, "EMASTER", MF_EMASTER );
+		CHECK_MASTER( x_buf, "XMASTER", MF_XMASTER );
+	}
+}
+
+#undef CHECK_MASTER
+
 bool Metastock::findFiles()
 {
 	DIR *dirh;
 	struct dirent *dirp;
 
+	if( ms_ar != NULL ) {
+		for( int m = 0; m < ms_ar->countMembers(); m++ ) {
+			addFile( ms_ar->memberName(m) );
+		}
+		return true;
+	}
+
 	if ((dirh = opendir( ms_dir )) == NULL) {
 		setError( ms_dir, strerror(errno) );
 		return false;
 	}
 
 	for (dirp = readdir(dirh); dirp != NULL; dirp = readdir(dirh)) {
-		if( ( dirp->d_name[0] == 'F' || dirp->d_name[0] == 'f') &&
-			dirp->d_name[1] >= '1' && dirp->d_name[1] <= '9') {
-			char *c_number = dirp->d_name + 1;
-			char *end;
-			long int number = strtol( c_number, &end, 10 );
-			assert( number > 0 && c_number != end );
-			if( (strcasecmp(end, ".MWD") == 0 || strcasecmp(end, ".DAT") == 0)
-					&& number <= MAX_DAT_NUM ) {
-				add_mr_list_datfile( number, dirp->d_name );
-			}
-		} else {
-			CHECK_MASTER( m_buf, "MASTER", MF_MASTER );
-			CHECK_MASTER( e_buf, "EMASTER", MF_EMASTER );
-			CHECK_MASTER( x_buf, "XMASTER", MF_XMASTER );
-		}
+		addFile( dirp->d_name );
 	}
 
 	closedir( dirh );
 	return true;
 }
 
-#undef CHECK_MASTER
 
 
 bool Metastock::set_outfile( const char *file )
@@ -281,17 +386,99 @@ bool Metastock::setDir( const char* d )
 		ms_dir[dir_len + 1] = '\0';
 	}
 
+	stats_phase_begin( ST_FIND_FILES );
+	struct stat s;
+	if( stat( d, &s ) != 0 || !S_ISDIR(s.st_mode) ) {
+		/* not a directory, try to read it as archive */
+		if( ColArchive::isColArchive( d ) ) {
+			stats_phase_end( ST_FIND_FILES );
+			return openColArchive( d );
+		}
+		ms_ar = new MsArchive();
+		if( !ms_ar->open( d, is_ms_file ) ) {
+			setError( ms_ar->lastError() );
+			return false;
+		}
+	}
+
 	if( !findFiles() ) {
 		return false;
 	}
+	stats_phase_end( ST_FIND_FILES );
 
+	stats_phase_begin( ST_READ_MASTERS );
 	if( !readMasters() ){
 		return false;
 	}
+	stats_phase_end( ST_READ_MASTERS );
+
+	stats_phase_begin( ST_PARSE_MASTERS );
 	if( !parseMasters() ) {
 		return false;
 	}
+	stats_phase_end( ST_PARSE_MASTERS );
+
+	FDat::set_outfile( out );
+	return true;
+}
+
+
+/**
+ * use a columnar archive instead of a metastock directory, the symbols are
+ * stored there like in XMASTER
+ */
+bool Metastock::openColArchive( const char *path )
+{
+	stats_phase_begin( ST_READ_MASTERS );
+	col_ar = new ColArchive();
+	if( !col_ar->open( path ) ) {
+		setError( col_ar->lastError() );
+		return false;
+	}
+	stats_phase_end( ST_READ_MASTERS );
+
+	for( int i = 0; i < col_ar->countSymbols(); i++ ) {
+		const master_record *mr = col_ar->symbol( i );
+		add_mr_list_datfile( mr->file_number, mr->file_name );
+		mr_list[mr->file_number] = *mr;
+	}
+
+	FDat::set_outfile( out );
+	return true;
+}
+
+
+bool Metastock::setStdin( const char *fields )
+{
+	static const char *sepset = ",;: \t\n";
+	unsigned int bitset = D_DAT | D_OPE | D_HIG | D_LOW | D_CLO | D_VOL | D_OPI;
+
+	if( fields != NULL ) {
+		char *endptr;
+		bitset = strtol( fields, &endptr, 0 );
+		if( *endptr != '\0' ) {
+			/* parse human readable columns */
+			char col_split[strlen(fields) + 1];
+			strcpy( col_split, fields );
+			bitset = 0;
+			for( char *token = strtok(col_split, sepset); token != NULL;
+					token = strtok(NULL, sepset) ) {
+				unsigned int fld = str_to_data_field( token );
+				if( fld == 0 ) {
+					setError( "invalid stdin field", token );
+					return false;
+				}
+				bitset |= fld;
+			}
+		}
+	}
+
+	if( bitset == 0 || bitset > 0xFF ) {
+		setError( "bad stdin field layout" );
+		return false;
+	}
 
+	stdin_fields = bitset;
 	FDat::set_outfile( out );
 	return true;
 }
@@ -312,6 +499,11 @@ void Metastock::set_skip_header( int skipheader )
 	print_header = !skipheader;
 }
 
+/* the lower 9 bits of format bitsets are time series columns */
+#define DATA_FORMAT_MASK 0777
+/* symbol info columns, M_SYM to M_KND */
+#define MASTER_FORMAT_MASK 01777
+
 void Metastock::set_out_format( int fmt_data )
 {
 	if( fmt_data < 0 ) {
@@ -321,7 +513,7 @@ void Metastock::set_out_format( int fmt_data )
 		prnt_data_mr_fields = M_SYM;
 	} else {
 		prnt_master_fields = fmt_data >> 9;
-		prnt_data_fields = fmt_data;
+		prnt_data_fields = fmt_data & DATA_FORMAT_MASK;
 		prnt_data_mr_fields = prnt_master_fields;
 	}
 }
@@ -329,14 +521,14 @@ void Metastock::set_out_format( int fmt_data )
 void Metastock::format_incl( unsigned int fmt_data )
 {
 	prnt_master_fields |= ( fmt_data >> 9 );
-	prnt_data_fields |= fmt_data;
+	prnt_data_fields |= fmt_data & DATA_FORMAT_MASK;
 	prnt_data_mr_fields |= ( fmt_data >> 9 );
 }
 
 void Metastock::format_excl( unsigned int fmt_data )
 {
 	prnt_master_fields &= ~( fmt_data >> 9 );
-	prnt_data_fields &= ~fmt_data;
+	prnt_data_fields &= ~fmt_data & DATA_FORMAT_MASK;
 	prnt_data_mr_fields &= ~( fmt_data >> 9 );
 }
 
@@ -351,7 +543,8 @@ static int token2format( const char *token )
 	if( ret == 0  ) {
 		/* token does not match any valid column - try some "flavour" strings */
 		if( strcasecmp(token, "all") == 0 ) {
-			ret = INT_MAX;
+			/* all stored columns, timestamp is just another date format */
+			ret = INT_MAX & ~D_TST;
 		} else if( strcasecmp(token, "none") == 0 ) {
 			ret = 0;
 		} else {
@@ -466,14 +659,136 @@ bool Metastock::setForceFloat( bool opi, bool vol )
 	return true;
 }
 
+#define FLOAT_FIELDS ( D_OPE | D_HIG | D_LOW | D_CLO | D_VOL | D_OPI )
 
-bool Metastock::readFile( FileBuf *file_buf ) const
+bool Metastock::setShortest( const char *columns )
+{
+	static const char *sepset = ",;: \t\n";
+	char col_split[strlen(columns) + 1];
+	unsigned int bitset = 0;
+
+	strcpy( col_split, columns );
+	for( char *token = strtok(col_split, sepset); token != NULL;
+			token = strtok(NULL, sepset) ) {
+		unsigned int fld = str_to_data_field( token );
+		if( strcasecmp(token, "all") == 0 ) {
+			fld = FLOAT_FIELDS;
+		} else if( (fld & FLOAT_FIELDS) == 0 ) {
+			setError( "invalid float column", token );
+			return false;
+		}
+		bitset |= fld;
+	}
+
+	FDat::setFtoa( bitset, ftoa_shortest, dtoa_shortest );
+	return true;
+}
+
+/**
+ * Parse a list like "close=2,volume=auto" or "all=4" and set the printing
+ * function func(N) for the given float columns, N is 0 to
+ * MAX_FTOA_PRECISION, and vol_func(N) for the volume sums of --resample.
+ * The value "auto" lets FDat guess the precision per dat file if allow_auto
+ * is true.
+ */
+bool Metastock::setColumnFtoa( const char *list, ftoa_func (*func)(int),
+	dtoa_func (*vol_func)(int), bool allow_auto )
+{
+	static const char *sepset = ",;: \t\n";
+	char col_split[strlen(list) + 1];
+
+	strcpy( col_split, list );
+	for( char *token = strtok(col_split, sepset); token != NULL;
+			token = strtok(NULL, sepset) ) {
+		char *value = strchr( token, '=' );
+		if( value == NULL ) {
+			setError( "missing column value", token );
+			return false;
+		}
+		*value++ = '\0';
+
+		unsigned int fld = str_to_data_field( token );
+		if( strcasecmp(token, "all") == 0 ) {
+			fld = FLOAT_FIELDS;
+		} else if( (fld & FLOAT_FIELDS) == 0 ) {
+			setError( "invalid float column", token );
+			return false;
+		}
+
+		if( allow_auto && strcasecmp(value, "auto") == 0 ) {
+			auto_prec_fields |= fld;
+			continue;
+		}
+		char *endptr;
+		long n = strtol( value, &endptr, 10 );
+		if( *value == '\0' || *endptr != '\0' || n < 0
+				|| n > MAX_FTOA_PRECISION ) {
+			setError( "invalid column value", value );
+			return false;
+		}
+		auto_prec_fields &= ~fld;
+		FDat::setFtoa( fld, func(n), vol_func(n) );
+	}
+
+	FDat::setAutoPrecision( auto_prec_fields );
+	return true;
+}
+
+bool Metastock::setTimestamp( const char *unit )
+{
+	tstoa_func func = tstoa_unit( unit );
+	if( func == NULL ) {
+		setError( "invalid timestamp unit", unit );
+		return false;
+	}
+	FDat::setTimestamp( func, strcmp( unit, "iso" ) == 0 );
+	return true;
+}
+
+bool Metastock::setOutputFormat( const char *fmt )
+{
+	if( strcasecmp( fmt, "text" ) == 0 ) {
+		out_fmt = OF_TEXT;
+	} else if( strcasecmp( fmt, "jsonl" ) == 0 ) {
+		out_fmt = OF_JSONL;
+	} else if( strcasecmp( fmt, "pgcopy" ) == 0 ) {
+		out_fmt = OF_PGCOPY;
+	} else if( strcasecmp( fmt, "raw" ) == 0 ) {
+		out_fmt = OF_RAW;
+	} else if( strcasecmp( fmt, "columnar" ) == 0 ) {
+		out_fmt = OF_COLUMNAR;
+	} else {
+		setError( "invalid output format", fmt );
+		return false;
+	}
+	FDat::setOutputFormat( out_fmt );
+	return true;
+}
+
+/**
+ * set decimals per float column, see setColumnFtoa()
+ */
+bool Metastock::setPrecision( const char *list )
+{
+	return setColumnFtoa( list, ftoa_precision, dtoa_precision, true );
+}
+
+/**
+ * print float columns as integers scaled by 10^N, see setColumnFtoa()
+ */
+bool Metastock::setScaled( const char *list )
+{
+	return setColumnFtoa( list, ftoa_scale, dtoa_scale, false );
+}
+
+
+int Metastock::openFile( const char *name ) const
 {
 	// build file name with full path
-	char puff[strlen(ms_dir) + strlen(file_buf->constName()) + 1];
+	char puff[strlen(ms_dir) + strlen(name) + 1];
 	char *file_path = puff;
 	strcpy( file_path, ms_dir );
-	strcpy( file_path + strlen(ms_dir), file_buf->constName() );
+	strcpy( file_path + strlen(ms_dir), name );
 
 #if defined _WIN32
 	int fd = open( file_path, _O_RDONLY | _O_BINARY );
@@ -482,6 +797,31 @@ bool Metastock::readFile( FileBuf *file_buf ) const
 #endif
 	if( fd < 0 ) {
 		setError( file_path, strerror(errno) );
+	}
+	return fd;
+}
+
+
+bool Metastock::readFile( FileBuf *file_buf ) const
+{
+	// build file name with full path
+	char puff[strlen(ms_dir) + strlen(file_buf->constName()) + 1];
+	char *file_path = puff;
+	strcpy( file_path, ms_dir );
+	strcpy( file_path + strlen(ms_dir), file_buf->constName() );
+
+	if( ms_ar != NULL ) {
+		int m = ms_ar->findMember( file_buf->constName() );
+		assert( m >= 0 );
+		if( file_buf->readArchive( ms_ar, m ) < 0 ) {
+			setError( ms_ar->lastError() );
+			return false;
+		}
+		return true;
+	}
+
+	int fd = openFile( file_buf->constName() );
+	if( fd < 0 ) {
 		return false;
 	}
 	int err = file_buf->readFile( fd );
@@ -509,6 +849,19 @@ bool Metastock::readFile( FileBuf *file_buf ) const
 		mr = &mr_list[ datnum ]; \
 	} while( false )
 
+/* broken records would hit asserts later, --verify tells more */
+#define SKIP_UNUSABLE_MR( _master_, _name_ ) \
+	if( !_master_.usableRecord(i) ) { \
+		printWarn( "skipping unusable record in", _name_ ); \
+		continue; \
+	}
+
+#define SKIP_DUPLICATE_MR( _name_ ) \
+	if( mr->record_number != 0 ) { \
+		printWarn( "skipping duplicate dat file number in", _name_ ); \
+		continue; \
+	}
+
 
 bool Metastock::parseMasters()
 {
@@ -533,15 +886,19 @@ bool Metastock::parseMasters()
 	if( cntM > 0 ) {
 		/* we prefer to use Master because EMaster is often broken */
 		for( int i = 1; i<=cntM; i++ ) {
+			SKIP_UNUSABLE_MR( mf, "MASTER" );
 			SELECT_MR( mf );
-			assert( mr->record_number == 0 );
+			SKIP_DUPLICATE_MR( "MASTER" );
 			mf.getRecord( mr, i );
 		}
 		if( cntE == cntM ) {
 			/* EMaster seems to be usable - fill up long names */
 			for( int i = 1; i<=cntE; i++ ) {
-				SELECT_MR( emf );
-				if( mr->record_number != i ) {
+				mr = NULL;
+				if( emf.usableRecord( i ) ) {
+					SELECT_MR( emf );
+				}
+				if( mr == NULL || mr->record_number != i ) {
 					printWarn( "inconsistent EMASTER and MASTER files, "
 						"consider option --ignore-emaster");
 					break;
@@ -552,8 +909,9 @@ bool Metastock::parseMasters()
 	} else if ( cntE > 0 ) {
 		/* Master is broken - use EMaster */
 		for( int i = 1; i<=cntE; i++ ) {
+			SKIP_UNUSABLE_MR( emf, "EMASTER" );
 			SELECT_MR( emf );
-			assert( mr->record_number == 0 );
+			SKIP_DUPLICATE_MR( "EMASTER" );
 			emf.getRecord( mr, i );
 		}
 	} /* else neither Master or EMaster is valid */
@@ -561,8 +919,9 @@ bool Metastock::parseMasters()
 	if( cntX > 0 ) {
 		/* XMaster is optional */
 		for( int i = 1; i<=cntX; i++ ) {
+			SKIP_UNUSABLE_MR( xmf, "XMASTER" );
 			SELECT_MR( xmf );
-			assert( mr->record_number == 0 );
+			SKIP_DUPLICATE_MR( "XMASTER" );
 			xmf.getRecord( mr, i );
 		}
 	}
@@ -572,6 +931,8 @@ bool Metastock::parseMasters()
 
 #undef DEBUG_MASTER
 #undef SELECT_MR
+#undef SKIP_UNUSABLE_MR
+#undef SKIP_DUPLICATE_MR
 
 
 bool Metastock::readMasters()
@@ -743,6 +1104,182 @@ bool Metastock::setPrintDateFrom( const char *date )
 }
 
 
+/**
+ * print only bars matching the filter expression
+ */
+bool Metastock::setWhere( const char *expr )
+{
+	where = new Where();
+	if( !where->compile( expr ) ) {
+		setError( "invalid --where expression", where->lastError() );
+		return false;
+	}
+	FDat::setWhere( where );
+	return true;
+}
+
+
+/**
+ * worker threads of --summary, at least 1
+ */
+void Metastock::setThreads( int n )
+{
+	threads = n > 0 ? n : 1;
+}
+
+/**
+ * let pruneFile() rely on the last date of the master records
+ */
+void Metastock::setTrustMasterDates()
+{
+	trust_master_dates = true;
+}
+
+/**
+ * aggregate bars to periods like "5min", "1h", "day", "week" or "month"
+ */
+bool Metastock::setResample( const char *period )
+{
+	char *end;
+	long n = strtol( period, &end, 10 );
+	if( end != period && n > 0 && strcasecmp( end, "min" ) == 0
+			&& n <= 1440 ) {
+		FDat::setResample( RS_MINUTES, n );
+	} else if( end != period && n > 0 && strcasecmp( end, "h" ) == 0
+			&& n <= 24 ) {
+		FDat::setResample( RS_MINUTES, n * 60 );
+	} else if( strcasecmp( period, "day" ) == 0 ) {
+		FDat::setResample( RS_DAY, 0 );
+	} else if( strcasecmp( period, "week" ) == 0 ) {
+		FDat::setResample( RS_WEEK, 0 );
+	} else if( strcasecmp( period, "month" ) == 0 ) {
+		FDat::setResample( RS_MONTH, 0 );
+	} else {
+		setError( "invalid resample period", period );
+		return false;
+	}
+	resampling = true;
+	return true;
+}
+
+/**
+ * print all time series as one stream ordered by date and time, must be
+ * set after the input and output options
+ */
+bool Metastock::setMergeByTime()
+{
+	if( ms_ar != NULL ) {
+		setError( "--merge-by-time", "can not read tar or zip archives" );
+		return false;
+	} else if( stdin_fields != 0 ) {
+		setError( "--merge-by-time", "can not read stdin" );
+		return false;
+	} else if( out_fmt == OF_COLUMNAR ) {
+		setError( "--merge-by-time", "can not write columnar archives" );
+		return false;
+	} else if( resampling ) {
+		setError( "--merge-by-time", "can not be combined with --resample" );
+		return false;
+	} else if( auto_prec_fields != 0 ) {
+		setError( "--merge-by-time", "can not guess precisions per file" );
+		return false;
+	}
+	merge_by_time = true;
+	return true;
+}
+
+/**
+ * print only the last bar on or before date of each file, must be set
+ * after the input and output options
+ */
+bool Metastock::setSnapshot( const char *date )
+{
+	int dt = str2date( date );
+	if( dt < 0 ) {
+		setError("parsing date time");
+		return false;
+	} else if( stdin_fields != 0 ) {
+		setError( "--snapshot", "can not read stdin" );
+		return false;
+	} else if( out_fmt == OF_COLUMNAR ) {
+		setError( "--snapshot", "can not write columnar archives" );
+		return false;
+	} else if( resampling ) {
+		setError( "--snapshot", "can not be combined with --resample" );
+		return false;
+	} else if( merge_by_time ) {
+		setError( "--snapshot", "can not be combined with --merge-by-time" );
+		return false;
+	} else if( auto_prec_fields != 0 ) {
+		setError( "--snapshot", "can not guess precisions per file" );
+		return false;
+	}
+	snapshot_date = dt;
+	return true;
+}
+
+
+/**
+ * cache decoded dat files in dir, used for plain directories only
+ */
+bool Metastock::setCacheDir( const char *dir )
+{
+	dat_cache = new DatCache( DC_SUFFIX_BARS, sizeof(ms_bar) );
+	if( !dat_cache->setDir( dir ) ) {
+		setError( dat_cache->lastError() );
+		return false;
+	}
+	return true;
+}
+
+/**
+ * keep zone maps of dat files in dir to skip blocks not matching
+ * --date-from or --where, used for plain directories only
+ */
+bool Metastock::setZoneMapDir( const char *dir )
+{
+	zone_maps = new DatCache( DC_SUFFIX_ZONES, sizeof(zm_block) );
+	if( !zone_maps->setDir( dir ) ) {
+		setError( zone_maps->lastError() );
+		return false;
+	}
+	return true;
+}
+
+/**
+ * True if a file has no data for the filters. Columnar archives know the
+ * real last date of each file. Master records are often stale, their last
+ * date is used only with --trust-master-dates.
+ */
+bool Metastock::pruneFile( const master_record *mr ) const
+{
+	int to_date = mr->to_date;
+	if( col_ar != NULL ) {
+		to_date = 0;
+		for( int b = col_ar->firstBlock( mr->file_number ); b >= 0
+				&& b < col_ar->countBlocks()
+				&& col_ar->blockFile( b ) == mr->file_number; b++ ) {
+			to_date = col_ar->blockMaxDate( b );
+		}
+	} else if( !trust_master_dates ) {
+		return false;
+	}
+
+	if( to_date <= 0 ) {
+		return false;
+	} else if( print_date_from > 0 && to_date < print_date_from ) {
+		return true;
+	} else if( where != NULL && (mr->field_bitset & D_DAT) ) {
+		/* like for --date-from we trust only the last date */
+		wh_range ranges[WH_COLUMNS];
+		wh_ranges_unknown( ranges );
+		ranges[WH_DATE].hi = to_date;
+		return !where->mayMatch( ranges );
+	}
+	return false;
+}
+
+
 bool Metastock::excludeFiles( const char *stamp ) const
 {
 	bool revert = false;
@@ -767,18 +1304,27 @@ bool Metastock::excludeFiles( const char *stamp ) const
 		strcpy( file_path, ms_dir );
 		strcpy( file_path + strlen(ms_dir), mr_list[i].file_name );
 
-		struct stat s;
-		int tmp = stat( file_path, &s );
-		if( tmp < 0 ) {
-			setError( file_path,  strerror(errno) );
-			return false;
+		time_t mtime;
+		if( col_ar != NULL ) {
+			mtime = col_ar->mtime();
+		} else if( ms_ar != NULL ) {
+			mtime = ms_ar->memberTime(
+				ms_ar->findMember( mr_list[i].file_name ) );
+		} else {
+			struct stat s;
+			int tmp = stat( file_path, &s );
+			if( tmp < 0 ) {
+				setError( file_path,  strerror(errno) );
+				return false;
+			}
+			mtime = s.st_mtime;
 		}
 		if( !revert ) {
-			if( oldest_t > s.st_mtime ) {
+			if( oldest_t > mtime ) {
 				mr_skip_list[i] = true;
 			}
 		} else {
-			if( oldest_t <= s.st_mtime ) {
+			if( oldest_t <= mtime ) {
 				mr_skip_list[i] = true;
 			}
 		}
@@ -789,7 +1335,7 @@ bool Metastock::excludeFiles( const char *stamp ) const
 
 bool Metastock::dumpSymbolInfo() const
 {
-	char buf[MAX_SIZE_MR_STRING + 1];
+	char buf[MAX_SIZE_MR_JSON + 3];
 	int len;
 
 	if( prnt_master_fields == 0 ) {
@@ -797,23 +1343,50 @@ bool Metastock::dumpSymbolInfo() const
 		return false;
 	}
 
-	if( print_header ) {
+	if( print_header && out_fmt == OF_TEXT ) {
 		len = mr_header_to_string( buf, prnt_master_fields, print_sep );
 		buf[len++] = '\n';
 		buf[len] = '\0';
 		fputs( buf, (FILE*)out );
 	}
 
+	if( out_fmt == OF_COLUMNAR ) {
+		setError( "bad output format", "columnar is for time series only" );
+		return false;
+	} else if( out_fmt == OF_PGCOPY ) {
+		FDat::print_pgcopy_header();
+	} else if( out_fmt == OF_RAW ) {
+		/* just the symbol table */
+		printRawHeader();
+		return true;
+	}
+
 	for( int i = 1; i<mr_len; i++ ) {
 		if( mr_list[i].record_number != 0 && !mr_skip_list[i] ) {
 			assert( mr_list[i].file_number == i );
-			len = mr_record_to_string( buf, &mr_list[i],
-				prnt_master_fields, print_sep );
+			if( out_fmt == OF_PGCOPY ) {
+				len = mr_record_to_pgcopy( buf, &mr_list[i],
+					prnt_master_fields,
+					count_bits(prnt_master_fields & MASTER_FORMAT_MASK) );
+				fwrite( buf, 1, len, (FILE*)out );
+				continue;
+			} else if( out_fmt == OF_JSONL ) {
+				len = mr_record_to_json( buf, &mr_list[i],
+					prnt_master_fields );
+				buf[len++] = '}';
+			} else {
+				len = mr_record_to_string( buf, &mr_list[i],
+					prnt_master_fields, print_sep );
+			}
 			buf[len++] = '\n';
 			buf[len] = '\0';
 			fputs( buf, (FILE*)out );
 		}
 	}
+
+	if( out_fmt == OF_PGCOPY ) {
+		FDat::print_pgcopy_trailer();
+	}
 	return true;
 }
 
@@ -848,46 +1421,555 @@ void Metastock::add_mr_list_datfile(  int datnum, const char* datname )
 
 
 
-bool Metastock::dumpData() const
+/**
+ * print the header and symbol table of raw output, all symbols which are
+ * not excluded are listed
+ */
+void Metastock::printRawHeader() const
 {
-	char buf[256];
+	char buf[RAW_SIZE_HEADER];
+	int n_symbols = 0;
 	int len;
 
-	if( prnt_data_fields == 0 && prnt_data_mr_fields == 0 ) {
-		setError( "bad output format", "no columns given" );
-		return false;
-	}
-
-	if( print_header ) {
-		len = mr_header_to_string( buf, prnt_data_mr_fields, print_sep );
-		if( prnt_data_mr_fields != 0 && prnt_data_fields != 0 ) {
-			buf[len++] = print_sep;
-			buf[len] = '\0';
+	for( int i = 1; i<mr_len; i++ ) {
+		if( mr_list[i].record_number != 0 && !mr_skip_list[i] ) {
+			n_symbols++;
 		}
-		FDat::print_header( buf );
 	}
 
+	len = raw_header( buf, n_symbols );
+	fwrite( buf, 1, len, (FILE*)out );
+	stats_count( SC_BYTES_WRITTEN, len );
+
 	for( int i = 1; i<mr_len; i++ ) {
 		if( mr_list[i].record_number != 0 && !mr_skip_list[i] ) {
-			assert( mr_list[i].file_number == i );
-			len = mr_record_to_string( buf, &mr_list[i],
-				prnt_data_mr_fields, print_sep );
-			if( prnt_data_mr_fields != 0 && prnt_data_fields != 0 ) {
-				buf[len++] = print_sep;
-				buf[len] = '\0';
+			len = mr_record_to_raw( buf, &mr_list[i] );
+			fwrite( buf, 1, len, (FILE*)out );
+			stats_count( SC_BYTES_WRITTEN, len );
+		}
+	}
+}
+
+
+/**
+ * symbol info columns to be printed before each line of a dat file, returns
+ * the length which counts in binary formats
+ */
+int Metastock::dataPrefix( char *buf, const master_record *mr ) const
+{
+	int len;
+	if( out_fmt == OF_COLUMNAR ) {
+		/* columns are fixed, symbols are stored once */
+		return 0;
+	} else if( out_fmt == OF_RAW ) {
+		/* columns are fixed */
+		return mr_raw_prefix( buf, mr );
+	} else if( out_fmt == OF_PGCOPY ) {
+		return mr_record_to_pgcopy( buf, mr, prnt_data_mr_fields,
+			count_bits(prnt_data_mr_fields & MASTER_FORMAT_MASK)
+			+ count_bits(prnt_data_fields & DATA_FORMAT_MASK) );
+	} else if( out_fmt == OF_JSONL ) {
+		len = mr_record_to_json( buf, mr, prnt_data_mr_fields );
+		if( prnt_data_mr_fields != 0 && prnt_data_fields != 0 ) {
+			buf[len++] = ',';
+		}
+	} else {
+		len = mr_record_to_string( buf, mr, prnt_data_mr_fields, print_sep );
+		if( prnt_data_mr_fields != 0 && prnt_data_fields != 0 ) {
+			buf[len++] = print_sep;
+		}
+	}
+	buf[len] = '\0';
+	return len;
+}
+
+
+bool Metastock::dumpData() const
+{
+	char buf[MAX_SIZE_MR_JSON + 2];
+	int len;
+
+	if( prnt_data_fields == 0 && prnt_data_mr_fields == 0 ) {
+		setError( "bad output format", "no columns given" );
+		return false;
+	}
+	if( out_fmt == OF_COLUMNAR ) {
+		return dumpColumnar();
+	}
+
+	if( stdin_fields != 0 ) {
+		/* no master files, so there are no symbol info columns */
+		if( prnt_data_fields == 0 ) {
+			setError( "bad output format", "no data columns given" );
+			return false;
+		}
+		if( print_header && out_fmt == OF_TEXT ) {
+			FDat::print_header( "" );
+		}
+		if( out_fmt == OF_PGCOPY ) {
+			FDat::print_pgcopy_header();
+			len = mr_record_to_pgcopy( buf, NULL, 0,
+				count_bits(prnt_data_fields & DATA_FORMAT_MASK) );
+		} else if( out_fmt == OF_RAW ) {
+			printRawHeader();
+			len = mr_raw_prefix( buf, NULL );
+		} else {
+			strcpy( buf, (out_fmt == OF_JSONL) ? "{" : "" );
+			len = strlen( buf );
+		}
+		fdat_buf->setName( "stdin" );
+		stats_file_begin( 0, "stdin", "" );
+		stats_count( SC_FILES_READ, 1 );
+		bool ok = streamData( STDIN_FILENO, -1, stdin_fields, buf, len );
+		stats_file_end();
+		if( ok && out_fmt == OF_PGCOPY ) {
+			FDat::print_pgcopy_trailer();
+		}
+		return ok;
+	}
+
+	if( print_header && out_fmt == OF_TEXT ) {
+		len = mr_header_to_string( buf, prnt_data_mr_fields, print_sep );
+		if( prnt_data_mr_fields != 0 && prnt_data_fields != 0 ) {
+			buf[len++] = print_sep;
+			buf[len] = '\0';
+		}
+		FDat::print_header( buf );
+	}
+	if( out_fmt == OF_PGCOPY ) {
+		FDat::print_pgcopy_header();
+	} else if( out_fmt == OF_RAW ) {
+		printRawHeader();
+	}
+
+	if( merge_by_time || snapshot_date != 0 ) {
+		if( merge_by_time ? !mergeByTime() : !dumpSnapshot() ) {
+			return false;
+		}
+		if( out_fmt == OF_PGCOPY ) {
+			FDat::print_pgcopy_trailer();
+		}
+		return true;
+	}
+
+	for( int i = 1; i<mr_len; i++ ) {
+		if( mr_list[i].record_number != 0 && !mr_skip_list[i]
+				&& pruneFile( &mr_list[i] ) ) {
+			stats_count( SC_SKIP_PRUNED, 1 );
+		} else if( mr_list[i].record_number != 0 && !mr_skip_list[i] ) {
+			assert( mr_list[i].file_number == i );
+			len = dataPrefix( buf, &mr_list[i] );
+			stats_file_begin( i, mr_list[i].file_name, mr_list[i].c_symbol );
+			bool ok = dumpData( i, mr_list[i].field_bitset, buf, len );
+			stats_file_end();
+			if( !ok ) {
+				return false;
+			}
+		} else if( mr_list[i].record_number != 0 ) {
+			stats_count( SC_SKIP_EXCLUDED, 1 );
+		}
+	}
+
+	if( out_fmt == OF_PGCOPY ) {
+		FDat::print_pgcopy_trailer();
+	}
+	return true;
+}
+
+
+
+/* read exactly len bytes unless the file ends, returns -1 on errors */
+static long long read_full( int fd, char *buf, long long len )
+{
+	long long got = 0;
+	while( got < len ) {
+		ssize_t n = read( fd, buf + got, len - got );
+		if( n < 0 ) {
+			return -1;
+		} else if( n == 0 ) {
+			break;
+		}
+		got += n;
+	}
+	return got;
+}
+
+
+/* total size of the read buffers of --merge-by-time */
+#define MERGE_BUFFER_SIZE (64 * 1024 * 1024)
+/* bars per file buffer, between these bounds */
+#define MERGE_MIN_BARS 64
+#define MERGE_MAX_BARS 8192
+/* dat files stay open between refills up to this number of files */
+#define MERGE_MAX_OPEN 256
+/* merged lines are printed in batches of this size */
+#define MERGE_BATCH 4096
+
+/* one dat file (or its blocks in a columnar archive) of --merge-by-time */
+struct merge_stream
+{
+	int file;
+	FDat *dat;
+	char *pfx;
+	int pfx_len;
+	int fd;
+	long long next; /* next record of the dat file resp. next block */
+	long long left; /* records left in the dat file */
+	int in_block; /* bars of block next already taken */
+	ms_bar *bars;
+	int pos;
+	int cnt;
+	long long key; /* date and time of bars[pos] */
+};
+
+static inline long long merge_key( const ms_bar *bar )
+{
+	return (long long)bar->date * 1000000 + bar->time;
+}
+
+/* order of the heap, equal times are printed in file order */
+static inline bool merge_before( const merge_stream *a,
+	const merge_stream *b )
+{
+	return a->key < b->key || (a->key == b->key && a->file < b->file);
+}
+
+static void merge_sift_down( merge_stream **heap, int n, int i )
+{
+	merge_stream *x = heap[i];
+	for( ;; ) {
+		int c = 2 * i + 1;
+		if( c >= n ) {
+			break;
+		}
+		if( c + 1 < n && merge_before( heap[c + 1], heap[c] ) ) {
+			c++;
+		}
+		if( !merge_before( heap[c], x ) ) {
+			break;
+		}
+		heap[i] = heap[c];
+		i = c;
+	}
+	heap[i] = x;
+}
+
+
+/**
+ * Check dat file n and set up its stream, the file is not kept open yet.
+ * Missing and unusable files are skipped with a warning like in
+ * dumpData(), returns false for them too but without error.
+ */
+bool Metastock::openStream( int n, merge_stream *st, bool *err ) const
+{
+	const master_record *mr = &mr_list[n];
+	const int rec_len = count_bits( mr->field_bitset ) * 4;
+
+	*err = false;
+	if( *mr->file_name == '\0' ) {
+		char msg[64];
+		snprintf( msg, sizeof(msg), "F%u.dat (or .mwd)", n);
+		printWarn( "missing data file", msg );
+		stats_count( SC_SKIP_MISSING, 1 );
+		return false;
+	}
+	stats_count( SC_FILES_READ, 1 );
+
+	memset( st, 0, sizeof(*st) );
+	st->file = n;
+	st->fd = -1;
+	if( col_ar != NULL ) {
+		st->next = col_ar->firstBlock( n );
+		if( st->next < 0 ) {
+			return false;
+		}
+	} else {
+		stats_phase_begin( ST_OPEN_DATA );
+		int fd = openFile( mr->file_name );
+		if( fd < 0 ) {
+			*err = true;
+			return false;
+		}
+		stats_phase_end( ST_OPEN_DATA );
+		struct stat s;
+		char header[rec_len > 0 ? rec_len : 1];
+		long long got = 0;
+		if( fstat( fd, &s ) < 0
+				|| (got = read_full( fd, header, rec_len )) < 0 ) {
+			setError( mr->file_name, strerror(errno) );
+			close( fd );
+			*err = true;
+			return false;
+		}
+		close( fd );
+		stats_count( SC_BYTES_READ, got );
+		long long cnt = FDat( header, got < rec_len ? got : s.st_size,
+			mr->field_bitset ).countRecords();
+		if( rec_len == 0 || cnt < 0 ) {
+			printWarn( "fdat file unusable", mr->file_name );
+			stats_count( SC_SKIP_UNUSABLE, 1 );
+			return false;
+		}
+		st->next = 1;
+		st->left = cnt;
+	}
+
+	char buf[MAX_SIZE_MR_JSON + 2];
+	st->pfx_len = dataPrefix( buf, mr );
+	st->pfx = (char*) malloc( st->pfx_len + 1 );
+	memcpy( st->pfx, buf, st->pfx_len );
+	st->dat = new FDat( NULL, 0, mr->field_bitset );
+	return true;
+}
+
+/**
+ * Read the next up to cap bars of a stream which match the filters. The
+ * dat file is opened and closed again unless keep_open, raw must hold cap
+ * records. Returns false on errors, st->cnt is 0 at the end of the file.
+ */
+bool Metastock::refillStream( merge_stream *st, int cap, char *raw,
+	bool keep_open ) const
+{
+	const master_record *mr = &mr_list[st->file];
+	const int rec_len = count_bits( mr->field_bitset ) * 4;
+
+	st->pos = 0;
+	st->cnt = 0;
+	while( st->cnt == 0 && col_ar != NULL && st->next < col_ar->countBlocks()
+			&& col_ar->blockFile( st->next ) == st->file ) {
+		ms_bar *bars;
+		stats_phase_begin( ST_READ_DATA );
+		int cnt = col_ar->readBlock( st->next, &bars );
+		stats_phase_end( ST_READ_DATA );
+		if( cnt < 0 ) {
+			setError( col_ar->lastError() );
+			return false;
+		}
+		if( st->in_block == 0 ) {
+			stats_count( SC_BYTES_READ, col_ar->blockSize( st->next ) );
+			stats_count( SC_RECORDS_DECODED, cnt );
+		}
+		/* blocks larger than cap are decoded again for each part */
+		int take = (cnt - st->in_block < cap) ? cnt - st->in_block : cap;
+		memcpy( st->bars, bars + st->in_block, take * sizeof(ms_bar) );
+		st->in_block += take;
+		if( st->in_block >= cnt ) {
+			st->next++;
+			st->in_block = 0;
+		}
+		st->cnt = st->dat->filterBars( st->bars, take );
+	}
+
+	while( st->cnt == 0 && col_ar == NULL && st->left > 0 ) {
+		if( st->fd < 0 ) {
+			stats_phase_begin( ST_OPEN_DATA );
+			st->fd = openFile( mr->file_name );
+			if( st->fd < 0 ) {
+				return false;
 			}
-			if( !dumpData( i, mr_list[i].field_bitset, buf ) ) {
+			stats_phase_end( ST_OPEN_DATA );
+			if( lseek( st->fd, st->next * rec_len, SEEK_SET ) < 0 ) {
+				setError( mr->file_name, strerror(errno) );
 				return false;
 			}
 		}
+		long long want = (st->left < cap) ? st->left : cap;
+		stats_phase_begin( ST_READ_DATA );
+		long long got = read_full( st->fd, raw, want * rec_len );
+		stats_phase_end( ST_READ_DATA );
+		if( got < 0 ) {
+			setError( mr->file_name, strerror(errno) );
+			return false;
+		}
+		long long recs = got / rec_len;
+		stats_count( SC_BYTES_READ, got );
+		stats_count( SC_RECORDS_DECODED, recs );
+		st->next += recs;
+		st->left -= recs;
+		if( recs < want ) {
+			printWarn( "fdat file truncated", mr->file_name );
+			stats_count( SC_TRUNCATED, 1 );
+			st->left = 0;
+		}
+		st->dat->decodeRecords( raw, recs, st->bars );
+		st->cnt = st->dat->filterBars( st->bars, recs );
+	}
+
+	if( st->fd >= 0 && (!keep_open || st->left == 0) ) {
+		close( st->fd );
+		st->fd = -1;
+	}
+	if( st->cnt > 0 ) {
+		st->key = merge_key( &st->bars[0] );
 	}
 	return true;
 }
 
+/**
+ * Print the time series of all files as one stream ordered by date and
+ * time (k-way merge). Each file gets a read buffer of bounded size, which
+ * is refilled when it runs empty. Many files are not kept open between
+ * refills.
+ */
+bool Metastock::mergeByTime() const
+{
+	merge_stream *streams =
+		(merge_stream*) malloc( mr_len * sizeof(merge_stream) );
+	int n = 0;
+	bool ok = true;
+
+	for( int i = 1; i<mr_len; i++ ) {
+		if( mr_list[i].record_number != 0 && !mr_skip_list[i]
+				&& pruneFile( &mr_list[i] ) ) {
+			stats_count( SC_SKIP_PRUNED, 1 );
+		} else if( mr_list[i].record_number != 0 && !mr_skip_list[i] ) {
+			bool err;
+			if( openStream( i, &streams[n], &err ) ) {
+				n++;
+			} else if( err ) {
+				ok = false;
+				break;
+			}
+		} else if( mr_list[i].record_number != 0 ) {
+			stats_count( SC_SKIP_EXCLUDED, 1 );
+		}
+	}
+
+	long long cap = (n > 0) ? MERGE_BUFFER_SIZE / (n * sizeof(ms_bar)) : 0;
+	cap = (cap < MERGE_MIN_BARS) ? MERGE_MIN_BARS :
+		(cap > MERGE_MAX_BARS) ? MERGE_MAX_BARS : cap;
+	const bool keep_open = n <= MERGE_MAX_OPEN;
+	ms_bar *bars = (ms_bar*) malloc( n * cap * sizeof(ms_bar) );
+	char *raw = (char*) malloc( cap * 8 * 4 );
+	merge_stream **heap = (merge_stream**) malloc( n * sizeof(merge_stream*) );
+	merged_bar *rows = (merged_bar*) malloc( MERGE_BATCH * sizeof(merged_bar) );
+
+	int h = 0;
+	for( int s = 0; ok && s < n; s++ ) {
+		streams[s].bars = bars + s * cap;
+		if( !refillStream( &streams[s], cap, raw, keep_open ) ) {
+			ok = false;
+		} else if( streams[s].cnt > 0 ) {
+			heap[h++] = &streams[s];
+		}
+	}
+	for( int i = h / 2 - 1; i >= 0; i-- ) {
+		merge_sift_down( heap, h, i );
+	}
+
+	int n_rows = 0;
+	while( ok && h > 0 ) {
+		merge_stream *st = heap[0];
+		merged_bar *row = &rows[n_rows++];
+		row->dat = st->dat;
+		row->header = st->pfx;
+		row->h_size = st->pfx_len;
+		row->bar = st->bars[st->pos++];
+
+		if( n_rows == MERGE_BATCH ) {
+			if( FDat::printMerged( rows, n_rows ) < 0 ) {
+				setError( "writing interrupted" );
+				ok = false;
+			}
+			n_rows = 0;
+		}
+
+		if( st->pos == st->cnt
+				&& !refillStream( st, cap, raw, keep_open ) ) {
+			ok = false;
+		} else if( st->pos < st->cnt ) {
+			st->key = merge_key( &st->bars[st->pos] );
+			merge_sift_down( heap, h, 0 );
+		} else {
+			heap[0] = heap[--h];
+			merge_sift_down( heap, h, 0 );
+		}
+	}
+	if( ok && n_rows > 0 && FDat::printMerged( rows, n_rows ) < 0 ) {
+		setError( "writing interrupted" );
+		ok = false;
+	}
+
+	for( int s = 0; s < n; s++ ) {
+		if( streams[s].fd >= 0 ) {
+			close( streams[s].fd );
+		}
+		free( streams[s].pfx );
+		delete streams[s].dat;
+	}
+	free( rows );
+	free( heap );
+	free( raw );
+	free( bars );
+	free( streams );
+	return ok;
+}
+
+
+
+/**
+ * Write all time series to a columnar archive. All columns of the dat files
+ * are stored, --format does not apply.
+ */
+bool Metastock::dumpColumnar() const
+{
+	ColWriter writer( out );
+	bool ok = writer.begin();
+	if( !ok ) {
+		setError( "writing interrupted" );
+		return false;
+	}
+	FDat::set_col_writer( &writer );
+
+	if( stdin_fields != 0 ) {
+		master_record mr;
+		memset( &mr, 0, sizeof(mr) );
+		mr.file_number = 1;
+		mr.record_number = 1;
+		mr.field_bitset = stdin_fields;
+		strcpy( mr.file_name, "stdin" );
+		fdat_buf->setName( "stdin" );
+		stats_file_begin( 0, "stdin", "" );
+		stats_count( SC_FILES_READ, 1 );
+		writer.beginSymbol( &mr );
+		ok = streamData( STDIN_FILENO, -1, stdin_fields, NULL, 0 );
+		if( ok && !writer.endSymbol() ) {
+			setError( "writing interrupted" );
+			ok = false;
+		}
+		stats_file_end();
+	}
+
+	for( int i = 1; ok && stdin_fields == 0 && i<mr_len; i++ ) {
+		if( mr_list[i].record_number != 0 && !mr_skip_list[i]
+				&& pruneFile( &mr_list[i] ) ) {
+			stats_count( SC_SKIP_PRUNED, 1 );
+		} else if( mr_list[i].record_number != 0 && !mr_skip_list[i] ) {
+			assert( mr_list[i].file_number == i );
+			stats_file_begin( i, mr_list[i].file_name, mr_list[i].c_symbol );
+			writer.beginSymbol( &mr_list[i] );
+			ok = dumpData( i, mr_list[i].field_bitset, NULL, 0 );
+			if( ok && !writer.endSymbol() ) {
+				setError( "writing interrupted" );
+				ok = false;
+			}
+			stats_file_end();
+		} else if( mr_list[i].record_number != 0 ) {
+			stats_count( SC_SKIP_EXCLUDED, 1 );
+		}
+	}
+
+	if( ok && !writer.finish() ) {
+		setError( "writing interrupted" );
+		ok = false;
+	}
+	FDat::set_col_writer( NULL );
+	return ok;
+}
 
 
 bool Metastock::dumpData( unsigned short n, unsigned char fields,
-	const char *pfx ) const
+	const char *pfx, int pfx_len ) const
 {
 	fdat_buf->setName( mr_list[n].file_name );
 
@@ -895,26 +1977,1672 @@ bool Metastock::dumpData( unsigned short n, unsigned char fields,
 		char msg[64];
 		snprintf( msg, sizeof(msg), "F%u.dat (or .mwd)", n);
 		printWarn( "missing data file", msg );
+		stats_count( SC_SKIP_MISSING, 1 );
+		return true;
+	}
+	stats_count( SC_FILES_READ, 1 );
+
+	if( col_ar != NULL ) {
+		return dumpColData( n, fields, pfx, pfx_len );
+	} else if( ms_ar != NULL ) {
+		/* archive members are read at once */
+		stats_phase_begin( ST_READ_DATA );
+		if( ! readFile( fdat_buf ) ) {
+			return false;
+		}
+		stats_phase_end( ST_READ_DATA );
+
+		FDat datfile( fdat_buf->constBuf(), fdat_buf->len(), fields );
+		if( datfile.countRecords() < 0 ) {
+			printWarn( "fdat file unusable", fdat_buf->constName() );
+			stats_count( SC_SKIP_UNUSABLE, 1 );
+			return true;
+		}
+		datfile.guessPrecision( fdat_buf->constBuf() + count_bits(fields) * 4,
+			datfile.countRecords() );
+		if( datfile.print( pfx, pfx_len ) < 0
+				|| datfile.printPending( pfx, pfx_len ) < 0 ) {
+			/* This is should only happen on WIN32 instead of SIGPIPE */
+			setError( "writing interrupted" );
+			return false;
+		}
 		return true;
 	}
 
-	if( ! readFile( fdat_buf ) ) {
+	if( dat_cache != NULL || zone_maps != NULL ) {
+		char file_path[strlen(ms_dir) + strlen(fdat_buf->constName()) + 1];
+		strcpy( file_path, ms_dir );
+		strcat( file_path, fdat_buf->constName() );
+		return dumpCachedData( file_path, fields, pfx, pfx_len );
+	}
+
+	stats_phase_begin( ST_OPEN_DATA );
+	int fd = openFile( fdat_buf->constName() );
+	if( fd < 0 ) {
 		return false;
 	}
 
-	FDat datfile( fdat_buf->constBuf(), fdat_buf->len(), fields );
-// 	fprintf( stderr, "#%d: %d x %d bytes\n",
-// 		n, datfile.countRecords(), count_bits(fields) * 4 );
+	struct stat s;
+	bool ret = false;
+	if( fstat( fd, &s ) < 0 ) {
+		setError( fdat_buf->constName(), strerror(errno) );
+	} else {
+		stats_phase_end( ST_OPEN_DATA );
+		ret = streamData( fd, s.st_size, fields, pfx, pfx_len );
+	}
 
-	if( datfile.countRecords() < 0 ) {
-		printWarn( "fdat file unusable", fdat_buf->constName() );
-		return true;
+	close( fd );
+	return ret;
+}
+
+
+/**
+ * Print a dat file from the cache if it has not been changed since it was
+ * cached. Otherwise print the blocks which may match --date-from according
+ * to its zone map or stream it and update cache and zone map on the fly.
+ * Cache errors are just warnings.
+ */
+bool Metastock::dumpCachedData( const char *path, unsigned char fields,
+	const char *pfx, int pfx_len ) const
+{
+	struct stat s;
+	long long cnt = -1;
+
+	stats_phase_begin( ST_OPEN_DATA );
+	int fd = openFile( fdat_buf->constName() );
+	if( fd < 0 ) {
+		return false;
+	}
+	if( fstat( fd, &s ) < 0 ) {
+		setError( path, strerror(errno) );
+		close( fd );
+		return false;
+	}
+
+	if( dat_cache != NULL ) {
+		ms_bar *bars;
+		cnt = dat_cache->load( path, &s, fields, (void**)&bars );
+		if( cnt >= 0 ) {
+			stats_phase_end( ST_OPEN_DATA );
+			close( fd );
+			stats_count( SC_CACHE_HITS, 1 );
+			bool ret = printCachedBars( fields, bars, cnt, pfx, pfx_len );
+			dat_cache->release();
+			return ret;
+		}
+		stats_count( SC_CACHE_MISSES, 1 );
+		if( !dat_cache->beginStore( path, &s, fields ) ) {
+			printWarn( "cache", dat_cache->lastError() );
+		}
+	}
+
+	if( zone_maps != NULL ) {
+		zm_block *zones;
+		cnt = zone_maps->load( path, &s, fields, (void**)&zones );
+		if( cnt >= 0 && ((print_date_from > 0 && (fields & D_DAT))
+				|| where != NULL) && auto_prec_fields == 0 ) {
+			/* pruning would change the precision sample */
+			stats_phase_end( ST_OPEN_DATA );
+			stats_count( SC_ZONES_HITS, 1 );
+			commitStore( dat_cache, false, SC_CACHE_STORED, "cache" );
+			bool ret = dumpZones( fd, fields, zones, cnt, pfx, pfx_len );
+			zone_maps->release();
+			close( fd );
+			return ret;
+		} else if( cnt >= 0 ) {
+			/* valid but useless now */
+			zone_maps->release();
+		} else {
+			stats_count( SC_ZONES_MISSES, 1 );
+			if( !zone_maps->beginStore( path, &s, fields ) ) {
+				printWarn( "zone map", zone_maps->lastError() );
+			}
+		}
 	}
-	if( datfile.print( pfx ) < 0) {
+	stats_phase_end( ST_OPEN_DATA );
+
+	bool ret = streamData( fd, s.st_size, fields, pfx, pfx_len );
+	close( fd );
+
+	commitStore( dat_cache, ret, SC_CACHE_STORED, "cache" );
+	commitStore( zone_maps, ret, SC_ZONES_STORED, "zone map" );
+	return ret;
+}
+
+
+/**
+ * print the bars of a cache hit like streamData() prints the dat file
+ */
+bool Metastock::printCachedBars( unsigned char fields, ms_bar *bars,
+	long long cnt, const char *pfx, int pfx_len ) const
+{
+	FDat datfile( NULL, 0, fields );
+
+	/* sample the same bars as streamData() does */
+	const long long chunk_recs = DAT_CHUNK_SIZE / (count_bits(fields) * 4);
+	datfile.guessPrecision( bars, cnt < chunk_recs ? cnt : chunk_recs );
+	cnt = datfile.filterBars( bars, cnt );
+	if( datfile.printBars( pfx, pfx_len, bars, cnt ) < 0
+			|| datfile.printPending( pfx, pfx_len ) < 0 ) {
 		/* This is should only happen on WIN32 instead of SIGPIPE */
 		setError( "writing interrupted" );
 		return false;
 	}
+	return true;
+}
+
+
+/**
+ * the filters might match some records of zone z
+ */
+bool Metastock::zoneMatches( unsigned char fields,
+	const zm_block *z ) const
+{
+	if( (fields & D_DAT) && z->max_date < print_date_from ) {
+		return false;
+	} else if( where != NULL ) {
+		wh_range ranges[WH_COLUMNS];
+		wh_ranges_unknown( ranges );
+		ranges[WH_DATE].lo = z->min_date;
+		ranges[WH_DATE].hi = z->max_date;
+		ranges[WH_CLOSE].lo = z->min_close;
+		ranges[WH_CLOSE].hi = z->max_close;
+		ranges[WH_VOLUME].lo = z->min_volume;
+		ranges[WH_VOLUME].hi = z->max_volume;
+		return where->mayMatch( ranges );
+	}
+	return true;
+}
+
+/**
+ * Print the blocks of a dat file which may match the filters according to
+ * its zone map, the other blocks are not read at all. Adjacent blocks are
+ * read at once.
+ */
+bool Metastock::dumpZones( int fd, unsigned char fields,
+	const zm_block *zones, long long n_zones, const char *pfx,
+	int pfx_len ) const
+{
+	const int rec_len = count_bits( fields ) * 4;
+	const long long chunk_recs = DAT_CHUNK_SIZE / rec_len;
+	FDat datfile( NULL, 0, fields );
+	long long first = 0;
+
+	for( long long z = 0; z < n_zones; ) {
+		if( !zoneMatches( fields, &zones[z] ) ) {
+			stats_count( SC_ZONES_PRUNED, 1 );
+			stats_count( SC_RECORDS_FILTERED, zones[z].records );
+			first += zones[z].records;
+			z++;
+			continue;
+		}
+
+		long long recs = 0;
+		do {
+			recs += zones[z].records;
+			z++;
+		} while( z < n_zones && zoneMatches( fields, &zones[z] )
+			&& recs + zones[z].records <= chunk_recs );
+
+		stats_phase_begin( ST_READ_DATA );
+		long long got = -1;
+		if( lseek( fd, (first + 1) * rec_len, SEEK_SET ) >= 0 ) {
+			got = fdat_buf->readChunk( fd, recs * rec_len );
+		}
+		stats_phase_end( ST_READ_DATA );
+		if( got != recs * rec_len ) {
+			/* the zone map was valid a moment ago */
+			setError( fdat_buf->constName(),
+				got < 0 ? strerror(errno) : "changed while reading" );
+			return false;
+		}
 
+		if( datfile.printRecords( pfx, pfx_len, fdat_buf->constBuf(),
+				recs ) < 0 ) {
+			/* This is should only happen on WIN32 instead of SIGPIPE */
+			setError( "writing interrupted" );
+			return false;
+		}
+		first += recs;
+	}
+	if( datfile.printPending( pfx, pfx_len ) < 0 ) {
+		setError( "writing interrupted" );
+		return false;
+	}
 	return true;
 }
+
+
+/**
+ * finish a cache entry written by streamData(), ok is false on errors
+ */
+void Metastock::commitStore( DatCache *dc, bool ok, st_counter stored,
+	const char *what ) const
+{
+	if( dc == NULL || !dc->storing() ) {
+		return;
+	} else if( !ok ) {
+		dc->abortStore();
+	} else if( dc->commitStore() ) {
+		stats_count( stored, 1 );
+	} else {
+		printWarn( what, dc->lastError() );
+	}
+}
+
+
+/**
+ * Print a time series from a columnar archive block by block. Blocks ending
+ * before --date-from or out of the --where date range are not even read.
+ */
+bool Metastock::dumpColData( unsigned short n, unsigned char fields,
+	const char *pfx, int pfx_len ) const
+{
+	FDat datfile( NULL, 0, fields );
+	bool first = true;
+
+	for( int b = col_ar->firstBlock( n ); b >= 0 && b < col_ar->countBlocks()
+			&& col_ar->blockFile( b ) == n; b++ ) {
+		bool skip = (fields & D_DAT)
+			&& col_ar->blockMaxDate( b ) < print_date_from;
+		if( !skip && where != NULL ) {
+			wh_range ranges[WH_COLUMNS];
+			wh_ranges_unknown( ranges );
+			ranges[WH_DATE].lo = col_ar->blockMinDate( b );
+			ranges[WH_DATE].hi = col_ar->blockMaxDate( b );
+			skip = !where->mayMatch( ranges );
+		}
+		if( skip ) {
+			stats_count( SC_RECORDS_FILTERED, col_ar->blockRecords( b ) );
+			continue;
+		}
+
+		ms_bar *bars;
+		stats_phase_begin( ST_READ_DATA );
+		int cnt = col_ar->readBlock( b, &bars );
+		stats_phase_end( ST_READ_DATA );
+		if( cnt < 0 ) {
+			setError( col_ar->lastError() );
+			return false;
+		}
+		stats_count( SC_RECORDS_DECODED, cnt );
+
+		/* like streamData() sample the first block before filtering */
+		if( first && cnt > 0 ) {
+			datfile.guessPrecision( bars, cnt );
+			first = false;
+		}
+		cnt = datfile.filterBars( bars, cnt );
+		if( datfile.printBars( pfx, pfx_len, bars, cnt ) < 0 ) {
+			/* This is should only happen on WIN32 instead of SIGPIPE */
+			setError( "writing interrupted" );
+			return false;
+		}
+	}
+	if( datfile.printPending( pfx, pfx_len ) < 0 ) {
+		setError( "writing interrupted" );
+		return false;
+	}
+	return true;
+}
+
+
+/**
+ * Decode and print a dat file in chunks of whole records, so memory usage
+ * does not depend on the file size. Size is the file size or -1 if unknown
+ * (pipes). Pending cache entries and zone maps are filled on the fly.
+ */
+bool Metastock::streamData( int fd, long long size, unsigned char fields,
+	const char *pfx, int pfx_len ) const
+{
+	const int rec_len = count_bits( fields ) * 4;
+
+	stats_phase_begin( ST_READ_DATA );
+	long long got = (rec_len > 0) ? fdat_buf->readChunk( fd, rec_len ) : 0;
+	stats_phase_end( ST_READ_DATA );
+	if( got < 0 ) {
+		setError( fdat_buf->constName(), strerror(errno) );
+		return false;
+	}
+	if( size < 0 || got < rec_len ) {
+		size = (got < rec_len) ? got : LLONG_MAX;
+	}
+
+	/* only the header record is buffered yet, we need it for counting.
+	   readChunk() may move the buffer, so datfile gets none. */
+	long long cnt = FDat( fdat_buf->constBuf(), size, fields ).countRecords();
+	FDat datfile( NULL, 0, fields );
+// 	fprintf( stderr, "#%s: %lld x %d bytes\n",
+// 		fdat_buf->constName(), cnt, rec_len );
+
+	DatCache *cache = (dat_cache != NULL && dat_cache->storing()) ?
+		dat_cache : NULL;
+	DatCache *zmap = (zone_maps != NULL && zone_maps->storing()) ?
+		zone_maps : NULL;
+	if( rec_len == 0 || cnt < 0 ) {
+		printWarn( "fdat file unusable", fdat_buf->constName() );
+		stats_count( SC_SKIP_UNUSABLE, 1 );
+		commitStore( cache, false, SC_CACHE_STORED, "cache" );
+		commitStore( zmap, false, SC_ZONES_STORED, "zone map" );
+		return true;
+	}
+
+	const long long chunk_recs = DAT_CHUNK_SIZE / rec_len;
+	/* chunks are decoded at once when they have to be stored */
+	ms_bar *bars = (cache != NULL || zmap != NULL) ?
+		(ms_bar*) malloc( chunk_recs * sizeof(ms_bar) ) : NULL;
+	zm_block zone;
+	zm_init( &zone );
+	bool ret = true;
+	bool first = true;
+	while( cnt > 0 ) {
+		long long want = (cnt < chunk_recs) ? cnt : chunk_recs;
+		stats_phase_begin( ST_READ_DATA );
+		got = fdat_buf->readChunk( fd, want * rec_len );
+		stats_phase_end( ST_READ_DATA );
+		if( got < 0 ) {
+			setError( fdat_buf->constName(), strerror(errno) );
+			ret = false;
+			break;
+		}
+
+		long long recs = got / rec_len;
+		if( first ) {
+			/* the first chunk has to be sample enough */
+			datfile.guessPrecision( fdat_buf->constBuf(), recs );
+			first = false;
+		}
+		int err;
+		if( bars != NULL ) {
+			datfile.decodeRecords( fdat_buf->constBuf(), recs, bars );
+			if( cache != NULL && cache->storing()
+					&& !cache->storeItems( bars, recs ) ) {
+				printWarn( "cache", cache->lastError() );
+			}
+			if( zmap != NULL && zmap->storing() ) {
+				addZones( &zone, bars, recs );
+			}
+			long long n = datfile.filterBars( bars, recs );
+			err = datfile.printBars( pfx, pfx_len, bars, n );
+		} else {
+			err = datfile.printRecords( pfx, pfx_len, fdat_buf->constBuf(),
+				recs );
+		}
+		if( err < 0 ) {
+			/* This is should only happen on WIN32 instead of SIGPIPE */
+			setError( "writing interrupted" );
+			ret = false;
+			break;
+		}
+
+		cnt -= recs;
+		if( recs < want ) {
+			printWarn( "fdat file truncated", fdat_buf->constName() );
+			stats_count( SC_TRUNCATED, 1 );
+			/* would hide the warning next time */
+			commitStore( cache, false, SC_CACHE_STORED, "cache" );
+			commitStore( zmap, false, SC_ZONES_STORED, "zone map" );
+			break;
+		}
+	}
+
+	if( zmap != NULL && zmap->storing() && zone.records > 0
+			&& !zmap->storeItems( &zone, 1 ) ) {
+		printWarn( "zone map", zmap->lastError() );
+	}
+	free( bars );
+
+	if( ret && datfile.printPending( pfx, pfx_len ) < 0 ) {
+		setError( "writing interrupted" );
+		ret = false;
+	}
+	return ret;
+}
+
+/**
+ * extend the current zone by cnt bars, full zones are stored
+ */
+void Metastock::addZones( zm_block *zone, const ms_bar *bars,
+	long long cnt ) const
+{
+	while( cnt > 0 ) {
+		long long n = ZM_BLOCK_RECORDS - zone->records;
+		if( n > cnt ) {
+			n = cnt;
+		}
+		zm_add( zone, bars, n );
+		bars += n;
+		cnt -= n;
+		if( zone->records == ZM_BLOCK_RECORDS ) {
+			if( !zone_maps->storeItems( zone, 1 ) ) {
+				printWarn( "zone map", zone_maps->lastError() );
+				return;
+			}
+			zm_init( zone );
+		}
+	}
+}
+
+
+
+/* max record length of dat files, 8 fields */
+#define MAX_DAT_RECORD_LENGTH 32
+
+bool Metastock::scanData() const
+{
+	char buf[MAX_SIZE_MR_STRING + 1];
+	int len;
+
+	if( stdin_fields != 0 ) {
+		setError( "--scan", "can not read stdin" );
+		return false;
+	} else if( resampling ) {
+		setError( "--scan", "can not be combined with --resample" );
+		return false;
+	}
+
+	if( print_header ) {
+		len = mr_header_to_string( buf, prnt_data_mr_fields, print_sep );
+		if( prnt_data_mr_fields != 0 ) {
+			buf[len++] = print_sep;
+			buf[len] = '\0';
+		}
+		fprintf( (FILE*)out, "%s" "records%c" "first_date%c" "last_date%c"
+			"file_size\n", buf, print_sep, print_sep, print_sep );
+	}
+
+	for( int i = 1; i<mr_len; i++ ) {
+		if( mr_list[i].record_number != 0 && !mr_skip_list[i] ) {
+			assert( mr_list[i].file_number == i );
+			len = mr_record_to_string( buf, &mr_list[i],
+				prnt_data_mr_fields, print_sep );
+			if( prnt_data_mr_fields != 0 ) {
+				buf[len++] = print_sep;
+				buf[len] = '\0';
+			}
+			if( !scanData( i, mr_list[i].field_bitset, buf ) ) {
+				return false;
+			}
+		}
+	}
+	fflush( (FILE*)out );
+	return true;
+}
+
+
+
+/**
+ * Print record count, first and last date and file size of one dat file.
+ * Only the header and the first and last record are read.
+ */
+bool Metastock::scanData( unsigned short n, unsigned char fields,
+	const char *pfx ) const
+{
+	const int rec_len = count_bits( fields ) * 4;
+	char rec[3 * MAX_DAT_RECORD_LENGTH];
+	long long size;
+	int cnt = -1;
+
+	fdat_buf->setName( mr_list[n].file_name );
+
+	if( !fdat_buf->hasName() ) {
+		char msg[64];
+		snprintf( msg, sizeof(msg), "F%u.dat (or .mwd)", n);
+		printWarn( "missing data file", msg );
+		return true;
+	}
+
+	/* header, first and last record */
+	char *hdr = rec;
+	char *first = rec + rec_len;
+	char *last = rec + 2 * rec_len;
+	int first_date = 0;
+	int last_date = 0;
+
+	if( col_ar != NULL ) {
+		/* from the block index, size is the compressed size */
+		size = 0;
+		cnt = 0;
+		for( int b = col_ar->firstBlock( n ); b >= 0
+				&& b < col_ar->countBlocks() && col_ar->blockFile( b ) == n;
+				b++ ) {
+			if( cnt == 0 ) {
+				first_date = col_ar->blockMinDate( b );
+			}
+			last_date = col_ar->blockMaxDate( b );
+			cnt += col_ar->blockRecords( b );
+			size += col_ar->blockSize( b );
+		}
+	} else if( ms_ar != NULL ) {
+		if( ! readFile( fdat_buf ) ) {
+			return false;
+		}
+		size = fdat_buf->len();
+		FDat datfile( fdat_buf->constBuf(), size, fields );
+		cnt = datfile.countRecords();
+		if( cnt >= 0 ) {
+			memcpy( hdr, fdat_buf->constBuf(), rec_len );
+			memcpy( last, fdat_buf->constBuf() + (long long)cnt * rec_len,
+				rec_len );
+		}
+		if( cnt > 0 ) {
+			memcpy( first, fdat_buf->constBuf() + rec_len, rec_len );
+		}
+	} else {
+		int fd = openFile( fdat_buf->constName() );
+		if( fd < 0 ) {
+			return false;
+		}
+
+		struct stat s;
+		if( fstat( fd, &s ) != 0 ) {
+			setError( fdat_buf->constName(), strerror(errno) );
+			close( fd );
+			return false;
+		}
+		size = s.st_size;
+		bool ok = true;
+		if( rec_len > 0 && size >= rec_len ) {
+			ok = read( fd, hdr, 2 * rec_len ) >= rec_len;
+			if( ok ) {
+				FDat datfile( hdr, size, fields );
+				cnt = datfile.countRecords();
+			}
+		}
+		if( ok && cnt > 0 ) {
+			ok = lseek( fd, (off_t)cnt * rec_len, SEEK_SET ) >= 0
+				&& read( fd, last, rec_len ) == rec_len;
+		}
+		if( !ok ) {
+			setError( fdat_buf->constName(), strerror(errno) );
+		}
+		close( fd );
+		if( !ok ) {
+			return false;
+		}
+	}
+
+	if( rec_len == 0 || cnt < 0 ) {
+		printWarn( "fdat file unusable", fdat_buf->constName() );
+		return true;
+	}
+
+	if( col_ar == NULL && cnt > 0 ) {
+		FDat datfile( rec, 3 * rec_len, fields );
+		first_date = datfile.recordDate( first );
+		last_date = datfile.recordDate( last );
+	}
+
+	char buf[MAX_SIZE_MR_STRING + 64];
+	int len = strlen( pfx );
+	char *cp = buf + len;
+	memcpy( buf, pfx, len );
+
+	cp += itoa( cp, cnt );
+	*cp++ = print_sep;
+	cp += itodatestr( cp, first_date );
+	*cp++ = print_sep;
+	cp += itodatestr( cp, last_date );
+	*cp++ = print_sep;
+	cp += ltoa( cp, size );
+	*cp++ = '\n';
+	*cp = '\0';
+
+	if( fputs( buf, (FILE*)out ) < 0 ) {
+		/* This is should only happen on WIN32 instead of SIGPIPE */
+		setError( "writing interrupted" );
+		return false;
+	}
+	return true;
+}
+
+
+
+enum sm_status {
+	SM_OK,
+	SM_MISSING,
+	SM_UNUSABLE,
+	SM_TRUNCATED,
+	SM_ERROR
+};
+
+/* one row of --summary, filled by a worker thread */
+struct file_summary
+{
+	int status;
+	int err;
+	long long bytes_read;
+	long long decoded;
+
+	long long records;
+	int first_date;
+	int last_date;
+	int last_day;
+	int month;
+	int month_days;
+	int max_gap;
+	float min_price;
+	float max_price;
+	float last_close;
+	double volume;
+	double turnover;
+	long long zero_volume;
+};
+
+static void summary_init( file_summary *sm )
+{
+	memset( sm, 0, sizeof(*sm) );
+	sm->min_price = HUGE_VALF;
+	sm->max_price = -HUGE_VALF;
+	sm->last_day = INT_MIN;
+	sm->month_days = -1;
+}
+
+/* filtered bars of one chunk as contiguous columns */
+struct sm_columns
+{
+	int *date;
+	float *low;
+	float *high;
+	float *close;
+	float *volume;
+	long long len;
+};
+
+static void sm_columns_init( sm_columns *c, long long size )
+{
+	c->date = (int*) malloc( size * sizeof(int) );
+	c->low = (float*) malloc( size * sizeof(float) );
+	c->high = (float*) malloc( size * sizeof(float) );
+	c->close = (float*) malloc( size * sizeof(float) );
+	c->volume = (float*) malloc( size * sizeof(float) );
+	c->len = 0;
+}
+
+static void sm_columns_free( sm_columns *c )
+{
+	free( c->date );
+	free( c->low );
+	free( c->high );
+	free( c->close );
+	free( c->volume );
+}
+
+/* append a bar, files without low or high use the close */
+static inline void sm_columns_add( sm_columns *c, unsigned char fields,
+	const ms_bar *b )
+{
+	const long long i = c->len++;
+	c->date[i] = b->date;
+	c->low[i] = (fields & D_LOW) ? b->low : b->close;
+	c->high[i] = (fields & D_HIG) ? b->high : b->close;
+	c->close[i] = b->close;
+	c->volume[i] = b->volume;
+}
+
+/**
+ * days since 0000-03-01 of a YYYYMMDD date, for differences only,
+ * -1 for invalid dates
+ */
+static inline int date_days( int date )
+{
+	int y = date / 10000;
+	int m = date / 100 % 100;
+	const int d = date % 100;
+	if( date <= 0 || y < 1 || m < 1 || m > 12 ) {
+		return -1;
+	}
+	if( m <= 2 ) {
+		/* years start in march, leap days come last */
+		y--;
+		m += 12;
+	}
+	return 365 * y + y / 4 - y / 100 + y / 400 + (153 * (m - 3) + 2) / 5 + d;
+}
+
+/* independent accumulators per pass, not one long dependency chain */
+#define SM_LANES 8
+
+/**
+ * Add a chunk of columns, min, max, the zero count, the sums and the gaps
+ * are separate passes over contiguous columns. Volume sums of whole numbers
+ * are exact in any order. VWAP is of the close, not the typical price.
+ */
+static void summary_add( file_summary *sm, const sm_columns *c )
+{
+	const long long n = c->len;
+	if( n == 0 ) {
+		return;
+	}
+	const long long n_lanes = n / SM_LANES * SM_LANES;
+
+	float lo[SM_LANES];
+	float hi[SM_LANES];
+	for( int k = 0; k < SM_LANES; k++ ) {
+		lo[k] = sm->min_price;
+		hi[k] = sm->max_price;
+	}
+	for( long long i = 0; i < n_lanes; i += SM_LANES ) {
+		for( int k = 0; k < SM_LANES; k++ ) {
+			const float v = c->low[i + k];
+			lo[k] = (v < lo[k]) ? v : lo[k];
+		}
+	}
+	for( long long i = 0; i < n_lanes; i += SM_LANES ) {
+		for( int k = 0; k < SM_LANES; k++ ) {
+			const float v = c->high[i + k];
+			hi[k] = (v > hi[k]) ? v : hi[k];
+		}
+	}
+	for( long long i = n_lanes; i < n; i++ ) {
+		lo[0] = (c->low[i] < lo[0]) ? c->low[i] : lo[0];
+		hi[0] = (c->high[i] > hi[0]) ? c->high[i] : hi[0];
+	}
+	for( int k = 0; k < SM_LANES; k++ ) {
+		if( lo[k] < sm->min_price ) {
+			sm->min_price = lo[k];
+		}
+		if( hi[k] > sm->max_price ) {
+			sm->max_price = hi[k];
+		}
+	}
+
+	long long zero = 0;
+	for( long long i = 0; i < n; i++ ) {
+		zero += (c->volume[i] == 0);
+	}
+	sm->zero_volume += zero;
+
+	double volume[SM_LANES];
+	double turnover[SM_LANES];
+	for( int k = 0; k < SM_LANES; k++ ) {
+		volume[k] = turnover[k] = 0;
+	}
+	for( long long i = 0; i < n_lanes; i += SM_LANES ) {
+		for( int k = 0; k < SM_LANES; k++ ) {
+			volume[k] += c->volume[i + k];
+		}
+	}
+	for( long long i = 0; i < n_lanes; i += SM_LANES ) {
+		for( int k = 0; k < SM_LANES; k++ ) {
+			turnover[k] += (double)c->close[i + k] * c->volume[i + k];
+		}
+	}
+	for( long long i = n_lanes; i < n; i++ ) {
+		volume[0] += c->volume[i];
+		turnover[0] += (double)c->close[i] * c->volume[i];
+	}
+	for( int k = 0; k < SM_LANES; k++ ) {
+		sm->volume += volume[k];
+		sm->turnover += turnover[k];
+	}
+
+	/* gaps in calendar days, the day number is computed once per month */
+	int last_date = sm->last_date;
+	int last_day = sm->last_day;
+	int month = sm->month;
+	int month_days = sm->month_days;
+	int max_gap = sm->max_gap;
+	for( long long i = 0; i < n; i++ ) {
+		const int date = c->date[i];
+		if( date == last_date ) {
+			continue;
+		}
+		last_date = date;
+		if( date / 100 != month ) {
+			month = date / 100;
+			month_days = date_days( month * 100 + 1 ) - 1;
+		}
+		if( month_days < 0 ) {
+			continue;
+		}
+		const int day = month_days + date % 100;
+		if( last_day != INT_MIN && day - last_day > max_gap ) {
+			max_gap = day - last_day;
+		}
+		last_day = day;
+	}
+	sm->last_day = last_day;
+	sm->month = month;
+	sm->month_days = month_days;
+	sm->max_gap = max_gap;
+
+	if( sm->records == 0 ) {
+		sm->first_date = c->date[0];
+	}
+	sm->last_date = c->date[n - 1];
+	sm->records += n;
+	sm->last_close = c->close[n - 1];
+}
+
+/**
+ * decode and add cnt records, cols must have room for cnt bars
+ */
+static void summary_add_records( file_summary *sm, const FDat *datfile,
+	unsigned char fields, const char *records, long long cnt,
+	sm_columns *cols )
+{
+	const int rec_len = count_bits( fields ) * 4;
+	ms_bar bar;
+	cols->len = 0;
+	for( long long i = 0; i < cnt; i++ ) {
+		if( datfile->record_to_bar( records + i * rec_len, &bar ) ) {
+			sm_columns_add( cols, fields, &bar );
+		}
+	}
+	sm->decoded += cnt;
+	summary_add( sm, cols );
+}
+
+
+/* worker thread context of dumpSummary() */
+struct summary_job
+{
+	const Metastock *ms;
+	const int *files;
+	file_summary *rows;
+};
+
+void Metastock::summaryWorker( void *arg, int item )
+{
+	summary_job *job = (summary_job*) arg;
+	const master_record *mr = &job->ms->mr_list[job->files[item]];
+	file_summary *sm = &job->rows[item];
+	stats_file_begin( job->files[item], mr->file_name, mr->c_symbol );
+	job->ms->summarizeFile( job->files[item], sm );
+	stats_count( SC_BYTES_READ, sm->bytes_read );
+	stats_count( SC_RECORDS_DECODED, sm->decoded );
+	stats_count( SC_RECORDS_FILTERED, sm->decoded - sm->records );
+	stats_file_end();
+}
+
+
+/**
+ * Print one row of statistics per data file instead of time series data.
+ * Plain directories are read by --threads worker threads, archives
+ * sequentially. Rows are printed in file number order.
+ */
+bool Metastock::dumpSummary() const
+{
+	char buf[MAX_SIZE_MR_STRING + 256];
+	int len;
+
+	if( stdin_fields != 0 ) {
+		setError( "--summary", "can not read stdin" );
+		return false;
+	} else if( resampling ) {
+		setError( "--summary", "can not be combined with --resample" );
+		return false;
+	}
+
+	if( print_header ) {
+		len = mr_header_to_string( buf, prnt_data_mr_fields, print_sep );
+		if( prnt_data_mr_fields != 0 ) {
+			buf[len++] = print_sep;
+			buf[len] = '\0';
+		}
+		fprintf( (FILE*)out, "%s" "records%c" "first_date%c" "last_date%c"
+			"min_price%c" "max_price%c" "last_close%c" "avg_volume%c"
+			"total_volume%c" "vwap%c" "zero_volume%c" "max_gap_days\n", buf,
+			print_sep, print_sep, print_sep, print_sep, print_sep, print_sep,
+			print_sep, print_sep, print_sep, print_sep );
+	}
+
+	int *files = (int*) malloc( mr_len * sizeof(int) );
+	int n_files = 0;
+	for( int i = 1; i<mr_len; i++ ) {
+		if( mr_list[i].record_number != 0 && !mr_skip_list[i] ) {
+			assert( mr_list[i].file_number == i );
+			files[n_files++] = i;
+		} else if( mr_list[i].record_number != 0 ) {
+			stats_count( SC_SKIP_EXCLUDED, 1 );
+		}
+	}
+	file_summary *rows =
+		(file_summary*) malloc( n_files * sizeof(file_summary) );
+
+	/* archives share their read buffers */
+	summary_job job = { this, files, rows };
+	stats_phase_begin( ST_READ_DATA );
+	run_workers( n_files, (ms_ar != NULL || col_ar != NULL) ? 1 : threads,
+		summaryWorker, &job );
+	stats_phase_end( ST_READ_DATA );
+
+	bool ok = true;
+	for( int f = 0; ok && f < n_files; f++ ) {
+		const master_record *mr = &mr_list[files[f]];
+		const file_summary *sm = &rows[f];
+		if( sm->status == SM_MISSING ) {
+			char msg[64];
+			snprintf( msg, sizeof(msg), "F%u.dat (or .mwd)", files[f] );
+			printWarn( "missing data file", msg );
+			stats_count( SC_SKIP_MISSING, 1 );
+			continue;
+		}
+		stats_count( SC_FILES_READ, 1 );
+		if( sm->status == SM_ERROR ) {
+			setError( mr->file_name, strerror(sm->err) );
+			ok = false;
+			break;
+		} else if( sm->status == SM_UNUSABLE ) {
+			printWarn( "fdat file unusable", mr->file_name );
+			stats_count( SC_SKIP_UNUSABLE, 1 );
+			continue;
+		} else if( sm->status == SM_TRUNCATED ) {
+			printWarn( "fdat file truncated", mr->file_name );
+			stats_count( SC_TRUNCATED, 1 );
+		}
+
+		len = mr_record_to_string( buf, mr, prnt_data_mr_fields, print_sep );
+		if( prnt_data_mr_fields != 0 ) {
+			buf[len++] = print_sep;
+		}
+		char *cp = buf + len;
+		const bool has_vol = mr->field_bitset & D_VOL;
+		const bool has_bars = sm->records > 0;
+
+		cp += ltoa( cp, sm->records );
+		*cp++ = print_sep;
+		if( has_bars ) {
+			cp += itodatestr( cp, sm->first_date );
+			*cp++ = print_sep;
+			cp += itodatestr( cp, sm->last_date );
+		} else {
+			*cp++ = print_sep;
+		}
+		*cp++ = print_sep;
+		if( has_bars && sm->min_price <= sm->max_price ) {
+			cp += ftoa( cp, sm->min_price );
+			*cp++ = print_sep;
+			cp += ftoa( cp, sm->max_price );
+		} else {
+			*cp++ = print_sep;
+		}
+		*cp++ = print_sep;
+		if( has_bars ) {
+			cp += ftoa( cp, sm->last_close );
+		}
+		*cp++ = print_sep;
+		if( has_vol && has_bars ) {
+			cp += sprintf( cp, "%.2f%c%.0f", sm->volume / sm->records,
+				print_sep, sm->volume );
+		} else {
+			*cp++ = print_sep;
+		}
+		*cp++ = print_sep;
+		if( has_vol && sm->volume != 0 ) {
+			cp += ftoa( cp, sm->turnover / sm->volume );
+		}
+		*cp++ = print_sep;
+		if( has_vol ) {
+			cp += ltoa( cp, sm->zero_volume );
+		}
+		*cp++ = print_sep;
+		cp += itoa( cp, sm->max_gap );
+		*cp++ = '\n';
+		*cp = '\0';
+
+		if( fputs( buf, (FILE*)out ) < 0 ) {
+			/* This is should only happen on WIN32 instead of SIGPIPE */
+			setError( "writing interrupted" );
+			ok = false;
+		}
+	}
+
+	free( rows );
+	free( files );
+	fflush( (FILE*)out );
+	return ok;
+}
+
+
+/**
+ * Compute the summary of dat file n. Must not touch shared state when
+ * reading plain directories, it runs in worker threads then.
+ */
+void Metastock::summarizeFile( int n, file_summary *sm ) const
+{
+	const master_record *mr = &mr_list[n];
+	const unsigned char fields = mr->field_bitset;
+	const int rec_len = count_bits( fields ) * 4;
+	const long long chunk_recs = rec_len > 0 ? DAT_CHUNK_SIZE / rec_len : 0;
+	FDat datfile( NULL, 0, fields );
+
+	summary_init( sm );
+	if( *mr->file_name == '\0' ) {
+		sm->status = SM_MISSING;
+		return;
+	} else if( rec_len == 0 ) {
+		sm->status = SM_UNUSABLE;
+		return;
+	}
+
+	sm_columns cols;
+	if( col_ar != NULL ) {
+		sm_columns_init( &cols, COL_BLOCK_RECORDS );
+		for( int b = col_ar->firstBlock( n ); b >= 0
+				&& b < col_ar->countBlocks() && col_ar->blockFile( b ) == n;
+				b++ ) {
+			ms_bar *bars;
+			int cnt = col_ar->readBlock( b, &bars );
+			if( cnt < 0 ) {
+				/* the archive was valid when it was opened */
+				sm->status = SM_ERROR;
+				sm->err = EIO;
+				break;
+			}
+			sm->bytes_read += col_ar->blockSize( b );
+			sm->decoded += cnt;
+			cnt = datfile.selectBars( bars, cnt );
+			cols.len = 0;
+			for( int i = 0; i < cnt; i++ ) {
+				sm_columns_add( &cols, fields, &bars[i] );
+			}
+			summary_add( sm, &cols );
+		}
+		sm_columns_free( &cols );
+		return;
+	}
+
+	sm_columns_init( &cols, chunk_recs );
+	if( ms_ar != NULL ) {
+		fdat_buf->setName( mr->file_name );
+		if( !readFile( fdat_buf ) ) {
+			sm->status = SM_ERROR;
+			sm->err = errno;
+			sm_columns_free( &cols );
+			return;
+		}
+		sm->bytes_read = fdat_buf->len();
+		FDat whole( fdat_buf->constBuf(), fdat_buf->len(), fields );
+		long long cnt = whole.countRecords();
+		if( cnt < 0 ) {
+			sm->status = SM_UNUSABLE;
+		}
+		for( long long r = 0; r < cnt; r += chunk_recs ) {
+			summary_add_records( sm, &datfile, fields,
+				fdat_buf->constBuf() + (r + 1) * rec_len,
+				cnt - r < chunk_recs ? cnt - r : chunk_recs, &cols );
+		}
+		sm_columns_free( &cols );
+		return;
+	}
+
+	char path[strlen(ms_dir) + strlen(mr->file_name) + 1];
+	strcpy( path, ms_dir );
+	strcat( path, mr->file_name );
+#if defined _WIN32
+	int fd = open( path, _O_RDONLY | _O_BINARY );
+#else
+	int fd = open( path, O_RDONLY );
+#endif
+	char *chunk = (char*) malloc( chunk_recs * rec_len );
+	struct stat s;
+	long long cnt = -1;
+	if( fd >= 0 && fstat( fd, &s ) == 0 ) {
+		long long got = read_full( fd, chunk, rec_len );
+		if( got >= 0 ) {
+			sm->bytes_read += got;
+			FDat header( chunk, got < rec_len ? got : s.st_size, fields );
+			cnt = header.countRecords();
+			if( cnt < 0 ) {
+				sm->status = SM_UNUSABLE;
+			}
+		} else {
+			sm->status = SM_ERROR;
+		}
+	} else {
+		sm->status = SM_ERROR;
+	}
+
+	while( cnt > 0 ) {
+		long long want = (cnt < chunk_recs) ? cnt : chunk_recs;
+		long long got = read_full( fd, chunk, want * rec_len );
+		if( got < 0 ) {
+			sm->status = SM_ERROR;
+			break;
+		}
+		sm->bytes_read += got;
+		long long recs = got / rec_len;
+		summary_add_records( sm, &datfile, fields, chunk, recs, &cols );
+		cnt -= recs;
+		if( recs < want ) {
+			sm->status = SM_TRUNCATED;
+			break;
+		}
+	}
+	if( sm->status == SM_ERROR ) {
+		sm->err = errno;
+	}
+
+	if( fd >= 0 ) {
+		close( fd );
+	}
+	free( chunk );
+	sm_columns_free( &cols );
+}
+
+
+
+/* findings of one dat file, filled by a worker thread */
+struct file_verify
+{
+	int err;
+	long long bytes_read;
+	vf_state st;
+};
+
+/* worker thread context of verifyData() */
+struct verify_job
+{
+	const Metastock *ms;
+	const int *files;
+	file_verify *results;
+};
+
+void Metastock::verifyWorker( void *arg, int item )
+{
+	verify_job *job = (verify_job*) arg;
+	const master_record *mr = &job->ms->mr_list[job->files[item]];
+	file_verify *fv = &job->results[item];
+	stats_file_begin( job->files[item], mr->file_name, mr->c_symbol );
+	job->ms->verifyFile( job->files[item], fv );
+	stats_count( SC_BYTES_READ, fv->bytes_read );
+	stats_count( SC_RECORDS_DECODED, fv->st.records );
+	stats_file_end();
+}
+
+
+/**
+ * print all findings of one file, returns their number
+ */
+long long Metastock::printFindings( const char *file,
+	const vf_finding *findings ) const
+{
+	long long n = 0;
+	for( int c = 0; c < VF_CHECKS; c++ ) {
+		const vf_finding *f = &findings[c];
+		if( f->count == 0 ) {
+			continue;
+		}
+		fprintf( (FILE*)out, "%s%c%s%c%lld%c%lld%c%s\n", file, print_sep,
+			vf_check_names[c], print_sep, f->count, print_sep, f->first,
+			print_sep, f->detail );
+		n += f->count;
+	}
+	return n;
+}
+
+/**
+ * Check master files and all dat files and print one row per file and
+ * kind of problem: file, check, count, first record (0 is the header) and
+ * a description of the first one. Dat files of plain directories are
+ * checked by --threads worker threads. Findings are counted in
+ * *n_findings, returns false only on errors.
+ */
+bool Metastock::verifyData( long long *n_findings ) const
+{
+	*n_findings = 0;
+	if( col_ar != NULL ) {
+		setError( "--verify needs dat files, not a columnar archive" );
+		return false;
+	} else if( stdin_fields != 0 ) {
+		setError( "--verify", "can not read stdin" );
+		return false;
+	}
+
+	if( print_header ) {
+		fprintf( (FILE*)out, "file%c" "check%c" "count%c" "first_record%c"
+			"detail\n", print_sep, print_sep, print_sep, print_sep );
+	}
+
+	vf_finding findings[VF_CHECKS];
+	if( m_buf->hasName() ) {
+		memset( findings, 0, sizeof(findings) );
+		MasterFile( m_buf->constBuf(), m_buf->len() ).verify( findings );
+		*n_findings += printFindings( m_buf->constName(), findings );
+	}
+	if( e_buf->hasName() ) {
+		memset( findings, 0, sizeof(findings) );
+		EMasterFile( e_buf->constBuf(), e_buf->len() ).verify( findings );
+		*n_findings += printFindings( e_buf->constName(), findings );
+	}
+	if( x_buf->hasName() ) {
+		memset( findings, 0, sizeof(findings) );
+		XMasterFile( x_buf->constBuf(), x_buf->len() ).verify( findings );
+		*n_findings += printFindings( x_buf->constName(), findings );
+	}
+
+	int *files = (int*) malloc( mr_len * sizeof(int) );
+	int n_files = 0;
+	for( int i = 1; i<mr_len; i++ ) {
+		const master_record *mr = &mr_list[i];
+		if( mr->record_number != 0 && *mr->file_name == '\0' ) {
+			char name[32];
+			snprintf( name, sizeof(name), "F%d", i );
+			memset( findings, 0, sizeof(findings) );
+			vf_add( &findings[VF_MISSING_FILE], 0,
+				"listed in %s record %d", mr->kind == 'E' ? "EMASTER" :
+				mr->kind == 'X' ? "XMASTER" : "MASTER", mr->record_number );
+			*n_findings += printFindings( name, findings );
+		} else if( mr->record_number == 0 && *mr->file_name != '\0' ) {
+			memset( findings, 0, sizeof(findings) );
+			vf_add( &findings[VF_ORPHAN_FILE], 0, "not in any master file" );
+			*n_findings += printFindings( mr->file_name, findings );
+		} else if( mr->record_number != 0 && !mr_skip_list[i] ) {
+			files[n_files++] = i;
+		} else if( mr->record_number != 0 ) {
+			stats_count( SC_SKIP_EXCLUDED, 1 );
+		}
+	}
+
+	file_verify *results =
+		(file_verify*) malloc( n_files * sizeof(file_verify) );
+	verify_job job = { this, files, results };
+	stats_phase_begin( ST_READ_DATA );
+	run_workers( n_files, ms_ar != NULL ? 1 : threads, verifyWorker, &job );
+	stats_phase_end( ST_READ_DATA );
+
+	bool ok = true;
+	for( int f = 0; f < n_files; f++ ) {
+		const file_verify *fv = &results[f];
+		const char *name = mr_list[files[f]].file_name;
+		stats_count( SC_FILES_READ, 1 );
+		if( fv->err != 0 ) {
+			setError( name, strerror(fv->err) );
+			ok = false;
+			break;
+		}
+		*n_findings += printFindings( name, fv->st.findings );
+	}
+
+	free( results );
+	free( files );
+	fflush( (FILE*)out );
+	return ok;
+}
+
+
+/**
+ * Check dat file n. Must not touch shared state when reading plain
+ * directories, it runs in worker threads then.
+ */
+void Metastock::verifyFile( int n, file_verify *fv ) const
+{
+	const master_record *mr = &mr_list[n];
+	const unsigned char fields = mr->field_bitset;
+	const int rec_len = count_bits( fields ) * 4;
+
+	memset( fv, 0, sizeof(*fv) );
+	if( ms_ar != NULL ) {
+		fdat_buf->setName( mr->file_name );
+		if( !readFile( fdat_buf ) ) {
+			fv->err = errno ? errno : EIO;
+			return;
+		}
+		fv->bytes_read = fdat_buf->len();
+		FDat datfile( fdat_buf->constBuf(), fdat_buf->len(), fields );
+		long long cnt = datfile.verifyHeader( fv->st.findings );
+		if( cnt > 0 ) {
+			datfile.verifyRecords( fdat_buf->constBuf() + rec_len, cnt,
+				&fv->st );
+		}
+		return;
+	}
+
+	char path[strlen(ms_dir) + strlen(mr->file_name) + 1];
+	strcpy( path, ms_dir );
+	strcat( path, mr->file_name );
+#if defined _WIN32
+	int fd = open( path, _O_RDONLY | _O_BINARY );
+#else
+	int fd = open( path, O_RDONLY );
+#endif
+	struct stat s;
+	if( fd < 0 || fstat( fd, &s ) != 0 ) {
+		fv->err = errno;
+		if( fd >= 0 ) {
+			close( fd );
+		}
+		return;
+	}
+
+	const long long chunk_recs = rec_len > 0 ? DAT_CHUNK_SIZE / rec_len : 1;
+	char *chunk = (char*) malloc( chunk_recs * (rec_len > 0 ? rec_len : 1) );
+	long long got = read_full( fd, chunk, rec_len );
+	long long cnt = 0;
+	if( got < 0 ) {
+		fv->err = errno;
+	} else {
+		fv->bytes_read = got;
+		FDat datfile( chunk, got < rec_len ? got : s.st_size, fields );
+		cnt = datfile.verifyHeader( fv->st.findings );
+	}
+
+	FDat datfile( NULL, 0, fields );
+	while( cnt > 0 ) {
+		long long want = (cnt < chunk_recs) ? cnt : chunk_recs;
+		got = read_full( fd, chunk, want * rec_len );
+		if( got < 0 ) {
+			fv->err = errno;
+			break;
+		}
+		fv->bytes_read += got;
+		long long recs = got / rec_len;
+		datfile.verifyRecords( chunk, recs, &fv->st );
+		cnt -= recs;
+		if( recs < want ) {
+			/* shrunk while reading */
+			vf_add( &fv->st.findings[VF_DAT_SIZE], 0, "changed while reading" );
+			break;
+		}
+	}
+
+	close( fd );
+	free( chunk );
+}
+
+
+
+/* dat files are searched by single records until this many are left */
+#define SNAPSHOT_WINDOW 64
+/* found bars are printed in batches of this size */
+#define SNAPSHOT_BATCH 256
+
+/* the bar of one dat file found by a worker thread of dumpSnapshot() */
+struct file_snapshot
+{
+	sm_status status;
+	int err;
+	bool found;
+	ms_bar bar;
+	long long bytes_read;
+};
+
+/* worker thread context of dumpSnapshot() */
+struct snapshot_job
+{
+	const Metastock *ms;
+	const int *files;
+	file_snapshot *results;
+};
+
+void Metastock::snapshotWorker( void *arg, int item )
+{
+	snapshot_job *job = (snapshot_job*) arg;
+	const master_record *mr = &job->ms->mr_list[job->files[item]];
+	file_snapshot *fs = &job->results[item];
+	stats_file_begin( job->files[item], mr->file_name, mr->c_symbol );
+	job->ms->snapshotFile( job->files[item], fs );
+	stats_count( SC_BYTES_READ, fs->bytes_read );
+	if( fs->found ) {
+		stats_count( SC_RECORDS_DECODED, 1 );
+	}
+	stats_file_end();
+}
+
+/**
+ * number of the cnt date sorted records (or bars) dated on or before date
+ */
+static long long count_until( const FDat *datfile, const char *records,
+	int rec_len, long long cnt, int date )
+{
+	long long lo = 0;
+	long long hi = cnt;
+	while( lo < hi ) {
+		long long mid = lo + (hi - lo) / 2;
+		if( datfile->recordDate( records + mid * rec_len ) <= date ) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static long long count_until( const ms_bar *bars, long long cnt, int date )
+{
+	long long lo = 0;
+	long long hi = cnt;
+	while( lo < hi ) {
+		long long mid = lo + (hi - lo) / 2;
+		if( bars[mid].date <= date ) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+
+/**
+ * Print the last bar on or before the --snapshot date of each file. Files
+ * are searched by --threads worker threads, records are assumed to be
+ * sorted by date. Bars not matching --date-from or --where are omitted.
+ */
+bool Metastock::dumpSnapshot() const
+{
+	int *files = (int*) malloc( mr_len * sizeof(int) );
+	int n_files = 0;
+	for( int i = 1; i<mr_len; i++ ) {
+		if( mr_list[i].record_number != 0 && !mr_skip_list[i]
+				&& pruneFile( &mr_list[i] ) ) {
+			stats_count( SC_SKIP_PRUNED, 1 );
+		} else if( mr_list[i].record_number != 0 && !mr_skip_list[i] ) {
+			assert( mr_list[i].file_number == i );
+			files[n_files++] = i;
+		} else if( mr_list[i].record_number != 0 ) {
+			stats_count( SC_SKIP_EXCLUDED, 1 );
+		}
+	}
+	file_snapshot *results =
+		(file_snapshot*) malloc( n_files * sizeof(file_snapshot) );
+
+	/* archives share their read buffers */
+	snapshot_job job = { this, files, results };
+	stats_phase_begin( ST_READ_DATA );
+	run_workers( n_files, (ms_ar != NULL || col_ar != NULL) ? 1 : threads,
+		snapshotWorker, &job );
+	stats_phase_end( ST_READ_DATA );
+
+	const int pfx_size = MAX_SIZE_MR_JSON + 2;
+	char *pfx = (char*) malloc( SNAPSHOT_BATCH * pfx_size );
+	FDat *dats[SNAPSHOT_BATCH];
+	merged_bar rows[SNAPSHOT_BATCH];
+	int n_rows = 0;
+	bool ok = true;
+	for( int f = 0; ok && f < n_files; f++ ) {
+		const master_record *mr = &mr_list[files[f]];
+		const file_snapshot *fs = &results[f];
+		if( fs->status == SM_MISSING ) {
+			char msg[64];
+			snprintf( msg, sizeof(msg), "F%u.dat (or .mwd)", files[f] );
+			printWarn( "missing data file", msg );
+			stats_count( SC_SKIP_MISSING, 1 );
+			continue;
+		}
+		stats_count( SC_FILES_READ, 1 );
+		if( fs->status == SM_ERROR ) {
+			setError( mr->file_name, strerror(fs->err) );
+			ok = false;
+		} else if( fs->status == SM_UNUSABLE ) {
+			printWarn( "fdat file unusable", mr->file_name );
+			stats_count( SC_SKIP_UNUSABLE, 1 );
+		} else if( fs->found ) {
+			merged_bar *row = &rows[n_rows];
+			char *p = pfx + n_rows * pfx_size;
+			dats[n_rows] = new FDat( NULL, 0, mr->field_bitset );
+			row->dat = dats[n_rows];
+			row->header = p;
+			row->h_size = dataPrefix( p, mr );
+			row->bar = fs->bar;
+			n_rows++;
+		}
+
+		if( n_rows == SNAPSHOT_BATCH || (f == n_files - 1 && n_rows > 0) ) {
+			if( FDat::printMerged( rows, n_rows ) < 0 ) {
+				setError( "writing interrupted" );
+				ok = false;
+			}
+			for( int r = 0; r < n_rows; r++ ) {
+				delete dats[r];
+			}
+			n_rows = 0;
+		}
+	}
+	for( int r = 0; r < n_rows; r++ ) {
+		delete dats[r];
+	}
+
+	free( pfx );
+	free( results );
+	free( files );
+	return ok;
+}
+
+
+/**
+ * Find the bar of dat file n for dumpSnapshot(). Must not touch shared
+ * state when reading plain directories, it runs in worker threads then.
+ */
+void Metastock::snapshotFile( int n, file_snapshot *fs ) const
+{
+	const master_record *mr = &mr_list[n];
+	const unsigned char fields = mr->field_bitset;
+	const int rec_len = count_bits( fields ) * 4;
+	FDat datfile( NULL, 0, fields );
+
+	memset( fs, 0, sizeof(*fs) );
+	fs->status = SM_OK;
+	if( *mr->file_name == '\0' ) {
+		fs->status = SM_MISSING;
+		return;
+	} else if( rec_len == 0 ) {
+		fs->status = SM_UNUSABLE;
+		return;
+	}
+
+	if( col_ar != NULL ) {
+		/* the last block starting on or before the date */
+		int last = -1;
+		for( int b = col_ar->firstBlock( n ); b >= 0
+				&& b < col_ar->countBlocks() && col_ar->blockFile( b ) == n
+				&& col_ar->blockMinDate( b ) <= snapshot_date; b++ ) {
+			last = b;
+		}
+		if( last < 0 ) {
+			return;
+		}
+		ms_bar *bars;
+		int cnt = col_ar->readBlock( last, &bars );
+		if( cnt < 0 ) {
+			/* the archive was valid when it was opened */
+			fs->status = SM_ERROR;
+			fs->err = EIO;
+			return;
+		}
+		fs->bytes_read = col_ar->blockSize( last );
+		long long k = count_until( bars, cnt, snapshot_date );
+		if( k > 0 ) {
+			fs->bar = bars[k - 1];
+			fs->found = datfile.selectBars( &fs->bar, 1 ) == 1;
+		}
+		return;
+	}
+
+	if( ms_ar != NULL ) {
+		fdat_buf->setName( mr->file_name );
+		if( !readFile( fdat_buf ) ) {
+			fs->status = SM_ERROR;
+			fs->err = errno;
+			return;
+		}
+		fs->bytes_read = fdat_buf->len();
+		FDat whole( fdat_buf->constBuf(), fdat_buf->len(), fields );
+		long long cnt = whole.countRecords();
+		if( cnt < 0 ) {
+			fs->status = SM_UNUSABLE;
+			return;
+		}
+		const char *records = fdat_buf->constBuf() + rec_len;
+		long long k = count_until( &datfile, records, rec_len, cnt,
+			snapshot_date );
+		if( k > 0 ) {
+			fs->found = datfile.record_to_bar( records + (k - 1) * rec_len,
+				&fs->bar );
+		}
+		return;
+	}
+
+	char path[strlen(ms_dir) + strlen(mr->file_name) + 1];
+	strcpy( path, ms_dir );
+	strcat( path, mr->file_name );
+#if defined _WIN32
+	int fd = open( path, _O_RDONLY | _O_BINARY );
+#else
+	int fd = open( path, O_RDONLY );
+#endif
+	char buf[SNAPSHOT_WINDOW * rec_len];
+	struct stat s;
+	long long got;
+	if( fd < 0 || fstat( fd, &s ) != 0
+			|| (got = read_full( fd, buf, rec_len )) < 0 ) {
+		fs->status = SM_ERROR;
+		fs->err = errno;
+		if( fd >= 0 ) {
+			close( fd );
+		}
+		return;
+	}
+	fs->bytes_read = got;
+	long long cnt = FDat( buf, got < rec_len ? got : s.st_size,
+		fields ).countRecords();
+	if( cnt < 0 ) {
+		fs->status = SM_UNUSABLE;
+		close( fd );
+		return;
+	}
+
+	/* records lo to hi-1 are left, record r is at (r + 1) * rec_len */
+	long long lo = 0;
+	long long hi = cnt;
+	while( hi - lo > SNAPSHOT_WINDOW ) {
+		long long mid = lo + (hi - lo) / 2;
+		if( lseek( fd, (mid + 1) * rec_len, SEEK_SET ) < 0
+				|| (got = read_full( fd, buf, rec_len )) < 0 ) {
+			break;
+		}
+		fs->bytes_read += got;
+		if( got < rec_len ) {
+			/* shrunk since fstat */
+			hi = mid;
+		} else if( datfile.recordDate( buf ) <= snapshot_date ) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if( hi - lo <= SNAPSHOT_WINDOW
+			&& lseek( fd, (lo + 1) * rec_len, SEEK_SET ) >= 0
+			&& (got = read_full( fd, buf, (hi - lo) * rec_len )) >= 0 ) {
+		fs->bytes_read += got;
+		long long k = count_until( &datfile, buf, rec_len, got / rec_len,
+			snapshot_date );
+		if( k > 0 ) {
+			fs->found = datfile.record_to_bar( buf + (k - 1) * rec_len,
+				&fs->bar );
+		} else if( lo > 0 ) {
+			/* the window starts after the date, the bar is record lo-1 */
+			if( lseek( fd, lo * rec_len, SEEK_SET ) >= 0
+					&& read_full( fd, buf, rec_len ) == rec_len ) {
+				fs->bytes_read += rec_len;
+				fs->found = datfile.record_to_bar( buf, &fs->bar );
+			}
+		}
+	} else {
+		fs->status = SM_ERROR;
+		fs->err = errno;
+	}
+	close( fd );
+}
@@ -38,8 +38,22 @@
 #ifndef METASTOCK_H
 #define METASTOCK_H
 
+#include "util.h"
+#include "ms_file.h"
+#include "stats.h"
+
 struct master_record;
 class FileBuf;
+class MsArchive;
+class ColArchive;
+class DatCache;
+class Where;
+struct zm_block;
+struct file_summary;
+struct file_verify;
+struct merge_stream;
+struct file_snapshot;
+struct vf_finding;
 
 
 #define ERROR_LENGTH 256
@@ -52,13 +66,27 @@ class Metastock
 
 		bool set_outfile( const char *file );
 		bool setDir( const char* dir );
+		bool setStdin( const char *fields );
 		bool set_field_sep( const char *sep );
 		void set_skip_header( int skipheader );
 		void set_out_format( int fmt_data );
 		bool set_out_format( const char *columns );
 		bool set_ignore_masters( bool master, bool emaster, bool xmaster );
 		bool setForceFloat( bool opi, bool vol );
+		bool setShortest( const char *columns );
+		bool setPrecision( const char *list );
+		bool setScaled( const char *list );
+		bool setTimestamp( const char *unit );
+		bool setOutputFormat( const char *fmt );
 		bool setPrintDateFrom( const char *date );
+		bool setCacheDir( const char *dir );
+		bool setZoneMapDir( const char *dir );
+		bool setWhere( const char *expr );
+		bool setResample( const char *period );
+		void setThreads( int n );
+		void setTrustMasterDates();
+		bool setMergeByTime();
+		bool setSnapshot( const char *date );
 
 		bool parseMasters();
 		void dumpMaster() const;
@@ -68,31 +96,86 @@ class Metastock
 		bool excludeFiles( const char *stamp ) const;
 		bool dumpSymbolInfo() const;
 		bool dumpData() const;
+		bool scanData() const;
+		bool dumpSummary() const;
+		bool verifyData( long long *n_findings ) const;
 		const char* lastError() const;
 
 	private:
 		void printWarn( const char* e1, const char* e2 = "" ) const;
 		void setError( const char* e1, const char* e2 = "" ) const;
 		bool findFiles();
+		void addFile( const char *name );
+		int openFile( const char *name ) const;
 		bool readFile( FileBuf *file_buf ) const;
 		bool readMasters();
+		bool openColArchive( const char *path );
 		void resize_mr_list( int new_len );
 		void add_mr_list_datfile( int datnum, const char* datname );
 		void format_incl( unsigned int fmt_data );
 		void format_excl( unsigned int fmt_data );
 		bool columns2bitset( const char *columns );
+		bool setColumnFtoa( const char *list, ftoa_func (*func)(int),
+			dtoa_func (*vol_func)(int), bool allow_auto );
+		void printRawHeader() const;
+		int dataPrefix( char *buf, const master_record *mr ) const;
 		bool dumpData( unsigned short number, unsigned char fields,
-			const char *pfx) const;
+			const char *pfx, int pfx_len ) const;
+		bool dumpColData( unsigned short number, unsigned char fields,
+			const char *pfx, int pfx_len ) const;
+		bool dumpColumnar() const;
+		bool mergeByTime() const;
+		bool openStream( int n, merge_stream *st, bool *err ) const;
+		bool refillStream( merge_stream *st, int cap, char *raw,
+			bool keep_open ) const;
+		bool pruneFile( const master_record *mr ) const;
+		bool dumpCachedData( const char *path, unsigned char fields,
+			const char *pfx, int pfx_len ) const;
+		bool printCachedBars( unsigned char fields, ms_bar *bars,
+			long long cnt, const char *pfx, int pfx_len ) const;
+		bool zoneMatches( unsigned char fields, const zm_block *z ) const;
+		bool dumpZones( int fd, unsigned char fields, const zm_block *zones,
+			long long n_zones, const char *pfx, int pfx_len ) const;
+		void addZones( zm_block *zone, const ms_bar *bars,
+			long long cnt ) const;
+		void commitStore( DatCache *dc, bool ok, st_counter stored,
+			const char *what ) const;
+		bool streamData( int fd, long long size, unsigned char fields,
+			const char *pfx, int pfx_len ) const;
+		bool scanData( unsigned short number, unsigned char fields,
+			const char *pfx ) const;
+		static void summaryWorker( void *arg, int item );
+		void summarizeFile( int n, file_summary *sm ) const;
+		static void verifyWorker( void *arg, int item );
+		void verifyFile( int n, file_verify *fv ) const;
+		long long printFindings( const char *file,
+			const vf_finding *findings ) const;
+		bool dumpSnapshot() const;
+		static void snapshotWorker( void *arg, int item );
+		void snapshotFile( int n, file_snapshot *fs ) const;
 
 		static bool print_header;
 		static char print_sep;
 		static unsigned short use_master_files;
 		static unsigned short prnt_master_fields;
-		static unsigned char prnt_data_fields;
+		static unsigned short prnt_data_fields;
 		static unsigned short prnt_data_mr_fields;
+		static unsigned int auto_prec_fields;
+		static output_format out_fmt;
 		int print_date_from;
+		unsigned char stdin_fields;
 
 		char *ms_dir;
+		MsArchive *ms_ar;
+		ColArchive *col_ar;
+		DatCache *dat_cache;
+		DatCache *zone_maps;
+		Where *where;
+		int threads;
+		bool trust_master_dates;
+		bool resampling;
+		bool merge_by_time;
+		int snapshot_date;
 		FileBuf *m_buf;
 		FileBuf *e_buf;
 		FileBuf *x_buf;
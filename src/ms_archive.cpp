@@ -0,0 +1,1063 @@
+/*** ms_archive.cpp -- reading metastock directories from archives
+ *
+ * Copyright (C) 2010-2016 Ruediger Meier
+ *
+ * Author:  Ruediger Meier <sweet_f_a@gmx.de>
+ *
+ * This file is part of atem.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of any contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ***/
+
+#include "ms_archive.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "config.h"
+
+#if defined HAVE_LZMA_H && defined HAVE_LIBLZMA
+	#define AR_WITH_XZ
+	#include <lzma.h>
+#endif
+#if defined HAVE_ZLIB_H && defined HAVE_LIBZ
+	#define AR_WITH_GZ
+	#include <zlib.h>
+#endif
+
+
+
+#define AR_BLCKSZ 16384
+/* members of compressed tars passed while seeking forward are kept up to
+   this size, the archive is decompressed again for the others */
+#define AR_CACHE_SIZE (64 * 1024 * 1024)
+#define TAR_BLCKSZ 512
+
+
+enum ar_type {
+	AR_TAR,
+	AR_TAR_XZ,
+	AR_TAR_GZ,
+	AR_ZIP
+};
+
+
+struct ar_member
+{
+	char name[MAX_LEN_AR_NAME + 1];
+	long long offset; /* tar: (uncompressed) data offset, zip: local header */
+	long long size;
+	long long csize; /* zip only */
+	unsigned short method; /* zip only */
+	time_t mtime;
+	int seq; /* position in the archive */
+	char *cache; /* compressed tar only, see AR_CACHE_SIZE */
+};
+
+
+
+
+static long long ar_pread( int fd, char *dst, long long len, long long off )
+{
+	long long done = 0;
+#if defined _WIN32
+	if( lseek( fd, off, SEEK_SET ) < 0 ) {
+		return -1;
+	}
+#endif
+	while( done < len ) {
+		long long chunk = len - done;
+		if( chunk > (1 << 30) ) {
+			chunk = 1 << 30;
+		}
+#if defined _WIN32
+		ssize_t tmp = read( fd, dst + done, chunk );
+#else
+		ssize_t tmp = pread( fd, dst + done, chunk, off + done );
+#endif
+		if( tmp < 0 ) {
+			return -1;
+		} else if( tmp == 0 ) {
+			break;
+		}
+		done += tmp;
+	}
+	return done;
+}
+
+static inline unsigned int ar_uint16( const char *c )
+{
+	const unsigned char *u = (const unsigned char*) c;
+	return u[0] | (u[1] << 8);
+}
+
+static inline unsigned long ar_uint32( const char *c )
+{
+	const unsigned char *u = (const unsigned char*) c;
+	return (unsigned long)u[0] | ((unsigned long)u[1] << 8)
+		| ((unsigned long)u[2] << 16) | ((unsigned long)u[3] << 24);
+}
+
+
+
+
+/**
+ * Sequential reader for (possibly compressed) tar archives.
+ */
+class ArStream
+{
+	public:
+		ArStream( int fd, int type );
+		~ArStream();
+
+		const char* init();
+		long long read( char *dst, long long len );
+		bool skip( long long len );
+		long long tell() const;
+		const char* lastError() const;
+
+	private:
+		long long readCompressed( char *dst, long long len );
+
+		const int fd;
+		const int type;
+		long long pos;
+		const char *err;
+
+		char *in;
+		bool in_eof;
+#if defined AR_WITH_XZ
+		lzma_stream xz;
+#endif
+#if defined AR_WITH_GZ
+		z_stream gz;
+#endif
+};
+
+ArStream::ArStream( int _fd, int _type ) :
+	fd( _fd ),
+	type( _type ),
+	pos( 0 ),
+	err( NULL ),
+	in( NULL ),
+	in_eof( false )
+{
+#if defined AR_WITH_XZ
+	memset( &xz, 0, sizeof(xz) );
+#endif
+#if defined AR_WITH_GZ
+	memset( &gz, 0, sizeof(gz) );
+#endif
+}
+
+ArStream::~ArStream()
+{
+#if defined AR_WITH_XZ
+	if( type == AR_TAR_XZ ) {
+		lzma_end( &xz );
+	}
+#endif
+#if defined AR_WITH_GZ
+	if( type == AR_TAR_GZ ) {
+		inflateEnd( &gz );
+	}
+#endif
+	free( in );
+}
+
+/* returns NULL on success or an error string */
+const char* ArStream::init()
+{
+	switch( type ) {
+	case AR_TAR:
+		return NULL;
+	case AR_TAR_XZ:
+#if defined AR_WITH_XZ
+		in = (char*) malloc( AR_BLCKSZ );
+		if( lzma_stream_decoder( &xz, UINT64_MAX, LZMA_CONCATENATED )
+				!= LZMA_OK ) {
+			return "could not initialize xz decoder";
+		}
+		return NULL;
+#else
+		return "xz support not compiled in";
+#endif
+	case AR_TAR_GZ:
+#if defined AR_WITH_GZ
+		in = (char*) malloc( AR_BLCKSZ );
+		/* 15 + 32, zlib detects the gzip header itself */
+		if( inflateInit2( &gz, 47 ) != Z_OK ) {
+			return "could not initialize gzip decoder";
+		}
+		return NULL;
+#else
+		return "gzip support not compiled in";
+#endif
+	default:
+		assert( false );
+		return "unknown archive type";
+	}
+}
+
+long long ArStream::tell() const
+{
+	return pos;
+}
+
+const char* ArStream::lastError() const
+{
+	return (err != NULL) ? err : strerror(errno);
+}
+
+/* read len bytes, returns less only on EOF or -1 on error */
+long long ArStream::read( char *dst, long long len )
+{
+	long long done = 0;
+
+	if( type != AR_TAR ) {
+		done = readCompressed( dst, len );
+	} else {
+		while( done < len ) {
+			ssize_t tmp = ::read( fd, dst + done, len - done );
+			if( tmp < 0 ) {
+				return -1;
+			} else if( tmp == 0 ) {
+				break;
+			}
+			done += tmp;
+		}
+	}
+
+	if( done > 0 ) {
+		pos += done;
+	}
+	return done;
+}
+
+long long ArStream::readCompressed( char *dst, long long len )
+{
+#if defined AR_WITH_XZ
+	if( type == AR_TAR_XZ ) {
+		xz.next_out = (uint8_t*) dst;
+		xz.avail_out = len;
+		while( xz.avail_out > 0 ) {
+			if( xz.avail_in == 0 && !in_eof ) {
+				ssize_t tmp = ::read( fd, in, AR_BLCKSZ );
+				if( tmp < 0 ) {
+					return -1;
+				}
+				in_eof = (tmp == 0);
+				xz.next_in = (const uint8_t*) in;
+				xz.avail_in = tmp;
+			}
+			lzma_ret ret = lzma_code( &xz, in_eof ? LZMA_FINISH : LZMA_RUN );
+			if( ret == LZMA_STREAM_END ) {
+				break;
+			} else if( ret != LZMA_OK ) {
+				err = "xz data corrupt";
+				return -1;
+			}
+		}
+		return len - xz.avail_out;
+	}
+#endif
+#if defined AR_WITH_GZ
+	if( type == AR_TAR_GZ ) {
+		gz.next_out = (Bytef*) dst;
+		gz.avail_out = len;
+		while( gz.avail_out > 0 ) {
+			if( gz.avail_in == 0 ) {
+				if( in_eof ) {
+					break;
+				}
+				ssize_t tmp = ::read( fd, in, AR_BLCKSZ );
+				if( tmp < 0 ) {
+					return -1;
+				}
+				in_eof = (tmp == 0);
+				gz.next_in = (Bytef*) in;
+				gz.avail_in = tmp;
+			}
+			int ret = inflate( &gz, Z_NO_FLUSH );
+			if( ret == Z_STREAM_END ) {
+				/* concatenated gzip members are allowed */
+				if( gz.avail_in == 0 && !in_eof ) {
+					ssize_t tmp = ::read( fd, in, AR_BLCKSZ );
+					if( tmp < 0 ) {
+						return -1;
+					}
+					gz.next_in = (Bytef*) in;
+					gz.avail_in = tmp;
+				}
+				if( gz.avail_in == 0 ) {
+					in_eof = true;
+					break;
+				}
+				inflateReset( &gz );
+			} else if( ret == Z_BUF_ERROR && in_eof ) {
+				err = "gzip data truncated";
+				return -1;
+			} else if( ret != Z_OK && ret != Z_BUF_ERROR ) {
+				err = "gzip data corrupt";
+				return -1;
+			}
+		}
+		return len - gz.avail_out;
+	}
+#endif
+	(void) dst;
+	(void) len;
+	assert( false );
+	return -1;
+}
+
+bool ArStream::skip( long long len )
+{
+	if( type == AR_TAR ) {
+		if( lseek( fd, len, SEEK_CUR ) < 0 ) {
+			return false;
+		}
+		pos += len;
+		return true;
+	}
+
+	char scratch[AR_BLCKSZ];
+	while( len > 0 ) {
+		long long chunk = len < AR_BLCKSZ ? len : AR_BLCKSZ;
+		if( read( scratch, chunk ) != chunk ) {
+			return false;
+		}
+		len -= chunk;
+	}
+	return true;
+}
+
+
+
+
+MsArchive::MsArchive() :
+	fd( -1 ),
+	type( AR_TAR ),
+	filter( NULL ),
+	sub_dir( NULL ),
+	first_dir( NULL ),
+	multi_dir( false ),
+	m_len( 0 ),
+	m_size( 0 ),
+	members( NULL ),
+	stream( NULL ),
+	by_offset( NULL ),
+	next_pass( 0 ),
+	cache_len( 0 )
+{
+	error[0] = '\0';
+}
+
+MsArchive::~MsArchive()
+{
+	if( fd >= 0 ) {
+		close( fd );
+	}
+	delete stream;
+	for( int m = 0; m < m_len; m++ ) {
+		free( members[m].cache );
+	}
+	free( by_offset );
+	free( members );
+	free( first_dir );
+	free( sub_dir );
+}
+
+
+static int cmp_member( const void *a, const void *b )
+{
+	return strcmp( ((const ar_member*)a)->name, ((const ar_member*)b)->name );
+}
+
+static int cmp_member_offset( const void *a, const void *b )
+{
+	long long d = (*(const ar_member**)a)->offset
+		- (*(const ar_member**)b)->offset;
+	return (d > 0) - (d < 0);
+}
+
+/* like cmp_member(), equal names in archive order */
+static int cmp_member_seq( const void *a, const void *b )
+{
+	int ret = cmp_member( a, b );
+	if( ret == 0 ) {
+		ret = ((const ar_member*)a)->seq - ((const ar_member*)b)->seq;
+	}
+	return ret;
+}
+
+
+/**
+ * Open archive at path. Path may continue with a directory inside the
+ * archive, e.g. "data.tar.xz/msdir". If no directory is given then all listed
+ * members must be located in the same directory.
+ */
+bool MsArchive::open( const char *path, ar_filter _filter )
+{
+	char ar_path[strlen(path) + 1];
+	struct stat s;
+
+	filter = _filter;
+	strcpy( ar_path, path );
+
+	/* strip directories inside the archive until we find the file */
+	while( stat( ar_path, &s ) != 0 ) {
+		char *sl = strrchr( ar_path, '/' );
+		if( sl == NULL || sl == ar_path ) {
+			setError( path, strerror(ENOENT) );
+			return false;
+		}
+		*sl = '\0';
+	}
+	if( !S_ISREG(s.st_mode) ) {
+		if( strcmp( ar_path, path ) != 0 ) {
+			/* a missing path below a directory, not inside an archive */
+			setError( path, strerror(ENOENT) );
+		} else {
+			setError( ar_path, "not a directory or archive" );
+		}
+		return false;
+	}
+
+	const char *sub = path + strlen(ar_path);
+	while( *sub == '/' ) {
+		sub++;
+	}
+	if( *sub != '\0' ) {
+		sub_dir = strdup( sub );
+		for( char *c = sub_dir + strlen(sub_dir) - 1; *c == '/'; c-- ) {
+			*c = '\0';
+		}
+	}
+
+#if defined _WIN32
+	fd = ::open( ar_path, _O_RDONLY | _O_BINARY );
+#else
+	fd = ::open( ar_path, O_RDONLY );
+#endif
+	if( fd < 0 ) {
+		setError( ar_path, strerror(errno) );
+		return false;
+	}
+
+	char magic[6];
+	memset( magic, 0, sizeof(magic) );
+	if( ar_pread( fd, magic, sizeof(magic), 0 ) < 0 ) {
+		setError( ar_path, strerror(errno) );
+		return false;
+	}
+
+	bool ok;
+	if( memcmp( magic, "\xFD" "7zXZ\0", 6 ) == 0 ) {
+		ok = openTar( AR_TAR_XZ );
+	} else if( memcmp( magic, "\x1F\x8B", 2 ) == 0 ) {
+		ok = openTar( AR_TAR_GZ );
+	} else if( memcmp( magic, "PK\x03\x04", 4 ) == 0
+			|| memcmp( magic, "PK\x05\x06", 4 ) == 0 ) {
+		ok = openZip();
+	} else {
+		ok = openTar( AR_TAR );
+	}
+
+	if( !ok ) {
+		/* prefix error with the archive name */
+		char tmp[AR_ERROR_LENGTH];
+		strcpy( tmp, error );
+		setError( ar_path, tmp );
+		return false;
+	}
+
+	if( !checkDirs() ) {
+		return false;
+	}
+
+	/* like tar -x the last of equally named members wins */
+	qsort( members, m_len, sizeof(ar_member), cmp_member_seq );
+	int n = 0;
+	for( int m = 0; m < m_len; m++ ) {
+		if( m + 1 < m_len && cmp_member( &members[m], &members[m + 1] ) == 0 ) {
+			continue;
+		}
+		members[n++] = members[m];
+	}
+	m_len = n;
+
+	if( type == AR_TAR_XZ || type == AR_TAR_GZ ) {
+		by_offset = (ar_member**) malloc( m_len * sizeof(ar_member*) );
+		for( int m = 0; m < m_len; m++ ) {
+			by_offset[m] = &members[m];
+		}
+		qsort( by_offset, m_len, sizeof(ar_member*), cmp_member_offset );
+	}
+	return true;
+}
+
+
+/* parse octal or GNU base-256 numbers of tar headers */
+static long long tar_number( const char *p, int len )
+{
+	long long n = 0;
+
+	if( (unsigned char)*p & 0x80 ) {
+		for( int i = 1; i < len; i++ ) {
+			n = (n << 8) | (unsigned char)p[i];
+		}
+		return n;
+	}
+
+	int i = 0;
+	while( i < len && p[i] == ' ' ) {
+		i++;
+	}
+	for( ; i < len && p[i] >= '0' && p[i] <= '7'; i++ ) {
+		n = (n << 3) + (p[i] - '0');
+	}
+	return n;
+}
+
+static bool tar_checksum( const char *hdr )
+{
+	long long chk = tar_number( hdr + 148, 8 );
+	unsigned long u_sum = 0;
+	long s_sum = 0;
+
+	for( int i = 0; i < TAR_BLCKSZ; i++ ) {
+		char c = (i >= 148 && i < 156) ? ' ' : hdr[i];
+		u_sum += (unsigned char) c;
+		s_sum += (signed char) c;
+	}
+	/* some historic tars used signed chars */
+	return chk == (long long)u_sum || chk == (long long)s_sum;
+}
+
+static bool tar_zero_block( const char *hdr )
+{
+	for( int i = 0; i < TAR_BLCKSZ; i++ ) {
+		if( hdr[i] != '\0' ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* extract "path=" from pax extended header records "<len> <key>=<val>\n" */
+static char* pax_path( const char *buf, long long len )
+{
+	const char *p = buf;
+	while( p < buf + len ) {
+		char *end;
+		long rec_len = strtol( p, &end, 10 );
+		if( rec_len <= 0 || *end != ' ' || p + rec_len > buf + len ) {
+			break;
+		}
+		const char *key = end + 1;
+		if( strncmp( key, "path=", 5 ) == 0 ) {
+			int val_len = p + rec_len - (key + 5) - 1;
+			char *ret = (char*) malloc( val_len + 1 );
+			memcpy( ret, key + 5, val_len );
+			ret[val_len] = '\0';
+			return ret;
+		}
+		p += rec_len;
+	}
+	return NULL;
+}
+
+bool MsArchive::openTar( int _type )
+{
+	ArStream st( fd, _type );
+	char hdr[TAR_BLCKSZ];
+	char *next_name = NULL;
+	bool first = true;
+	bool ok = false;
+
+	type = _type;
+
+	const char *e = st.init();
+	if( e != NULL ) {
+		setError( e );
+		return false;
+	}
+
+	while( true ) {
+		long long n = st.read( hdr, TAR_BLCKSZ );
+		if( n < 0 ) {
+			setError( st.lastError() );
+			break;
+		} else if( n == 0 && !first ) {
+			/* missing end of archive blocks, accept it like GNU tar does */
+			ok = true;
+			break;
+		} else if( n != TAR_BLCKSZ ) {
+			setError( first ? "unknown archive format" : "truncated archive" );
+			break;
+		}
+		if( tar_zero_block( hdr ) ) {
+			ok = true;
+			break;
+		}
+		if( !tar_checksum( hdr ) ) {
+			setError( first ? "unknown archive format" :
+				"bad tar header checksum" );
+			break;
+		}
+		first = false;
+
+		long long size = tar_number( hdr + 124, 12 );
+		long long padding = (TAR_BLCKSZ - size % TAR_BLCKSZ) % TAR_BLCKSZ;
+		char typeflag = hdr[156];
+
+		if( typeflag == 'L' || typeflag == 'x' ) {
+			/* GNU long name or pax header, applies to the next member */
+			char *tmp = (char*) malloc( size + 1 );
+			if( st.read( tmp, size ) != size || !st.skip( padding ) ) {
+				free( tmp );
+				setError( "truncated archive" );
+				break;
+			}
+			tmp[size] = '\0';
+			free( next_name );
+			if( typeflag == 'L' ) {
+				next_name = tmp;
+			} else {
+				next_name = pax_path( tmp, size );
+				free( tmp );
+			}
+			continue;
+		}
+
+		ar_member *am = NULL;
+		if( typeflag == '0' || typeflag == '\0' || typeflag == '7' ) {
+			char name[100 + 1 + 155 + 1];
+			if( next_name != NULL ) {
+				am = addMember( next_name, 0, size, tar_number(hdr + 136, 12) );
+			} else {
+				int len = 0;
+				if( memcmp( hdr + 257, "ustar\0", 6 ) == 0 && hdr[345] != '\0' ) {
+					/* posix ustar prefix, GNU tar uses this area otherwise */
+					len = strnlen( hdr + 345, 155 );
+					memcpy( name, hdr + 345, len );
+					name[len++] = '/';
+				}
+				int nlen = strnlen( hdr, 100 );
+				memcpy( name + len, hdr, nlen );
+				name[len + nlen] = '\0';
+				am = addMember( name, 0, size, tar_number(hdr + 136, 12) );
+			}
+		}
+		free( next_name );
+		next_name = NULL;
+
+		if( am != NULL ) {
+			am->offset = st.tell();
+		}
+		if( !st.skip( size ) ) {
+			setError( "truncated archive" );
+			break;
+		}
+		if( !st.skip( padding ) ) {
+			setError( "truncated archive" );
+			break;
+		}
+	}
+
+	free( next_name );
+	return ok;
+}
+
+
+static time_t dos2time( unsigned int ddate, unsigned int dtime )
+{
+	struct tm dt;
+	memset( &dt, 0, sizeof(tm) );
+
+	dt.tm_year = (ddate >> 9) + 80;
+	dt.tm_mon = ((ddate >> 5) & 0x0F) - 1;
+	dt.tm_mday = ddate & 0x1F;
+	dt.tm_hour = dtime >> 11;
+	dt.tm_min = (dtime >> 5) & 0x3F;
+	dt.tm_sec = (dtime & 0x1F) * 2;
+	dt.tm_isdst = -1;
+
+	return mktime( &dt );
+}
+
+bool MsArchive::openZip()
+{
+	struct stat s;
+	type = AR_ZIP;
+
+	if( fstat( fd, &s ) < 0 ) {
+		setError( strerror(errno) );
+		return false;
+	}
+
+	/* end of central directory record, at most 64k comment behind */
+	long long tail_len = s.st_size < 0xFFFF + 22 ? s.st_size : 0xFFFF + 22;
+	char *tail = (char*) malloc( tail_len );
+	if( ar_pread( fd, tail, tail_len, s.st_size - tail_len ) != tail_len ) {
+		free( tail );
+		setError( "truncated archive" );
+		return false;
+	}
+	const char *eocd = NULL;
+	for( long long i = tail_len - 22; i >= 0; i-- ) {
+		if( memcmp( tail + i, "PK\x05\x06", 4 ) == 0 ) {
+			eocd = tail + i;
+			break;
+		}
+	}
+	if( eocd == NULL ) {
+		free( tail );
+		setError( "zip central directory not found" );
+		return false;
+	}
+	unsigned int entries = ar_uint16( eocd + 10 );
+	unsigned long cd_size = ar_uint32( eocd + 12 );
+	unsigned long cd_off = ar_uint32( eocd + 16 );
+	free( tail );
+
+	if( cd_off == 0xFFFFFFFFUL || entries == 0xFFFF ) {
+		setError( "zip64 archives not supported" );
+		return false;
+	}
+
+	char *cd = (char*) malloc( cd_size );
+	if( ar_pread( fd, cd, cd_size, cd_off ) != (long long) cd_size ) {
+		free( cd );
+		setError( "truncated archive" );
+		return false;
+	}
+
+	const char *p = cd;
+	for( unsigned int i = 0; i < entries; i++ ) {
+		if( p + 46 > cd + cd_size || memcmp( p, "PK\x01\x02", 4 ) != 0 ) {
+			free( cd );
+			setError( "bad zip central directory" );
+			return false;
+		}
+		unsigned int nlen = ar_uint16( p + 28 );
+		unsigned int elen = ar_uint16( p + 30 );
+		unsigned int clen = ar_uint16( p + 32 );
+		if( p + 46 + nlen > cd + cd_size ) {
+			free( cd );
+			setError( "bad zip central directory" );
+			return false;
+		}
+
+		char name[nlen + 1];
+		memcpy( name, p + 46, nlen );
+		name[nlen] = '\0';
+
+		if( nlen > 0 && name[nlen - 1] != '/' ) {
+			ar_member *am = addMember( name, ar_uint32( p + 42 ),
+				ar_uint32( p + 24 ),
+				dos2time( ar_uint16( p + 14 ), ar_uint16( p + 12 ) ) );
+			if( am != NULL ) {
+				am->method = ar_uint16( p + 10 );
+				am->csize = ar_uint32( p + 20 );
+			}
+		}
+		p += 46 + nlen + elen + clen;
+	}
+
+	free( cd );
+	return true;
+}
+
+
+ar_member* MsArchive::addMember( const char *path, long long offset,
+	long long size, time_t mtime )
+{
+	while( *path == '/' || (path[0] == '.' && path[1] == '/') ) {
+		path += (*path == '/') ? 1 : 2;
+	}
+
+	const char *base = strrchr( path, '/' );
+	int dir_len = 0;
+	if( base == NULL ) {
+		base = path;
+	} else {
+		dir_len = base - path;
+		base++;
+	}
+
+	if( strlen(base) > MAX_LEN_AR_NAME || !filter( base ) ) {
+		return NULL;
+	}
+
+	if( sub_dir != NULL ) {
+		if( (int)strlen(sub_dir) != dir_len
+				|| strncmp( sub_dir, path, dir_len ) != 0 ) {
+			return NULL;
+		}
+	} else if( first_dir == NULL ) {
+		first_dir = strndup( path, dir_len );
+	} else if( (int)strlen(first_dir) != dir_len
+			|| strncmp( first_dir, path, dir_len ) != 0 ) {
+		multi_dir = true;
+	}
+
+	if( m_len >= m_size ) {
+		m_size = 2 * m_size + 128;
+		members = (ar_member*) realloc( members, m_size * sizeof(ar_member) );
+	}
+
+	ar_member *am = &members[m_len++];
+	memset( am, 0, sizeof(ar_member) );
+	strcpy( am->name, base );
+	am->seq = m_len - 1;
+	am->offset = offset;
+	am->size = size;
+	am->mtime = mtime;
+	return am;
+}
+
+
+bool MsArchive::checkDirs()
+{
+	if( multi_dir ) {
+		setError( "metastock files found in more than one archive directory",
+			"append the wanted one to the path" );
+		return false;
+	}
+	return true;
+}
+
+
+int MsArchive::countMembers() const
+{
+	return m_len;
+}
+
+const char* MsArchive::memberName( int m ) const
+{
+	assert( m >= 0 && m < m_len );
+	return members[m].name;
+}
+
+long long MsArchive::memberSize( int m ) const
+{
+	assert( m >= 0 && m < m_len );
+	return members[m].size;
+}
+
+time_t MsArchive::memberTime( int m ) const
+{
+	assert( m >= 0 && m < m_len );
+	return members[m].mtime;
+}
+
+int MsArchive::findMember( const char *name ) const
+{
+	ar_member key;
+	strncpy( key.name, name, MAX_LEN_AR_NAME );
+	key.name[MAX_LEN_AR_NAME] = '\0';
+
+	const ar_member *am = (const ar_member*) bsearch( &key, members, m_len,
+		sizeof(ar_member), cmp_member );
+	return (am != NULL) ? am - members : -1;
+}
+
+
+/**
+ * copy member m to dst which must be at least memberSize(m) large,
+ * returns the number of bytes read or -1 on error
+ */
+long long MsArchive::readMember( int m, char *dst ) const
+{
+	assert( m >= 0 && m < m_len );
+	const ar_member *am = &members[m];
+
+	switch( type ) {
+	case AR_TAR: {
+		long long ret = ar_pread( fd, dst, am->size, am->offset );
+		if( ret < 0 ) {
+			setError( am->name, strerror(errno) );
+		} else if( ret != am->size ) {
+			setError( am->name, "truncated archive" );
+			ret = -1;
+		}
+		return ret;
+	}
+	case AR_TAR_XZ:
+	case AR_TAR_GZ:
+		return readStreamMember( &members[m], dst );
+	case AR_ZIP:
+		return readZipMember( am, dst );
+	default:
+		assert( false );
+		return -1;
+	}
+}
+
+
+/**
+ * Compressed tar archives can't be seeked. We decompress forward to the
+ * member and start over only if it is behind the current position. Members
+ * passed on the way are cached up to AR_CACHE_SIZE, so any read order costs
+ * one pass as long as they fit.
+ */
+long long MsArchive::readStreamMember( ar_member *am, char *dst ) const
+{
+	if( am->cache != NULL ) {
+		memcpy( dst, am->cache, am->size );
+		free( am->cache );
+		am->cache = NULL;
+		cache_len -= am->size;
+		return am->size;
+	}
+
+	if( stream != NULL && stream->tell() > am->offset ) {
+		delete stream;
+		stream = NULL;
+	}
+	if( stream == NULL ) {
+		if( lseek( fd, 0, SEEK_SET ) < 0 ) {
+			setError( am->name, strerror(errno) );
+			return -1;
+		}
+		stream = new ArStream( fd, type );
+		next_pass = 0;
+		const char *e = stream->init();
+		if( e != NULL ) {
+			setError( am->name, e );
+			return -1;
+		}
+	}
+
+	for( ; next_pass < m_len && by_offset[next_pass] != am; next_pass++ ) {
+		ar_member *pm = by_offset[next_pass];
+		if( pm->offset < stream->tell() || pm->cache != NULL
+				|| cache_len + pm->size > AR_CACHE_SIZE ) {
+			continue;
+		}
+		pm->cache = (char*) malloc( pm->size > 0 ? pm->size : 1 );
+		if( !stream->skip( pm->offset - stream->tell() )
+				|| stream->read( pm->cache, pm->size ) != pm->size ) {
+			/* reported when it is wanted */
+			free( pm->cache );
+			pm->cache = NULL;
+			break;
+		}
+		cache_len += pm->size;
+	}
+
+	if( !stream->skip( am->offset - stream->tell() )
+			|| stream->read( dst, am->size ) != am->size ) {
+		setError( am->name, "truncated archive" );
+		delete stream;
+		stream = NULL;
+		return -1;
+	}
+	next_pass++;
+	return am->size;
+}
+
+
+long long MsArchive::readZipMember( const ar_member *am, char *dst ) const
+{
+	char lh[30];
+	if( ar_pread( fd, lh, sizeof(lh), am->offset ) != sizeof(lh)
+			|| memcmp( lh, "PK\x03\x04", 4 ) != 0 ) {
+		setError( am->name, "bad zip local header" );
+		return -1;
+	}
+	long long data_off = am->offset + sizeof(lh)
+		+ ar_uint16( lh + 26 ) + ar_uint16( lh + 28 );
+
+	if( am->method == 0 ) {
+		if( ar_pread( fd, dst, am->size, data_off ) != am->size ) {
+			setError( am->name, "truncated archive" );
+			return -1;
+		}
+		return am->size;
+	} else if( am->method != 8 ) {
+		setError( am->name, "unsupported zip compression method" );
+		return -1;
+	}
+
+#if defined AR_WITH_GZ
+	char *cbuf = (char*) malloc( am->csize );
+	if( ar_pread( fd, cbuf, am->csize, data_off ) != am->csize ) {
+		free( cbuf );
+		setError( am->name, "truncated archive" );
+		return -1;
+	}
+
+	z_stream zs;
+	memset( &zs, 0, sizeof(zs) );
+	/* raw deflate, zip has its own headers */
+	inflateInit2( &zs, -15 );
+	zs.next_in = (Bytef*) cbuf;
+	zs.avail_in = am->csize;
+	zs.next_out = (Bytef*) dst;
+	zs.avail_out = am->size;
+	int ret = inflate( &zs, Z_FINISH );
+	inflateEnd( &zs );
+	free( cbuf );
+
+	if( ret != Z_STREAM_END || zs.total_out != (unsigned long) am->size ) {
+		setError( am->name, "zip data corrupt" );
+		return -1;
+	}
+	return am->size;
+#else
+	setError( am->name, "zip deflate support not compiled in" );
+	return -1;
+#endif
+}
+
+
+const char* MsArchive::lastError() const
+{
+	return error;
+}
+
+
+void MsArchive::setError( const char* e1, const char* e2 ) const
+{
+	if( e2 == NULL || *e2 == '\0' ) {
+		snprintf( error, AR_ERROR_LENGTH, "%s", e1);
+	} else {
+		snprintf( error, AR_ERROR_LENGTH, "%s: %s", e1, e2 );
+	}
+}
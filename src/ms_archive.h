@@ -0,0 +1,116 @@
+/*** ms_archive.h -- reading metastock directories from archives
+ *
+ * Copyright (C) 2010-2016 Ruediger Meier
+ *
+ * Author:  Ruediger Meier <sweet_f_a@gmx.de>
+ *
+ * This file is part of atem.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of any contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ***/
+
+#ifndef ATEM_MS_ARCHIVE_H
+#define ATEM_MS_ARCHIVE_H
+
+#include <time.h>
+
+
+/* metastock file names are short, longer member names are never listed */
+#define MAX_LEN_AR_NAME 15
+#define AR_ERROR_LENGTH 256
+
+/* returns true if member name (without directory) should be listed */
+typedef bool (*ar_filter)( const char *name );
+
+struct ar_member;
+class ArStream;
+
+
+/**
+ * A flat, read only view of one directory inside a tar (plain, xz or gzip
+ * compressed) or zip archive.
+ * Members are read on demand. Compressed tar archives can't be seeked, the
+ * members passed on the way to a wanted one are kept in a cache of limited
+ * size. When an uncached earlier member is wanted, they are decompressed
+ * again from the start.
+ */
+class MsArchive
+{
+	public:
+		MsArchive();
+		~MsArchive();
+
+		bool open( const char *path, ar_filter filter );
+
+		int countMembers() const;
+		const char* memberName( int m ) const;
+		long long memberSize( int m ) const;
+		time_t memberTime( int m ) const;
+		int findMember( const char *name ) const;
+		long long readMember( int m, char *dst ) const;
+
+		const char* lastError() const;
+
+	private:
+		bool openTar( int type );
+		bool openZip();
+		ar_member* addMember( const char *path, long long offset,
+			long long size, time_t mtime );
+		bool checkDirs();
+		long long readZipMember( const ar_member *am, char *dst ) const;
+		long long readStreamMember( ar_member *am, char *dst ) const;
+		void setError( const char* e1, const char* e2 = "" ) const;
+
+		int fd;
+		int type;
+		ar_filter filter;
+
+		char *sub_dir;
+		char *first_dir;
+		bool multi_dir;
+
+		int m_len;
+		int m_size;
+		ar_member *members;
+
+		/* decompressor of compressed tar archives, positioned after the
+		   last member read */
+		mutable ArStream *stream;
+		/* members of compressed tar archives in archive order, the ones
+		   before next_pass have been passed by stream */
+		ar_member **by_offset;
+		mutable int next_pass;
+		mutable long long cache_len;
+
+		mutable char error[AR_ERROR_LENGTH];
+};
+
+
+
+#endif
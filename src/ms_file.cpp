@@ -39,10 +39,16 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <stdint.h>
+#include <math.h>
 
 
+#include "col_archive.h"
+#include "where.h"
+#include "stats.h"
 #include "util.h"
 #include "boobs.h"
 #include "config.h"
@@ -101,6 +107,7 @@ unsigned int str_to_data_field( const char* column )
 	RETURN_IF_COLUMN( D_OPE );
 	RETURN_IF_COLUMN( D_OPI );
 	RETURN_IF_COLUMN( D_TIM );
+	RETURN_IF_COLUMN( D_TST );
 	return 0;
 }
 
@@ -170,6 +177,305 @@ int mr_header_to_string( char *dest,
 #undef PRINT_FIELD
 
 
+/**
+ * copy src as quoted JSON string, return strlen. Quotes, backslashes and
+ * control chars are escaped, bytes >= 0x80 are taken as latin1.
+ */
+static int json_strcpy( char *dest, const char *src )
+{
+	static const char hex[] = "0123456789abcdef";
+	char *d = dest;
+	*d++ = '"';
+	for( const unsigned char *c = (const unsigned char*)src; *c; c++ ) {
+		if( *c >= 0x20 && *c < 0x80 && *c != '"' && *c != '\\' ) {
+			*d++ = *c;
+		} else if( *c == '"' || *c == '\\' ) {
+			*d++ = '\\';
+			*d++ = *c;
+		} else {
+			memcpy( d, "\\u00", 4 );
+			d[4] = hex[*c >> 4];
+			d[5] = hex[*c & 0xf];
+			d += 6;
+		}
+	}
+	*d++ = '"';
+	return d - dest;
+}
+
+static inline int json_charcpy( char *dest, char c )
+{
+	const char s[2] = { c, '\0' };
+	return json_strcpy( dest, s );
+}
+
+static inline int quoted_datestr( char *dest, int date )
+{
+	*dest = '"';
+	int len = itodatestr( dest + 1, date );
+	dest[len + 1] = '"';
+	return len + 2;
+}
+
+/* escaping is only needed for strings from master files */
+#define PRINT_FIELD( _func_, _field_, _var_ ) \
+	if( prnt_master_fields & _field_) { \
+		memcpy( cp, "\"" STR_##_field_ "\":", sizeof(STR_##_field_) + 2 ); \
+		cp += sizeof(STR_##_field_) + 2; \
+		cp += _func_( cp, _var_ ); \
+		*cp++ = ','; \
+	}
+
+/**
+ * print the symbol info columns as begin of a JSON object, without closing
+ * brace
+ */
+int mr_record_to_json( char *dest, const struct master_record* mr,
+	unsigned short prnt_master_fields )
+{
+	char *cp = dest;
+	*cp++ = '{';
+
+	PRINT_FIELD( json_strcpy, M_SYM, mr->c_symbol );
+	PRINT_FIELD( json_strcpy, M_NAM, mr->c_long_name );
+	PRINT_FIELD( json_charcpy, M_PER, mr->barsize );
+	PRINT_FIELD( quoted_datestr, M_DT1, mr->from_date );
+	PRINT_FIELD( quoted_datestr, M_DT2, mr->to_date );
+	PRINT_FIELD( itoa, M_FNO, mr->file_number );
+	PRINT_FIELD( json_strcpy, M_FIL, mr->file_name );
+	PRINT_FIELD( itoa, M_FLD, mr->field_bitset );
+	PRINT_FIELD( itoa, M_RNO, mr->record_number );
+	PRINT_FIELD( json_charcpy, M_KND, mr->kind );
+
+	// remove last separator if exists
+	if( cp[-1] == ',' ) {
+		cp--;
+	}
+	*cp = '\0';
+	assert( (cp - dest) < MAX_SIZE_MR_JSON );
+	return cp - dest;
+}
+
+#undef PRINT_FIELD
+
+
+/* PostgreSQL binary COPY, all integers are big endian */
+#define PGCOPY_SIGNATURE "PGCOPY\n\377\r\n"
+/* field length of NULL values */
+#define PGCOPY_NULL -1
+/* 2000-01-01 is day 0 of PostgreSQL dates and timestamps */
+#define PG_EPOCH_SECS 946684800LL
+
+static inline int pg_int16( char *dest, int16_t n )
+{
+	uint16_t x = htobe16( (uint16_t)n );
+	memcpy( dest, &x, 2 );
+	return 2;
+}
+
+static inline int pg_int32( char *dest, int32_t n )
+{
+	uint32_t x = htobe32( (uint32_t)n );
+	memcpy( dest, &x, 4 );
+	return 4;
+}
+
+static inline int pg_int64( char *dest, int64_t n )
+{
+	uint64_t x = htobe64( (uint64_t)n );
+	memcpy( dest, &x, 8 );
+	return 8;
+}
+
+/**
+ * The pg_field_* functions print a whole field, length and value. They
+ * return the number of bytes written.
+ */
+static inline int pg_field_null( char *dest )
+{
+	return pg_int32( dest, PGCOPY_NULL );
+}
+
+static inline int pg_field_int4( char *dest, int n )
+{
+	pg_int32( dest, 4 );
+	return 4 + pg_int32( dest + 4, n );
+}
+
+static inline int pg_field_float4( char *dest, float f )
+{
+	union {
+		uint32_t L;
+		float F;
+	} x;
+	x.F = f;
+	pg_int32( dest, 4 );
+	return 4 + pg_int32( dest + 4, x.L );
+}
+
+/* text fields are UTF-8, bytes >= 0x80 are taken as latin1 like in JSON */
+static int pg_field_text( char *dest, const char *src )
+{
+	char *d = dest + 4;
+	for( const unsigned char *c = (const unsigned char*)src; *c; c++ ) {
+		if( *c < 0x80 ) {
+			*d++ = *c;
+		} else {
+			*d++ = 0xc0 | (*c >> 6);
+			*d++ = 0x80 | (*c & 0x3f);
+		}
+	}
+	pg_int32( dest, d - dest - 4 );
+	return d - dest;
+}
+
+static inline int pg_field_char( char *dest, char c )
+{
+	const char s[2] = { c, '\0' };
+	return pg_field_text( dest, s );
+}
+
+/* days since 2000-01-01, NULL for invalid dates */
+static int pg_field_date( char *dest, int date )
+{
+	int64_t secs;
+	if( !epoch_seconds( &secs, date, 0 ) ) {
+		return pg_field_null( dest );
+	}
+	return pg_field_int4( dest, (secs - PG_EPOCH_SECS) / 86400 );
+}
+
+/* microseconds since midnight */
+static int pg_field_time( char *dest, int time )
+{
+	if( time < 0 || time >= 1000000 ) {
+		time = 0;
+	}
+	int64_t secs = (time / 10000) * 3600 + (time / 100 % 100) * 60
+		+ time % 100;
+	pg_int32( dest, 8 );
+	return 4 + pg_int64( dest + 4, secs * 1000000 );
+}
+
+/* microseconds since 2000-01-01, NULL for invalid dates */
+static int pg_field_timestamp( char *dest, int date, int time )
+{
+	int64_t secs;
+	if( !epoch_seconds( &secs, date, time ) ) {
+		return pg_field_null( dest );
+	}
+	pg_int32( dest, 8 );
+	return 4 + pg_int64( dest + 4, (secs - PG_EPOCH_SECS) * 1000000 );
+}
+
+
+#define PRINT_FIELD( _func_, _field_, _var_ ) \
+	if( prnt_master_fields & _field_) { \
+		cp += _func_( cp, _var_ ); \
+	}
+
+/**
+ * print the begin of a PostgreSQL binary COPY tuple, the number of fields
+ * n_fields and the symbol info columns
+ */
+int mr_record_to_pgcopy( char *dest, const struct master_record* mr,
+	unsigned short prnt_master_fields, int n_fields )
+{
+	char *cp = dest;
+	cp += pg_int16( cp, n_fields );
+
+	PRINT_FIELD( pg_field_text, M_SYM, mr->c_symbol );
+	PRINT_FIELD( pg_field_text, M_NAM, mr->c_long_name );
+	PRINT_FIELD( pg_field_char, M_PER, mr->barsize );
+	PRINT_FIELD( pg_field_date, M_DT1, mr->from_date );
+	PRINT_FIELD( pg_field_date, M_DT2, mr->to_date );
+	PRINT_FIELD( pg_field_int4, M_FNO, mr->file_number );
+	PRINT_FIELD( pg_field_text, M_FIL, mr->file_name );
+	PRINT_FIELD( pg_field_int4, M_FLD, mr->field_bitset );
+	PRINT_FIELD( pg_field_int4, M_RNO, mr->record_number );
+	PRINT_FIELD( pg_field_char, M_KND, mr->kind );
+
+	assert( (cp - dest) <= MAX_SIZE_MR_PGCOPY );
+	return cp - dest;
+}
+
+#undef PRINT_FIELD
+
+
+static inline int raw_int32( char *dest, int32_t n )
+{
+	uint32_t x = htole32( (uint32_t)n );
+	memcpy( dest, &x, 4 );
+	return 4;
+}
+
+static inline int raw_float32( char *dest, float f )
+{
+	union {
+		uint32_t L;
+		float F;
+	} x;
+	x.F = f;
+	return raw_int32( dest, x.L );
+}
+
+/* zero padded string of fixed length, src must be shorter */
+static inline int raw_strcpy( char *dest, const char *src, int len )
+{
+	memset( dest, '\0', len );
+	strcpy( dest, src );
+	return len;
+}
+
+/**
+ * print the header of raw output, the symbol table of n_symbols entries
+ * has to follow
+ */
+int raw_header( char *dest, int n_symbols )
+{
+	static const char *columns[RAW_COLUMNS] = { "symbol_id", STR_D_DAT,
+		STR_D_TIM, STR_D_OPE, STR_D_HIG, STR_D_LOW, STR_D_CLO, STR_D_VOL,
+		STR_D_OPI };
+	char *cp = dest;
+
+	cp += raw_strcpy( cp, RAW_MAGIC, 8 );
+	cp += raw_int32( cp, RAW_VERSION );
+	cp += raw_int32( cp, RAW_SIZE_HEADER + n_symbols * RAW_SIZE_SYMBOL );
+	cp += raw_int32( cp, RAW_SIZE_RECORD );
+	cp += raw_int32( cp, RAW_COLUMNS );
+	cp += raw_int32( cp, n_symbols );
+	for( int i = 0; i < RAW_COLUMNS; i++ ) {
+		cp += raw_strcpy( cp, columns[i], RAW_NAME_LEN );
+	}
+
+	assert( (cp - dest) == RAW_SIZE_HEADER );
+	return cp - dest;
+}
+
+/**
+ * print a symbol table entry of raw output, the id is the file number
+ */
+int mr_record_to_raw( char *dest, const struct master_record* mr )
+{
+	char *cp = dest;
+
+	cp += raw_int32( cp, mr->file_number );
+	cp += raw_strcpy( cp, mr->c_symbol, 16 );
+	cp += raw_strcpy( cp, mr->c_long_name, 48 );
+
+	assert( (cp - dest) == RAW_SIZE_SYMBOL );
+	return cp - dest;
+}
+
+/**
+ * print the symbol id of raw records, 0 without symbol (stdin)
+ */
+int mr_raw_prefix( char *dest, const struct master_record* mr )
+{
+	return raw_int32( dest, (mr != NULL) ? mr->file_number : 0 );
+}
+
+
 static inline char
 readChar( const char *c, int offset )
 {
@@ -272,6 +578,82 @@ floatToIntDate_YYY( float d )
 }
 
 
+const char *vf_check_names[VF_CHECKS] = {
+	"master_size",
+	"master_count",
+	"master_record",
+	"master_dates",
+	"duplicate_file",
+	"missing_file",
+	"orphan_file",
+	"dat_size",
+	"dat_count",
+	"date",
+	"date_order",
+	"duplicate_date",
+	"ohlc",
+	"negative",
+	"float"
+};
+
+/**
+ * count a finding, only the first one of a check is described
+ */
+void vf_add( vf_finding *f, long long record, const char *fmt, ... )
+{
+	if( f->count++ == 0 ) {
+		va_list ap;
+		va_start( ap, fmt );
+		f->first = record;
+		vsnprintf( f->detail, VF_DETAIL_LENGTH, fmt, ap );
+		va_end( ap );
+	}
+}
+
+static inline bool valid_date( int d )
+{
+	const int m = d / 100 % 100;
+	const int day = d % 100;
+	return d > 0 && d < 100000000 && m >= 1 && m <= 12 && day >= 1
+		&& day <= 31;
+}
+
+static inline bool valid_time( int t )
+{
+	return t >= 0 && t < 240000 && t / 100 % 100 < 60 && t % 100 < 60;
+}
+
+/**
+ * master header and record count checks shared by all master files,
+ * returns the number of complete records
+ */
+static int verify_master_size( vf_finding *f, int size, int record_length,
+	int cnt )
+{
+	if( size < record_length || size % record_length != 0 ) {
+		vf_add( &f[VF_MASTER_SIZE], 0,
+			"%d bytes are not a multiple of %d", size, record_length );
+	}
+	int n = size / record_length - 1;
+	if( n < 0 ) {
+		n = 0;
+	}
+	if( cnt != n ) {
+		vf_add( &f[VF_MASTER_COUNT], 0,
+			"header says %d records, file has %d", cnt, n );
+	}
+	return cnt < n ? cnt : n;
+}
+
+/* dat file numbers seen already, to find duplicates */
+static bool seen_file_number( char *seen, int n )
+{
+	bool ret = seen[n / 8] & (1 << (n % 8));
+	seen[n / 8] |= (1 << (n % 8));
+	return ret;
+}
+
+
 
 
 
@@ -477,6 +859,52 @@ int MasterFile::dataLength( int r ) const
 }
 
 
+/**
+ * true if record r has a dat file number and a field count we can use
+ */
+bool MasterFile::usableRecord( int r ) const
+{
+	const char *record = buf + (record_length * r);
+	return readUnsignedChar( record, 0 ) > 0
+		&& record[4] >= 5 && record[4] <= 8;
+}
+
+/**
+ * check header and records like checkHeader() and checkRecord() but
+ * without printing and asserts, findings has VF_CHECKS entries
+ */
+void MasterFile::verify( vf_finding *findings ) const
+{
+	const int n = verify_master_size( findings, size, record_length,
+		readUnsignedChar( buf, 0 ) );
+	char seen[256 / 8];
+	memset( seen, 0, sizeof(seen) );
+
+	for( int r = 1; r <= n; r++ ) {
+		const char *record = buf + (record_length * r);
+		const int fno = readUnsignedChar( record, 0 );
+		if( !usableRecord( r ) || record[3] != 4 * record[4] ) {
+			vf_add( &findings[VF_MASTER_RECORD], r,
+				"F%d, %d fields, record length %d", fno, record[4],
+				record[3] );
+			continue;
+		} else if( seen_file_number( seen, fno ) ) {
+			vf_add( &findings[VF_DUPLICATE_FILE], r, "F%d", fno );
+		}
+		int date1 = floatToIntDate_YYY( readFloat( record, 25 ) );
+		int date2 = floatToIntDate_YYY( readFloat( record, 29 ) );
+		if( date1 > date2 ) {
+			/* like getRecord() */
+			date1 -= 1000000;
+		}
+		if( !valid_date( date1 ) || !valid_date( date2 ) || date1 > date2 ) {
+			vf_add( &findings[VF_MASTER_DATES], r, "F%d, %d to %d", fno,
+				date1, date2 );
+		}
+	}
+}
+
+
 
 
 
@@ -761,6 +1189,53 @@ int EMasterFile::dataLength( int r ) const
 }
 
 
+/**
+ * true if record r has a dat file number and fields we can use
+ */
+bool EMasterFile::usableRecord( int r ) const
+{
+	const char *record = buf + (record_length * r);
+	return readUnsignedChar( record, 2 ) > 0
+		&& record[6] >= 5 && record[6] <= 8
+		&& record[6] == count_bits( readUnsignedChar( record, 7 ) );
+}
+
+/**
+ * check header and records without printing and asserts, see
+ * MasterFile::verify()
+ */
+void EMasterFile::verify( vf_finding *findings ) const
+{
+	const int n = verify_master_size( findings, size, record_length,
+		readUnsignedChar( buf, 0 ) );
+	char seen[256 / 8];
+	memset( seen, 0, sizeof(seen) );
+
+	for( int r = 1; r <= n; r++ ) {
+		const char *record = buf + (record_length * r);
+		const int fno = readUnsignedChar( record, 2 );
+		if( !usableRecord( r ) ) {
+			vf_add( &findings[VF_MASTER_RECORD], r,
+				"F%d, %d fields, field bitset %02x", fno, record[6],
+				readUnsignedChar( record, 7 ) );
+			continue;
+		} else if( seen_file_number( seen, fno ) ) {
+			vf_add( &findings[VF_DUPLICATE_FILE], r, "F%d", fno );
+		}
+		int date1 = floatToIntDate_YYY( readFloat_IEEE( record, 64 ) );
+		int date2 = floatToIntDate_YYY( readFloat_IEEE( record, 72 ) );
+		if( date1 > date2 ) {
+			/* like checkRecord() */
+			date1 -= 1000000;
+		}
+		if( !valid_date( date1 ) || !valid_date( date2 ) || date1 > date2 ) {
+			vf_add( &findings[VF_MASTER_DATES], r, "F%d, %d to %d", fno,
+				date1, date2 );
+		}
+	}
+}
+
+
 
 
 
@@ -959,6 +1434,51 @@ int XMasterFile::fileNumber( int r ) const
 }
 
 
+/**
+ * true if record r has a dat file number and fields we can use
+ */
+bool XMasterFile::usableRecord( int r ) const
+{
+	const char *record = buf + (record_length * r);
+	const int bits = count_bits( readUnsignedChar( record, 70 ) );
+	return read_uint16( record, 65 ) > 255 && bits >= 5 && bits <= 8;
+}
+
+/**
+ * check header and records without printing and asserts, see
+ * MasterFile::verify()
+ */
+void XMasterFile::verify( vf_finding *findings ) const
+{
+	if( size >= 4 && memcmp( buf, "\x5d\xfeXM", 4 ) != 0 ) {
+		vf_add( &findings[VF_MASTER_SIZE], 0, "bad magic" );
+	}
+	const int n = verify_master_size( findings, size, record_length,
+		size >= 12 ? read_uint16( buf, 10 ) : 0 );
+	char *seen = (char*) calloc( 65536 / 8, 1 );
+
+	for( int r = 1; r <= n; r++ ) {
+		const char *record = buf + (record_length * r);
+		const int fno = read_uint16( record, 65 );
+		if( !usableRecord( r ) ) {
+			vf_add( &findings[VF_MASTER_RECORD], r,
+				"F%d, field bitset %02x", fno,
+				readUnsignedChar( record, 70 ) );
+			continue;
+		} else if( seen_file_number( seen, fno ) ) {
+			vf_add( &findings[VF_DUPLICATE_FILE], r, "F%d", fno );
+		}
+		int date1 = read_int32( record, 108 );
+		int date2 = read_int32( record, 116 );
+		if( !valid_date( date1 ) || !valid_date( date2 ) || date1 > date2 ) {
+			vf_add( &findings[VF_MASTER_DATES], r, "F%d, %d to %d", fno,
+				date1, date2 );
+		}
+	}
+	free( seen );
+}
+
+
 int XMasterFile::dataLength( int r ) const
 {
 	const char *record = buf + (record_length * r);
@@ -977,11 +1497,14 @@ int XMasterFile::dataLength( int r ) const
 
 
 
-FDat::FDat( const char *_buf, int _size, unsigned char fields ) :
+FDat::FDat( const char *_buf, long long _size, unsigned char fields ) :
 	field_bitset( fields ),
 	record_length( count_bits(fields) * 4 ),
 	buf( _buf ),
-	size( _size )
+	size( _size ),
+	rs_pending( false ),
+	rs_key( 0 ),
+	rs_volume( 0 )
 {
 }
 
@@ -991,9 +1514,21 @@ char FDat::print_sep = '\t';
 unsigned int FDat::print_bitset = 0xff;
 int FDat::print_date_from = 0;
 
-ftoa_func FDat::prc_ftoa = ftoa;
+ftoa_func FDat::ope_ftoa = ftoa;
+ftoa_func FDat::hig_ftoa = ftoa;
+ftoa_func FDat::low_ftoa = ftoa;
+ftoa_func FDat::clo_ftoa = ftoa;
 ftoa_func FDat::vol_ftoa = ftoa_prec_f0;
 ftoa_func FDat::opi_ftoa = ftoa_prec_f0;
+dtoa_func FDat::vol_dtoa = dtoa_prec_f0;
+unsigned int FDat::auto_prec_fields = 0;
+tstoa_func FDat::tst_func = tstoa_unit( "s" );
+bool FDat::tst_quoted = false;
+output_format FDat::out_fmt = OF_TEXT;
+ColWriter *FDat::col_writer = NULL;
+const Where *FDat::where = NULL;
+resample_unit FDat::rs_unit = RS_NONE;
+int FDat::rs_minutes = 0;
 
 
 void FDat::set_outfile( void *file )
@@ -1014,14 +1549,29 @@ void FDat::setPrintDateFrom( int date )
 	print_date_from = date;
 }
 
+void FDat::setWhere( const Where *w )
+{
+	where = w;
+}
+
+/**
+ * aggregate bars to periods of unit, minutes is the length of RS_MINUTES
+ */
+void FDat::setResample( resample_unit unit, int minutes )
+{
+	rs_unit = unit;
+	rs_minutes = minutes;
+}
+
 void FDat::setForceFloat( ms_data_field fld )
 {
 	switch(fld) {
 	case D_OPI:
-		opi_ftoa = prc_ftoa;
+		opi_ftoa = ftoa;
 		break;
 	case D_VOL:
-		vol_ftoa = prc_ftoa;
+		vol_ftoa = ftoa;
+		vol_dtoa = dtoa;
 		break;
 	default:
 		/* maybe extend this switch if ever needed */
@@ -1029,6 +1579,58 @@ void FDat::setForceFloat( ms_data_field fld )
 	}
 }
 
+/**
+ * set the printing function for all float columns given in fields,
+ * date and time bits are ignored. vol_func prints the same way the volume
+ * sums of --resample which are passed as double.
+ */
+void FDat::setFtoa( unsigned int fields, ftoa_func func, dtoa_func vol_func )
+{
+	if( fields & D_OPE ) {
+		ope_ftoa = func;
+	}
+	if( fields & D_HIG ) {
+		hig_ftoa = func;
+	}
+	if( fields & D_LOW ) {
+		low_ftoa = func;
+	}
+	if( fields & D_CLO ) {
+		clo_ftoa = func;
+	}
+	if( fields & D_VOL ) {
+		vol_ftoa = func;
+		vol_dtoa = vol_func;
+	}
+	if( fields & D_OPI ) {
+		opi_ftoa = func;
+	}
+}
+
+/**
+ * let guessPrecision() choose the number of decimals for these columns
+ */
+void FDat::setAutoPrecision( unsigned int fields )
+{
+	auto_prec_fields = fields;
+}
+
+void FDat::setTimestamp( tstoa_func func, bool quoted )
+{
+	tst_func = func;
+	tst_quoted = quoted;
+}
+
+void FDat::setOutputFormat( output_format fmt )
+{
+	out_fmt = fmt;
+}
+
+void FDat::set_col_writer( ColWriter *w )
+{
+	col_writer = w;
+}
+
 
 bool FDat::checkHeader() const
 {
@@ -1039,40 +1641,442 @@ bool FDat::checkHeader() const
 }
 
 
-int FDat::print( const char* header ) const
+int FDat::print( const char* header, int h_size ) const
 {
-	const char *record = buf + record_length;
-	const char *end = buf + ((countRecords() + 1) * record_length);
-	assert( end - buf <= size );
-	char buf[512];
-	char *buf_p = buf;
-
-	int h_size = strlen( header );
-	memcpy( buf, header, h_size );
-	buf_p += h_size;
+	assert( (countRecords() + 1) * (long long)record_length <= size );
+	return printRecords( header, h_size, buf + record_length,
+		countRecords() );
+}
 
-	int err = 0;
-	while( record < end ) {
-		int len = record_to_string( record, buf_p );
-		record += record_length;
-		if( len < 0) {
-			continue;
-		}
-		buf_p[len++] = '\n';
-		buf_p[len] = '\0';
 
-		/* We don't check errors every loop to be fast. Main reason to check
-		   errors at all is because there is no SIGPIPE on WIN32. */
-		err = fputs( buf, (FILE*)out );
-	}
+/* output lines are collected and written in blocks of this size */
+#define OUT_BUF_SIZE 65536
+/* max length of one output line, symbol info prefix included */
+#define MAX_SIZE_DAT_LINE 2048
 
-	fflush( (FILE*)out );
-	return err;
+/**
+ * write a block of formatted lines, returns -1 on error
+ */
+static int write_lines( void *out, const char *buf, size_t len )
+{
+	stats_phase_end( ST_FORMAT );
+	stats_phase_begin( ST_WRITE );
+	size_t written = fwrite( buf, 1, len, (FILE*)out );
+	stats_count( SC_BYTES_WRITTEN, written );
+	stats_phase_end( ST_WRITE );
+	stats_phase_begin( ST_FORMAT );
+
+	return (written == len) ? 0 : -1;
 }
 
+/* records are decoded in batches of this size before printing */
+#define BAR_BATCH 1024
 
-void FDat::print_header( const char* symbol_header )
-{
+/**
+ * print cnt records which don't need to be located in our buffer, used to
+ * print chunks of large files. The header of h_size bytes is printed before
+ * each record, it may contain zero bytes in binary formats.
+ */
+int FDat::printRecords( const char* header, int h_size, const char *records,
+	long long cnt ) const
+{
+	ms_bar bars[BAR_BATCH];
+	const char *record = records;
+	const char *end = records + cnt * record_length;
+	long long filtered = 0;
+
+	int err = 0;
+	while( record < end ) {
+		int n = 0;
+		stats_phase_begin( ST_DECODE );
+		for( ; record < end && n < BAR_BATCH; record += record_length ) {
+			if( record_to_bar( record, &bars[n] ) ) {
+				n++;
+			} else {
+				filtered++;
+			}
+		}
+		stats_phase_end( ST_DECODE );
+		stats_phase_begin( ST_FORMAT );
+		if( print_bars( header, h_size, bars, n ) < 0 ) {
+			err = -1;
+		}
+		stats_phase_end( ST_FORMAT );
+	}
+
+	stats_count( SC_RECORDS_DECODED, cnt );
+	stats_count( SC_RECORDS_FILTERED, filtered );
+
+	fflush( (FILE*)out );
+	return err;
+}
+
+/**
+ * print cnt decoded bars like printRecords() does, they are not filtered
+ * anymore
+ */
+int FDat::printBars( const char* header, int h_size, const ms_bar *bars,
+	long long cnt ) const
+{
+	stats_phase_begin( ST_FORMAT );
+	int err = print_bars( header, h_size, bars, cnt );
+	stats_phase_end( ST_FORMAT );
+
+	fflush( (FILE*)out );
+	return err;
+}
+
+/**
+ * print the bar still aggregated by --resample, must be called after the
+ * last records of a file have been printed
+ */
+int FDat::printPending( const char* header, int h_size ) const
+{
+	if( !rs_pending ) {
+		return 0;
+	}
+	rs_pending = false;
+	rs_bar.volume = rs_volume;
+
+	stats_phase_begin( ST_FORMAT );
+	int err = write_bars( header, h_size, &rs_bar, 1, &rs_volume );
+	stats_phase_end( ST_FORMAT );
+
+	fflush( (FILE*)out );
+	return err;
+}
+
+/**
+ * the period of a bar, bars are aggregated as long as it does not change
+ */
+static inline long long resample_key( const ms_bar *bar, resample_unit unit,
+	int minutes )
+{
+	switch( unit ) {
+	case RS_MINUTES:
+		return (long long)bar->date * 1440
+			+ (bar->time / 10000 * 60 + bar->time / 100 % 100) / minutes;
+	case RS_WEEK: {
+		int64_t secs;
+		if( !epoch_seconds( &secs, bar->date, 0 ) ) {
+			return bar->date;
+		}
+		/* weeks start on monday, 1970-01-01 was a thursday */
+		int64_t days = secs / 86400 + 3;
+		return (days >= 0 ? days : days - 6) / 7;
+	}
+	case RS_MONTH:
+		return bar->date / 100;
+	default:
+		return bar->date;
+	}
+}
+
+/* printBars() within a running format phase, applies --resample */
+int FDat::print_bars( const char* header, int h_size, const ms_bar *bars,
+	long long cnt ) const
+{
+	if( rs_unit == RS_NONE || !(field_bitset & D_DAT) ) {
+		return write_bars( header, h_size, bars, cnt, NULL );
+	}
+
+	ms_bar done[BAR_BATCH];
+	double done_volumes[BAR_BATCH];
+	int n = 0;
+	int err = 0;
+	for( const ms_bar *bar = bars; bar < bars + cnt; bar++ ) {
+		long long key = resample_key( bar, rs_unit, rs_minutes );
+		if( rs_pending && key == rs_key ) {
+			if( bar->high > rs_bar.high ) {
+				rs_bar.high = bar->high;
+			}
+			if( bar->low < rs_bar.low ) {
+				rs_bar.low = bar->low;
+			}
+			rs_bar.close = bar->close;
+			rs_volume += bar->volume;
+			rs_bar.openint = bar->openint;
+			if( rs_unit != RS_MINUTES ) {
+				/* labeled by the last trading day like MetaStock does */
+				rs_bar.date = bar->date;
+			}
+			continue;
+		}
+
+		if( rs_pending ) {
+			done[n] = rs_bar;
+			done[n].volume = rs_volume;
+			done_volumes[n++] = rs_volume;
+			if( n == BAR_BATCH ) {
+				if( write_bars( header, h_size, done, n,
+						done_volumes ) < 0 ) {
+					err = -1;
+				}
+				n = 0;
+			}
+		}
+		rs_pending = true;
+		rs_key = key;
+		rs_bar = *bar;
+		/* float sums would lose single records soon */
+		rs_volume = bar->volume;
+		if( rs_unit == RS_MINUTES ) {
+			/* labeled by the start of the period */
+			int m = (bar->time / 10000 * 60 + bar->time / 100 % 100)
+				/ rs_minutes * rs_minutes;
+			rs_bar.time = m / 60 * 10000 + m % 60 * 100;
+		} else {
+			rs_bar.time = 0;
+		}
+	}
+	if( n > 0 && write_bars( header, h_size, done, n, done_volumes ) < 0 ) {
+		err = -1;
+	}
+	return err;
+}
+
+/**
+ * Write formatted bars within a running format phase. Volumes summed up by
+ * --resample are passed as doubles, the float volume of bars may be off.
+ */
+int FDat::write_bars( const char* header, int h_size, const ms_bar *bars,
+	long long cnt, const double *volumes ) const
+{
+	const ms_bar *bar = bars;
+	const ms_bar *end = bars + cnt;
+	char buf[OUT_BUF_SIZE];
+	char *buf_p = buf;
+
+	assert( h_size < MAX_SIZE_DAT_LINE / 2 );
+
+	if( out_fmt == OF_COLUMNAR ) {
+		/* no header, the writer knows the current symbol */
+		stats_count( SC_RECORDS_PRINTED, cnt );
+		return col_writer->addBars( bars, cnt ) ? 0 : -1;
+	}
+
+	int err = 0;
+	for( ; bar < end; bar++ ) {
+		if( buf_p + MAX_SIZE_DAT_LINE > buf + OUT_BUF_SIZE ) {
+			/* We check errors only per block. Main reason to check errors
+			   at all is because there is no SIGPIPE on WIN32. */
+			if( write_lines( out, buf, buf_p - buf ) < 0 ) {
+				err = -1;
+			}
+			buf_p = buf;
+		}
+		buf_p += format_line( header, h_size, bar, buf_p,
+			(volumes != NULL) ? &volumes[bar - bars] : NULL );
+	}
+	if( buf_p != buf ) {
+		if( write_lines( out, buf, buf_p - buf ) < 0 ) {
+			err = -1;
+		}
+	}
+
+	stats_count( SC_RECORDS_PRINTED, cnt );
+	return err;
+}
+
+/**
+ * format one output line (header and bar), returns its length
+ */
+int FDat::format_line( const char* header, int h_size, const ms_bar *bar,
+	char *s, const double *volume ) const
+{
+	char *p = s;
+	memcpy( p, header, h_size );
+	p += h_size;
+	switch( out_fmt ) {
+	case OF_JSONL:
+		p += format_bar<true>( bar, p, volume );
+		*p++ = '\n';
+		break;
+	case OF_PGCOPY:
+		p += bar_to_pgcopy( bar, p );
+		break;
+	case OF_RAW:
+		p += bar_to_raw( bar, p );
+		break;
+	default:
+		p += format_bar<false>( bar, p, volume );
+		*p++ = '\n';
+	}
+	return p - s;
+}
+
+/**
+ * print lines of different files like write_bars(), used by
+ * --merge-by-time where neighbouring lines rarely share a file
+ */
+int FDat::printMerged( const merged_bar *rows, int cnt )
+{
+	char buf[OUT_BUF_SIZE];
+	char *buf_p = buf;
+	int err = 0;
+
+	stats_phase_begin( ST_FORMAT );
+	for( const merged_bar *row = rows; row < rows + cnt; row++ ) {
+		assert( row->h_size < MAX_SIZE_DAT_LINE / 2 );
+		if( buf_p + MAX_SIZE_DAT_LINE > buf + OUT_BUF_SIZE ) {
+			if( write_lines( out, buf, buf_p - buf ) < 0 ) {
+				err = -1;
+			}
+			buf_p = buf;
+		}
+		buf_p += row->dat->format_line( row->header, row->h_size, &row->bar,
+			buf_p, NULL );
+	}
+	if( buf_p != buf ) {
+		if( write_lines( out, buf, buf_p - buf ) < 0 ) {
+			err = -1;
+		}
+	}
+	stats_phase_end( ST_FORMAT );
+
+	stats_count( SC_RECORDS_PRINTED, cnt );
+	fflush( (FILE*)out );
+	return err;
+}
+
+/**
+ * remove bars before --date-from or not matching --where, returns the
+ * number of remaining bars
+ */
+long long FDat::filterBars( ms_bar *bars, long long cnt ) const
+{
+	long long n = selectBars( bars, cnt );
+	stats_count( SC_RECORDS_FILTERED, cnt - n );
+	return n;
+}
+
+/**
+ * filterBars() without counting, may be called from worker threads
+ */
+long long FDat::selectBars( ms_bar *bars, long long cnt ) const
+{
+	int date_from = (field_bitset & D_DAT) ? print_date_from : 0;
+	if( date_from <= 0 && where == NULL ) {
+		return cnt;
+	}
+	long long n = 0;
+	for( long long i = 0; i < cnt; i++ ) {
+		if( bars[i].date >= date_from
+				&& (where == NULL || where->match( &bars[i] )) ) {
+			bars[n++] = bars[i];
+		}
+	}
+	return n;
+}
+
+
+/* records looked at by guessPrecision(), spread evenly */
+#define PREC_SAMPLE_SIZE 1024
+/* auto precision never prints more decimals than the default */
+#define MAX_AUTO_PRECISION 5
+
+/* order of the fields within dat records */
+static const unsigned int field_order[8] = {
+	D_DAT, D_TIM, D_OPE, D_HIG, D_LOW, D_CLO, D_VOL, D_OPI };
+
+/**
+ * number of decimals needed to print f without changing its float value
+ */
+static int count_decimals( float f )
+{
+	static const double p10[MAX_AUTO_PRECISION + 1] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5 };
+	int d = 0;
+	for( ; d < MAX_AUTO_PRECISION; d++ ) {
+		double r = floor( (double)f * p10[d] + 0.5 );
+		if( (float)(r / p10[d]) == f ) {
+			break;
+		}
+	}
+	return d;
+}
+
+/**
+ * Set the precision of the auto precision columns to the minimal number of
+ * decimals that represents the tick grid of some sample records, e.g. 2 for
+ * equities priced in cents and 4 or 5 for FX.
+ */
+void FDat::guessPrecision( const char *records, long long cnt ) const
+{
+	const unsigned int fields = auto_prec_fields;
+	if( fields == 0 ) {
+		return;
+	}
+
+	int decimals[8];
+	memset( decimals, 0, sizeof(decimals) );
+	long long step = (cnt + PREC_SAMPLE_SIZE - 1) / PREC_SAMPLE_SIZE;
+	for( long long r = 0; r < cnt; r += step ) {
+		const char *record = records + r * record_length;
+		int offset = 0;
+		for( int i = 0; i < 8; i++ ) {
+			const unsigned int fld = field_order[i];
+			if( !(field_bitset & fld) ) {
+				continue;
+			}
+			if( fields & fld ) {
+				int d = count_decimals( readFloat(record, offset) );
+				if( d > decimals[i] ) {
+					decimals[i] = d;
+				}
+			}
+			offset += 4;
+		}
+	}
+
+	/* columns missing in this file print the default value, -0 */
+	for( int i = 0; i < 8; i++ ) {
+		if( fields & field_order[i] ) {
+			setFtoa( field_order[i], ftoa_precision(decimals[i]),
+				dtoa_precision(decimals[i]) );
+		}
+	}
+}
+
+/**
+ * guessPrecision() for decoded bars
+ */
+void FDat::guessPrecision( const ms_bar *bars, long long cnt ) const
+{
+	const unsigned int fields = auto_prec_fields;
+	if( fields == 0 ) {
+		return;
+	}
+
+	int decimals[8];
+	memset( decimals, 0, sizeof(decimals) );
+	long long step = (cnt + PREC_SAMPLE_SIZE - 1) / PREC_SAMPLE_SIZE;
+	for( long long r = 0; r < cnt; r += step ) {
+		const ms_bar *bar = &bars[r];
+		/* in field_order, date and time are never floats */
+		const float values[8] = { 0, 0, bar->open, bar->high, bar->low,
+			bar->close, bar->volume, bar->openint };
+		for( int i = 2; i < 8; i++ ) {
+			if( field_bitset & fields & field_order[i] ) {
+				int d = count_decimals( values[i] );
+				if( d > decimals[i] ) {
+					decimals[i] = d;
+				}
+			}
+		}
+	}
+
+	for( int i = 0; i < 8; i++ ) {
+		if( fields & field_order[i] ) {
+			setFtoa( field_order[i], ftoa_precision(decimals[i]),
+				dtoa_precision(decimals[i]) );
+		}
+	}
+}
+
+
+void FDat::print_header( const char* symbol_header )
+{
 	char buf[512];
 	char *buf_p = buf;
 
@@ -1085,6 +2089,40 @@ void FDat::print_header( const char* symbol_header )
 	buf_p[len] = '\0';
 
 	fputs( buf, (FILE*)out );
+	stats_count( SC_BYTES_WRITTEN, h_size + len );
+}
+
+
+/**
+ * print the signature, flags and (empty) header extension which start
+ * PostgreSQL binary COPY data
+ */
+void FDat::print_pgcopy_header()
+{
+	char buf[sizeof(PGCOPY_SIGNATURE) + 8];
+	char *buf_p = buf;
+
+	/* the signature ends with a zero byte */
+	memcpy( buf_p, PGCOPY_SIGNATURE, sizeof(PGCOPY_SIGNATURE) );
+	buf_p += sizeof(PGCOPY_SIGNATURE);
+	buf_p += pg_int32( buf_p, 0 );
+	buf_p += pg_int32( buf_p, 0 );
+
+	fwrite( buf, 1, buf_p - buf, (FILE*)out );
+	stats_count( SC_BYTES_WRITTEN, buf_p - buf );
+}
+
+/**
+ * print the end marker of PostgreSQL binary COPY data
+ */
+void FDat::print_pgcopy_trailer()
+{
+	char buf[2];
+	pg_int16( buf, -1 );
+
+	fwrite( buf, 1, 2, (FILE*)out );
+	stats_count( SC_BYTES_WRITTEN, 2 );
+	fflush( (FILE*)out );
 }
 
 
@@ -1097,49 +2135,147 @@ void FDat::print_header( const char* symbol_header )
 		offset += 4; \
 	}
 
+/* JSON keys are the column names */
+#define PRINT_KEY( _field_ ) \
+	if( JSON ) { \
+		memcpy( s, "\"" STR_##_field_ "\":", sizeof(STR_##_field_) + 2 ); \
+		s += sizeof(STR_##_field_) + 2; \
+	}
+
+/* JSON has no Inf or NaN, they are null */
 #define PRINT_FIELD( _func_, _field_, _var_ ) \
 	if( print_bitset & _field_) { \
+		PRINT_KEY( _field_ ); \
+		if( JSON && !isfinite( _var_ ) ) { \
+			memcpy( s, "null", 4 ); \
+			s += 4; \
+		} else { \
+			s += _func_( s, _var_ ); \
+		} \
+		*s++ = sep; \
+	}
+
+/* date and time are strings in JSON */
+#define PRINT_QUOTED( _func_, _field_, _var_ ) \
+	if( print_bitset & _field_) { \
+		PRINT_KEY( _field_ ); \
+		if( JSON ) { \
+			*s++ = '"'; \
+		} \
 		s += _func_( s, _var_ ); \
-		*s++ = print_sep; \
+		if( JSON ) { \
+			*s++ = '"'; \
+		} \
+		*s++ = sep; \
 	}
 
 
-int FDat::record_to_string( const char *record, char *s ) const
+/**
+ * Decode a record, columns missing in the file get defaults. Returns false
+ * if the record is filtered by date or --where.
+ */
+bool FDat::record_to_bar( const char *record, ms_bar *bar ) const
+{
+	return decode_bar<true>( record, bar );
+}
+
+/**
+ * decode cnt records without filtering them by date
+ */
+void FDat::decodeRecords( const char *records, long long cnt,
+	ms_bar *bars ) const
+{
+	stats_phase_begin( ST_DECODE );
+	for( long long i = 0; i < cnt; i++ ) {
+		decode_bar<false>( records + i * record_length, &bars[i] );
+	}
+	stats_phase_end( ST_DECODE );
+
+	stats_count( SC_RECORDS_DECODED, cnt );
+}
+
+template <bool FILTER>
+bool FDat::decode_bar( const char *record, ms_bar *bar ) const
 {
 	int offset = 0;
-	char *begin = s;
 
-	int date, time;
-	float open, high , low, close, volume, openint;
-	date = time = 0;
-	open = high = low = close = volume = openint = DEFAULT_FLOAT;
+	bar->date = bar->time = 0;
+	bar->open = bar->high = bar->low = bar->close = DEFAULT_FLOAT;
+	bar->volume = bar->openint = DEFAULT_FLOAT;
 
 	if( field_bitset & D_DAT ) {
-		date = floatToIntDate_YYY(readFloat(record, offset));
-		if( date < print_date_from ) {
-			return -1;
+		bar->date = floatToIntDate_YYY(readFloat(record, offset));
+		if( FILTER && bar->date < print_date_from ) {
+			return false;
 		}
 		offset += 4;
 	}
 
-	READ_FIELD( time, D_TIM );
-	READ_FIELD( open, D_OPE );
-	READ_FIELD( high, D_HIG );
-	READ_FIELD( low, D_LOW );
-	READ_FIELD( close, D_CLO );
-	READ_FIELD( volume, D_VOL );
-	READ_FIELD( openint, D_OPI );
+	READ_FIELD( bar->time, D_TIM );
+	READ_FIELD( bar->open, D_OPE );
+	READ_FIELD( bar->high, D_HIG );
+	READ_FIELD( bar->low, D_LOW );
+	READ_FIELD( bar->close, D_CLO );
+	READ_FIELD( bar->volume, D_VOL );
+	READ_FIELD( bar->openint, D_OPI );
 
-	PRINT_FIELD( itodatestr, D_DAT, date );
-	PRINT_FIELD( itotimestr, D_TIM, time );
-	PRINT_FIELD( prc_ftoa, D_OPE, open );
-	PRINT_FIELD( prc_ftoa, D_HIG, high );
-	PRINT_FIELD( prc_ftoa, D_LOW, low );
-	PRINT_FIELD( prc_ftoa, D_CLO, close );
-	PRINT_FIELD( vol_ftoa, D_VOL, volume );
-	PRINT_FIELD( opi_ftoa, D_OPI, openint );
+	if( FILTER && where != NULL && !where->match( bar ) ) {
+		return false;
+	}
+	return true;
+}
 
-	if( s != begin ) {
+
+/**
+ * Format a bar as separated columns or as members of a JSON object. The
+ * JSON variant prints the members and the closing brace, the opening brace
+ * is part of the prefix printed by Metastock. A volume sum which is not
+ * exact as float is printed from the double.
+ */
+template <bool JSON>
+int FDat::format_bar( const ms_bar *bar, char *s,
+	const double *volume ) const
+{
+	char *begin = s;
+	const char sep = JSON ? ',' : print_sep;
+
+	if( print_bitset & D_TST ) {
+		PRINT_KEY( D_TST );
+		if( JSON && tst_quoted ) {
+			*s++ = '"';
+		}
+		int len = tst_func( s, bar->date, bar->time );
+		if( JSON && len == 0 ) {
+			/* invalid date */
+			memcpy( s, "null", 4 );
+			len = 4;
+		}
+		s += len;
+		if( JSON && tst_quoted ) {
+			*s++ = '"';
+		}
+		*s++ = sep;
+	}
+	PRINT_QUOTED( itodatestr, D_DAT, bar->date );
+	PRINT_QUOTED( itotimestr, D_TIM, bar->time );
+	PRINT_FIELD( ope_ftoa, D_OPE, bar->open );
+	PRINT_FIELD( hig_ftoa, D_HIG, bar->high );
+	PRINT_FIELD( low_ftoa, D_LOW, bar->low );
+	PRINT_FIELD( clo_ftoa, D_CLO, bar->close );
+	if( volume != NULL && (double)bar->volume != *volume ) {
+		PRINT_FIELD( vol_dtoa, D_VOL, *volume );
+	} else {
+		PRINT_FIELD( vol_ftoa, D_VOL, bar->volume );
+	}
+	PRINT_FIELD( opi_ftoa, D_OPI, bar->openint );
+
+	if( JSON ) {
+		if( s != begin ) {
+			s--;
+		}
+		*s++ = '}';
+		*s = '\0';
+	} else if( s != begin ) {
 		*(--s) = '\0';
 	} else {
 		*s = '\0';
@@ -1148,6 +2284,92 @@ int FDat::record_to_string( const char *record, char *s ) const
 	return s - begin;
 }
 
+int FDat::bar_to_string( const ms_bar *bar, char *s ) const
+{
+	return format_bar<false>( bar, s, NULL );
+}
+
+int FDat::bar_to_json( const ms_bar *bar, char *s ) const
+{
+	return format_bar<true>( bar, s, NULL );
+}
+
+/**
+ * decode and format a record, returns -1 if it's filtered
+ */
+int FDat::record_to_string( const char *record, char *s ) const
+{
+	ms_bar bar;
+	if( !record_to_bar( record, &bar ) ) {
+		return -1;
+	}
+	return format_bar<false>( &bar, s, NULL );
+}
+
+#undef PRINT_KEY
+#undef PRINT_QUOTED
+#undef PRINT_FIELD
+
+/* columns missing in the file are NULL */
+#define PRINT_FIELD( _func_, _field_, _var_ ) \
+	if( print_bitset & _field_) { \
+		s += (field_bitset & _field_) ? _func_( s, _var_ ) \
+			: pg_field_null( s ); \
+	}
+
+/**
+ * Format a bar as fields of a PostgreSQL binary COPY tuple, the field
+ * count is part of the prefix. Prices are float4 as stored in dat files,
+ * --timestamp, --precision and --scaled don't apply.
+ */
+int FDat::bar_to_pgcopy( const ms_bar *bar, char *s ) const
+{
+	char *begin = s;
+
+	if( print_bitset & D_TST ) {
+		s += pg_field_timestamp( s, bar->date, bar->time );
+	}
+	PRINT_FIELD( pg_field_date, D_DAT, bar->date );
+	PRINT_FIELD( pg_field_time, D_TIM, bar->time );
+	PRINT_FIELD( pg_field_float4, D_OPE, bar->open );
+	PRINT_FIELD( pg_field_float4, D_HIG, bar->high );
+	PRINT_FIELD( pg_field_float4, D_LOW, bar->low );
+	PRINT_FIELD( pg_field_float4, D_CLO, bar->close );
+	PRINT_FIELD( pg_field_float4, D_VOL, bar->volume );
+	PRINT_FIELD( pg_field_float4, D_OPI, bar->openint );
+
+	return s - begin;
+}
+
+#undef PRINT_FIELD
+
+/**
+ * Format a bar as raw struct, without the symbol id which is the prefix.
+ * All columns are printed regardless of --format, missing ones are 0 resp.
+ * -0.0 like in text output.
+ */
+int FDat::bar_to_raw( const ms_bar *bar, char *s ) const
+{
+	char *begin = s;
+
+	s += raw_int32( s, bar->date );
+	s += raw_int32( s, bar->time );
+	s += raw_float32( s, bar->open );
+	s += raw_float32( s, bar->high );
+	s += raw_float32( s, bar->low );
+	s += raw_float32( s, bar->close );
+	s += raw_float32( s, bar->volume );
+	s += raw_float32( s, bar->openint );
+
+	return s - begin;
+}
+
+#define PRINT_FIELD( _func_, _field_, _var_ ) \
+	if( print_bitset & _field_) { \
+		s += _func_( s, _var_ ); \
+		*s++ = print_sep; \
+	}
+
 #undef DEFAULT_FLOAT
 #undef READ_FIELD
 
@@ -1155,6 +2377,7 @@ int FDat::header_to_string( char *s )
 {
 	char *begin = s;
 
+	PRINT_FIELD( strcpy_len, D_TST, STR_D_TST );
 	PRINT_FIELD( strcpy_len, D_DAT, STR_D_DAT );
 	PRINT_FIELD( strcpy_len, D_TIM, STR_D_TIM );
 	PRINT_FIELD( strcpy_len, D_OPE, STR_D_OPE );
@@ -1174,6 +2397,110 @@ int FDat::header_to_string( char *s )
 }
 
 
+/**
+ * return date (YYYYMMDD) of any record or 0 if there is no date field
+ */
+int FDat::recordDate( const char *record ) const
+{
+	if( !(field_bitset & D_DAT) ) {
+		return 0;
+	}
+	return floatToIntDate_YYY( readFloat( record, 0 ) );
+}
+
+
+/**
+ * check the header record count against the file size, returns the number
+ * of complete records in the file
+ */
+long long FDat::verifyHeader( vf_finding *findings ) const
+{
+	if( size < record_length || record_length == 0 ) {
+		vf_add( &findings[VF_DAT_SIZE], 0, "%lld bytes, record length %d",
+			size, record_length );
+		return 0;
+	}
+	if( size % record_length != 0 ) {
+		vf_add( &findings[VF_DAT_SIZE], 0, "%lld trailing bytes",
+			size % record_length );
+	}
+	const long long n = size / record_length - 1;
+	const int cnt = read_uint16( buf, 2 ) - 1;
+	if( cnt != n ) {
+		vf_add( &findings[VF_DAT_COUNT], 0,
+			"header says %d records, file has %lld", cnt, n );
+	}
+	return n;
+}
+
+/**
+ * check cnt records, state is kept across calls
+ */
+void FDat::verifyRecords( const char *records, long long cnt,
+	vf_state *st ) const
+{
+	vf_finding *f = st->findings;
+	const int n_fields = count_bits( field_bitset );
+	ms_bar bar;
+
+	for( const char *rec = records; rec < records + cnt * record_length;
+			rec += record_length ) {
+		const long long r = ++st->records;
+
+		/* MBF exponent 1 wraps to IEEE exponent 0xff (Inf or NaN), exponent
+		   2 gives an IEEE denormal or zero, exponent 0 with other bits set
+		   is read as 0 */
+		for( int i = 0; i < n_fields; i++ ) {
+			uint32_t x = read_uint32( rec, 4 * i );
+			uint32_t e = x >> 24;
+			if( (e == 0 && x != 0) || e == 1 || e == 2 ) {
+				vf_add( &f[VF_FLOAT], r, "field %d is %08x", i + 1, x );
+			}
+		}
+
+		decode_bar<false>( rec, &bar );
+		if( (field_bitset & D_DAT) && !valid_date( bar.date ) ) {
+			vf_add( &f[VF_DATE], r, "date %d", bar.date );
+		}
+		if( (field_bitset & D_TIM) && !valid_time( bar.time ) ) {
+			vf_add( &f[VF_DATE], r, "time %d", bar.time );
+		}
+		if( (field_bitset & D_DAT) && r > 1 ) {
+			if( bar.date < st->prev_date || (bar.date == st->prev_date
+					&& bar.time < st->prev_time) ) {
+				vf_add( &f[VF_DATE_ORDER], r, "%d %06d after %d %06d",
+					bar.date, bar.time, st->prev_date, st->prev_time );
+			} else if( bar.date == st->prev_date
+					&& bar.time == st->prev_time ) {
+				vf_add( &f[VF_DUPLICATE_DATE], r, "%d %06d", bar.date,
+					bar.time );
+			}
+		}
+		st->prev_date = bar.date;
+		st->prev_time = bar.time;
+
+		const bool hl = (field_bitset & (D_HIG | D_LOW)) == (D_HIG | D_LOW);
+		if( hl && bar.high < bar.low ) {
+			vf_add( &f[VF_OHLC], r, "high %g < low %g", bar.high, bar.low );
+		} else if( hl && (field_bitset & D_OPE)
+				&& (bar.open < bar.low || bar.open > bar.high) ) {
+			vf_add( &f[VF_OHLC], r, "open %g not in %g to %g", bar.open,
+				bar.low, bar.high );
+		} else if( hl && (field_bitset & D_CLO)
+				&& (bar.close < bar.low || bar.close > bar.high) ) {
+			vf_add( &f[VF_OHLC], r, "close %g not in %g to %g", bar.close,
+				bar.low, bar.high );
+		}
+
+		if( bar.open < 0 || bar.high < 0 || bar.low < 0 || bar.close < 0
+				|| bar.volume < 0 || bar.openint < 0 ) {
+			vf_add( &f[VF_NEGATIVE], r, "%g %g %g %g %g %g", bar.open,
+				bar.high, bar.low, bar.close, bar.volume, bar.openint );
+		}
+	}
+}
+
+
 int FDat::countRecords() const
 {
 	if( size < record_length ) {
@@ -1182,7 +2509,7 @@ int FDat::countRecords() const
 
 	int cnt = read_uint16( buf, 2 ) - 1;
 
-	if( (cnt + 1) * record_length > size ) {
+	if( (cnt + 1) * (long long)record_length > size ) {
 		return -1;
 	}
 
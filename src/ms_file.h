@@ -38,6 +38,8 @@
 #ifndef ATEM_MS_FILE_H
 #define ATEM_MS_FILE_H
 
+#include "util.h"
+
 
 enum ms_master_file {
 	MF_MASTER = 01,
@@ -60,6 +62,22 @@ enum ms_master_field {
 	M_KND = 01000,
 };
 
+enum output_format {
+	OF_TEXT,
+	OF_JSONL,
+	OF_PGCOPY,
+	OF_RAW,
+	OF_COLUMNAR
+};
+
+enum resample_unit {
+	RS_NONE,
+	RS_MINUTES,
+	RS_DAY,
+	RS_WEEK,
+	RS_MONTH
+};
+
 enum ms_data_field {
 	// data fields
 	D_DAT = 01,
@@ -69,7 +87,9 @@ enum ms_data_field {
 	D_VOL = 020,
 	D_OPE = 040,
 	D_OPI = 0100,
-	D_TIM = 0200
+	D_TIM = 0200,
+	/* not stored, printed from date and time */
+	D_TST = 0400
 };
 
 #define STR_M_SYM "symbol"
@@ -91,6 +111,7 @@ enum ms_data_field {
 #define STR_D_OPE "open"
 #define STR_D_OPI "openint"
 #define STR_D_TIM "time"
+#define STR_D_TST "timestamp"
 
 unsigned int str_to_master_field( const char* );
 unsigned int str_to_data_field( const char* );
@@ -117,6 +138,19 @@ struct master_record
 	int to_date;
 };
 
+/* a decoded dat file record, missing columns are 0 resp. -0.0 */
+struct ms_bar
+{
+	int date;
+	int time;
+	float open;
+	float high;
+	float low;
+	float close;
+	float volume;
+	float openint;
+};
+
 /* estimated maximum string length returned by mr_record_to_string()
    sizes of ints (incl. seperators) + char* lengths (+/- seperator/zero) */
 #define MAX_SIZE_MR_STRING ( 6 + 2 + 6 + 4 + 2 \
@@ -129,6 +163,89 @@ int mr_record_to_string( char *dest, const struct master_record*,
 
 int mr_header_to_string( char *dest, unsigned short print_bitset, char sep );
 
+/* maximum string length returned by mr_record_to_json(), keys, quotes and
+   separators + strings with all chars escaped as \u00XX + numbers */
+#define MAX_SIZE_MR_JSON ( 1 + 130 \
+	+ 6 * (MAX_LEN_MR_SYMBOL + MAX_LEN_MR_LNAME + MAX_LEN_MR_FILENAME + 2) \
+	+ 10 + 10 + 5 + 3 + 5 )
+
+int mr_record_to_json( char *dest, const struct master_record*,
+	unsigned short print_bitset );
+
+/* maximum length returned by mr_record_to_pgcopy(), field count + lengths
+   + latin1 strings as UTF-8 + dates and ints */
+#define MAX_SIZE_MR_PGCOPY ( 2 + 10 * 4 \
+	+ 2 * (MAX_LEN_MR_SYMBOL + MAX_LEN_MR_LNAME + MAX_LEN_MR_FILENAME + 2) \
+	+ 2 * 4 + 3 * 4 )
+
+int mr_record_to_pgcopy( char *dest, const struct master_record*,
+	unsigned short print_bitset, int n_fields );
+
+/* Raw output, all numbers are little endian and 4 byte aligned:
+   header:  char magic[8], uint32 version, header_size (symbol table
+            included), record_size, n_columns, n_symbols
+            + n_columns zero padded column names of RAW_NAME_LEN
+   symbols: n_symbols x { int32 id, char symbol[16], char long_name[48] }
+   records: int32 symbol id, date (YYYYMMDD), time (HHMMSS)
+            + float32 open, high, low, close, volume, openint */
+#define RAW_MAGIC "ATEMRAW"
+#define RAW_VERSION 1
+#define RAW_NAME_LEN 16
+#define RAW_COLUMNS 9
+#define RAW_SIZE_HEADER ( 8 + 5 * 4 + RAW_COLUMNS * RAW_NAME_LEN )
+#define RAW_SIZE_SYMBOL ( 4 + 16 + 48 )
+#define RAW_SIZE_RECORD ( RAW_COLUMNS * 4 )
+
+int raw_header( char *dest, int n_symbols );
+int mr_record_to_raw( char *dest, const struct master_record* );
+int mr_raw_prefix( char *dest, const struct master_record* );
+
+
+
+/* problems found by --verify, see vf_check_names */
+enum vf_check {
+	VF_MASTER_SIZE,
+	VF_MASTER_COUNT,
+	VF_MASTER_RECORD,
+	VF_MASTER_DATES,
+	VF_DUPLICATE_FILE,
+	VF_MISSING_FILE,
+	VF_ORPHAN_FILE,
+	VF_DAT_SIZE,
+	VF_DAT_COUNT,
+	VF_DATE,
+	VF_DATE_ORDER,
+	VF_DUPLICATE_DATE,
+	VF_OHLC,
+	VF_NEGATIVE,
+	VF_FLOAT,
+	VF_CHECKS
+};
+
+extern const char *vf_check_names[VF_CHECKS];
+
+#define VF_DETAIL_LENGTH 96
+
+/* all findings of one check in one file, only the first one is described,
+   record 0 is the header */
+struct vf_finding
+{
+	long long count;
+	long long first;
+	char detail[VF_DETAIL_LENGTH];
+};
+
+void vf_add( vf_finding *f, long long record, const char *fmt, ... );
+
+/* state of FDat::verifyRecords() while reading a dat file in chunks */
+struct vf_state
+{
+	vf_finding findings[VF_CHECKS];
+	long long records;
+	int prev_date;
+	int prev_time;
+};
+
 
 
 class MasterFile
@@ -144,6 +261,8 @@ class MasterFile
 		int getRecord( master_record *, unsigned short rnum ) const;
 		int fileNumber( int record ) const;
 		int dataLength( int record ) const;
+		bool usableRecord( int record ) const;
+		void verify( vf_finding *findings ) const;
 
 	private:
 		bool checkHeader() const;
@@ -176,6 +295,8 @@ class EMasterFile
 		int getRecord( master_record *, unsigned short rnum ) const;
 		int fileNumber( int record ) const;
 		int dataLength( int record ) const;
+		bool usableRecord( int record ) const;
+		void verify( vf_finding *findings ) const;
 
 	private:
 		bool checkHeader() const;
@@ -207,6 +328,8 @@ class XMasterFile
 		int getRecord( master_record *, unsigned short rnum ) const;
 		int fileNumber( int record ) const;
 		int dataLength( int record ) const;
+		bool usableRecord( int record ) const;
+		void verify( vf_finding *findings ) const;
 
 	private:
 		bool checkHeader() const;
@@ -224,42 +347,113 @@ class XMasterFile
 
 
 
-typedef int (*ftoa_func)(char*, float);
+class ColWriter;
+class Where;
+class FDat;
+
+/* one output line of --merge-by-time, bar of file dat printed after header */
+struct merged_bar
+{
+	const FDat *dat;
+	const char *header;
+	int h_size;
+	ms_bar bar;
+};
 
 class FDat
 {
 	public:
-		FDat( const char *buf, int size, unsigned char fields );
+		FDat( const char *buf, long long size, unsigned char fields );
 
 		static bool checkHeader( const char* buf );
 		static bool checkRecord( const char* buf, int record  );
 		static void set_outfile( void *file );
 		static void initPrinter( char sep, unsigned int bitset );
 		static void setPrintDateFrom( int date );
+		static void setWhere( const Where *w );
+		static void setResample( resample_unit unit, int minutes );
 		static void setForceFloat( ms_data_field );
+		static void setFtoa( unsigned int fields, ftoa_func func,
+			dtoa_func vol_func );
+		static void setAutoPrecision( unsigned int fields );
+		static void setTimestamp( tstoa_func func, bool quoted );
+		static void setOutputFormat( output_format fmt );
+		static void set_col_writer( ColWriter *w );
 		static void print_header( const char* symbol_header );
+		static void print_pgcopy_header();
+		static void print_pgcopy_trailer();
 
 		bool checkHeader() const;
-		int print( const char* header ) const;
+		int print( const char* header, int h_size ) const;
+		int printRecords( const char* header, int h_size, const char *records,
+			long long cnt ) const;
+		int printBars( const char* header, int h_size, const ms_bar *bars,
+			long long cnt ) const;
+		int printPending( const char* header, int h_size ) const;
+		static int printMerged( const merged_bar *rows, int cnt );
+		long long filterBars( ms_bar *bars, long long cnt ) const;
+		long long selectBars( ms_bar *bars, long long cnt ) const;
 		int countRecords() const;
+		long long verifyHeader( vf_finding *findings ) const;
+		void verifyRecords( const char *records, long long cnt,
+			vf_state *st ) const;
+		int recordDate( const char *record ) const;
+		bool record_to_bar( const char *record, ms_bar *bar ) const;
+		void decodeRecords( const char *records, long long cnt,
+			ms_bar *bars ) const;
+		int record_to_string( const char *record, char *s ) const;
+		int bar_to_string( const ms_bar *bar, char *s ) const;
+		int bar_to_json( const ms_bar *bar, char *s ) const;
+		int bar_to_pgcopy( const ms_bar *bar, char *s ) const;
+		int bar_to_raw( const ms_bar *bar, char *s ) const;
+		void guessPrecision( const char *records, long long cnt ) const;
+		void guessPrecision( const ms_bar *bars, long long cnt ) const;
 
 	private:
 		static int header_to_string( char *s );
-		int record_to_string( const char *record, char *s ) const;
+		int print_bars( const char* header, int h_size, const ms_bar *bars,
+			long long cnt ) const;
+		int write_bars( const char* header, int h_size, const ms_bar *bars,
+			long long cnt, const double *volumes ) const;
+		int format_line( const char* header, int h_size, const ms_bar *bar,
+			char *s, const double *volume ) const;
+		template <bool FILTER>
+		bool decode_bar( const char *record, ms_bar *bar ) const;
+		template <bool JSON>
+		int format_bar( const ms_bar *bar, char *s,
+			const double *volume ) const;
 
 		static void *out;
 		static char print_sep;
 		static unsigned int print_bitset;
 		static int print_date_from;
-		static ftoa_func prc_ftoa;
+		static ftoa_func ope_ftoa;
+		static ftoa_func hig_ftoa;
+		static ftoa_func low_ftoa;
+		static ftoa_func clo_ftoa;
 		static ftoa_func vol_ftoa;
 		static ftoa_func opi_ftoa;
+		static dtoa_func vol_dtoa;
+		static unsigned int auto_prec_fields;
+		static tstoa_func tst_func;
+		static bool tst_quoted;
+		static output_format out_fmt;
+		static ColWriter *col_writer;
+		static const Where *where;
+		static resample_unit rs_unit;
+		static int rs_minutes;
 
 		const unsigned char field_bitset;
 		const int record_length;
 
 		const char * const buf;
-		const int size;
+		const long long size;
+
+		/* the period aggregated by --resample */
+		mutable bool rs_pending;
+		mutable long long rs_key;
+		mutable ms_bar rs_bar;
+		mutable double rs_volume;
 };
 
 
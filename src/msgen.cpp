@@ -0,0 +1,729 @@
+/*** msgen.cpp -- generate synthetic metastock directories
+ *
+ * Copyright (C) 2010-2016 Ruediger Meier
+ *
+ * Author:  Ruediger Meier <sweet_f_a@gmx.de>
+ *
+ * This file is part of atem.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of any contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ***/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "ms_file.h"
+#include "util.h"
+#include "boobs.h"
+#include "config.h"
+
+
+#define MAX_SYMBOLS 65535
+/* the dat header stores count + 1 as uint16 */
+#define MAX_BARS 65534
+#define MAX_PATH_LEN 1024
+/* records buffered before writing */
+#define WRITE_RECS 4096
+
+#define MASTER_REC_LEN 53
+#define EMASTER_REC_LEN 192
+#define XMASTER_REC_LEN 150
+/* files 1 - 255 are listed in MASTER/EMASTER, higher ones in XMASTER */
+#define MAX_MASTER_FILES 255
+
+enum defect {
+	DF_TRUNCATED = 01,
+	DF_BADCOUNT = 02,
+	DF_MISSING = 04,
+	DF_ORPHAN = 010,
+	DF_UNSORTED = 020,
+	DF_NOEMASTER = 040,
+	DF_NOXMASTER = 0100,
+	DF_STALE = 0200
+};
+
+static const struct {
+	const char *name;
+	int flag;
+} defect_names[] = {
+	{ "truncated", DF_TRUNCATED },
+	{ "badcount", DF_BADCOUNT },
+	{ "missing", DF_MISSING },
+	{ "orphan", DF_ORPHAN },
+	{ "unsorted", DF_UNSORTED },
+	{ "noemaster", DF_NOEMASTER },
+	{ "noxmaster", DF_NOXMASTER },
+	{ "stale", DF_STALE },
+	{ NULL, 0 }
+};
+
+
+struct gen_opts
+{
+	const char *dir;
+	int symbols;
+	int bars;
+	int fields; /* 0 means cycle through all layouts */
+	int interval; /* minutes per intraday bar, 0 means daily */
+	unsigned long seed;
+	int date_from;
+	int defects;
+};
+
+/* per file description, also used to write the master records */
+struct gen_file
+{
+	int number;
+	unsigned char field_bitset;
+	int cnt_fields;
+	char symbol[MAX_LEN_MR_SYMBOL + 1];
+	char name[MAX_LEN_MR_LNAME + 1];
+	int from_date;
+	int to_date;
+	int from_time;
+	int to_time;
+};
+
+
+
+static uint64_t rnd_state;
+
+/* xorshift64*, same sequence on every platform */
+static uint32_t rnd()
+{
+	rnd_state ^= rnd_state >> 12;
+	rnd_state ^= rnd_state << 25;
+	rnd_state ^= rnd_state >> 27;
+	return (uint32_t)((rnd_state * 2685821657736338717ULL) >> 32);
+}
+
+static uint32_t rnd_range( uint32_t n )
+{
+	return rnd() % n;
+}
+
+
+static void put_uint16( char *dst, uint16_t v )
+{
+	v = htole16( v );
+	memcpy( dst, &v, 2 );
+}
+
+static void put_int32( char *dst, int32_t v )
+{
+	uint32_t u = htole32( (uint32_t) v );
+	memcpy( dst, &u, 4 );
+}
+
+static void put_float_ieee( char *dst, float f )
+{
+	union {
+		uint32_t L;
+		float F;
+	} x;
+	x.F = f;
+	put_int32( dst, x.L );
+}
+
+/**
+ * inverse of readFloat() in ms_file.cpp, IEEE float to MBF
+ */
+static void put_float_mbf( char *dst, float f )
+{
+	union {
+		uint32_t L;
+		float F;
+	} x;
+	x.F = f;
+
+	uint32_t mbf = 0;
+	if( (x.L & 0x7fffffff) != 0 ) {
+		uint32_t s = (x.L >> 8) & 0x00800000;
+		uint32_t e = ((x.L >> 23) & 0xff) + 2;
+		mbf = (e << 24) | s | (x.L & 0x007fffff);
+	}
+	put_int32( dst, mbf );
+}
+
+/* copy without terminating zero, pad with c */
+static void put_string( char *dst, const char *src, int len, char pad )
+{
+	int l = strlen( src );
+	if( l > len ) {
+		l = len;
+	}
+	memcpy( dst, src, l );
+	memset( dst + l, pad, len - l );
+}
+
+
+static bool is_leap( int y )
+{
+	return (y % 4 == 0 && (y % 100 != 0 || y % 400 == 0));
+}
+
+/**
+ * next week day after date (YYYYMMDD)
+ */
+static int next_weekday( int date, int *wday )
+{
+	static const int mdays[] = {31,28,31,30,31,30,31,31,30,31,30,31};
+	int y = date / 10000;
+	int m = date / 100 % 100;
+	int d = date % 100;
+	do {
+		if( ++d > mdays[m - 1] + (m == 2 && is_leap(y)) ) {
+			d = 1;
+			if( ++m > 12 ) {
+				m = 1;
+				y++;
+			}
+		}
+		*wday = (*wday + 1) % 7;
+	} while( *wday == 0 || *wday == 6 );
+	return y * 10000 + m * 100 + d;
+}
+
+/**
+ * day of week, 0 is sunday (Sakamoto's method)
+ */
+static int weekday( int date )
+{
+	static const int t[] = {0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4};
+	int y = date / 10000;
+	int m = date / 100 % 100;
+	int d = date % 100;
+	if( m < 3 ) {
+		y--;
+	}
+	return (y + y/4 - y/100 + y/400 + t[m - 1] + d) % 7;
+}
+
+
+/**
+ * Field layouts must be describable by MASTER, which only knows the field
+ * count: date,high,low,close,volume[,open[,openint]] plus time for intraday.
+ */
+static unsigned char layout_bitset( int cnt_fields, bool intraday )
+{
+	unsigned char bitset = 0;
+	if( intraday ) {
+		bitset |= D_TIM;
+		cnt_fields--;
+	}
+	return bitset | ((unsigned char)0xff >> (8 - cnt_fields));
+}
+
+
+static bool write_file( const char *dir, const char *name, const char *buf,
+	size_t len )
+{
+	char path[MAX_PATH_LEN];
+	snprintf( path, sizeof(path), "%s/%s", dir, name );
+	FILE *f = fopen( path, "wb" );
+	if( f == NULL ) {
+		fprintf( stderr, "error: %s: %s\n", path, strerror(errno) );
+		return false;
+	}
+	bool ok = fwrite( buf, 1, len, f ) == len;
+	if( fclose( f ) != 0 ) {
+		ok = false;
+	}
+	if( !ok ) {
+		fprintf( stderr, "error: %s: %s\n", path, strerror(errno) );
+	}
+	return ok;
+}
+
+
+static void dat_name( char *dst, size_t size, int number )
+{
+	snprintf( dst, size, "F%d.%s", number,
+		(number > MAX_MASTER_FILES) ? "MWD" : "DAT" );
+}
+
+
+/**
+ * Write one dat file with a random walk of prices in cents, so the values
+ * are exact and identical on every platform. Fills in the date range.
+ */
+static bool write_dat( const gen_opts *o, gen_file *gf, int defects )
+{
+	char name[MAX_LEN_MR_FILENAME + 1];
+	char path[MAX_PATH_LEN];
+	dat_name( name, sizeof(name), gf->number );
+	snprintf( path, sizeof(path), "%s/%s", o->dir, name );
+
+	FILE *f = fopen( path, "wb" );
+	if( f == NULL ) {
+		fprintf( stderr, "error: %s: %s\n", path, strerror(errno) );
+		return false;
+	}
+
+	const int rec_len = gf->cnt_fields * 4;
+	char *buf = (char*) calloc( WRITE_RECS, rec_len );
+	bool ok = true;
+
+	/* header record */
+	int cnt = o->bars;
+	put_uint16( buf + 2, (defects & DF_BADCOUNT) ? cnt + 2 : cnt + 1 );
+	ok = fwrite( buf, 1, rec_len, f ) == (size_t) rec_len;
+
+	int date = o->date_from;
+	int wday = weekday( date );
+	if( wday == 0 || wday == 6 ) {
+		date = next_weekday( date, &wday );
+	}
+	const int day_open = 9 * 60 + 30;
+	const int day_close = 16 * 60;
+	int minute = day_open;
+
+	long price = 100 + rnd_range( 100000 );
+	long openint = rnd_range( 100000 );
+	gf->from_date = gf->to_date = date;
+	gf->from_time = gf->to_time = (o->interval > 0) ? 93000 : 0;
+
+	int r = 0;
+	while( ok && r < cnt ) {
+		int n = (cnt - r < WRITE_RECS) ? cnt - r : WRITE_RECS;
+		for( int i = 0; i < n; i++, r++ ) {
+			char *rec = buf + i * rec_len;
+			int time = 0;
+			if( o->interval > 0 ) {
+				time = (minute / 60) * 10000 + (minute % 60) * 100;
+			}
+			gf->to_date = date;
+			gf->to_time = time;
+
+			long open = price;
+			long move = (long) rnd_range( 2 * (price / 50 + 1) + 1 )
+				- (price / 50 + 1);
+			price = (open + move > 1) ? open + move : 1;
+			long high = ((open > price) ? open : price)
+				+ rnd_range( price / 100 + 1 );
+			long low = ((open < price) ? open : price)
+				- rnd_range( price / 100 + 1 );
+			if( low < 1 ) {
+				low = 1;
+			}
+			long volume = rnd_range( 1000 ) * (1 + rnd_range( 10000 ));
+			openint += (long) rnd_range( 201 ) - 100;
+			if( openint < 0 ) {
+				openint = 0;
+			}
+
+			/* same order as FDat::record_to_string() reads them */
+			int off = 0;
+			put_float_mbf( rec + off, date - 19000000 );
+			off += 4;
+			if( gf->field_bitset & D_TIM ) {
+				put_float_mbf( rec + off, time );
+				off += 4;
+			}
+			if( gf->field_bitset & D_OPE ) {
+				put_float_mbf( rec + off, open / 100.0f );
+				off += 4;
+			}
+			put_float_mbf( rec + off, high / 100.0f );
+			put_float_mbf( rec + off + 4, low / 100.0f );
+			put_float_mbf( rec + off + 8, price / 100.0f );
+			put_float_mbf( rec + off + 12, volume );
+			off += 16;
+			if( gf->field_bitset & D_OPI ) {
+				put_float_mbf( rec + off, openint );
+			}
+
+			if( o->interval > 0 ) {
+				minute += o->interval;
+				if( minute >= day_close ) {
+					minute = day_open;
+					date = next_weekday( date, &wday );
+				}
+			} else {
+				date = next_weekday( date, &wday );
+			}
+		}
+
+		if( (defects & DF_UNSORTED) && r == n && n > 1 ) {
+			/* swap first two records of the file */
+			char tmp[32];
+			memcpy( tmp, buf, rec_len );
+			memcpy( buf, buf + rec_len, rec_len );
+			memcpy( buf + rec_len, tmp, rec_len );
+		}
+
+		size_t len = (size_t) n * rec_len;
+		if( (defects & DF_TRUNCATED) && r == cnt ) {
+			/* cut the last record in half */
+			len -= rec_len / 2;
+		}
+		ok = fwrite( buf, 1, len, f ) == len;
+	}
+
+	free( buf );
+	if( fclose( f ) != 0 ) {
+		ok = false;
+	}
+	if( !ok ) {
+		fprintf( stderr, "error: %s: %s\n", path, strerror(errno) );
+	}
+	if( defects & DF_MISSING ) {
+		remove( path );
+	}
+	if( defects & DF_STALE ) {
+		/* master record not updated since the first bar */
+		gf->to_date = gf->from_date;
+		gf->to_time = gf->from_time;
+	}
+	return ok;
+}
+
+
+static bool write_master( const gen_opts *o, const gen_file *files, int cnt )
+{
+	size_t len = (size_t)(cnt + 1) * MASTER_REC_LEN;
+	char *buf = (char*) calloc( 1, len );
+
+	buf[0] = cnt;
+	buf[2] = cnt;
+	for( int i = 0; i < cnt; i++ ) {
+		const gen_file *gf = &files[i];
+		char *rec = buf + (i + 1) * MASTER_REC_LEN;
+		rec[0] = gf->number;
+		put_uint16( rec + 1, 101 );
+		rec[3] = gf->cnt_fields * 4;
+		rec[4] = gf->cnt_fields;
+		put_string( rec + 7, gf->name, 16, ' ' );
+		put_float_mbf( rec + 25, gf->from_date - 19000000 );
+		put_float_mbf( rec + 29, gf->to_date - 19000000 );
+		rec[33] = (o->interval > 0) ? 'I' : 'D';
+		put_uint16( rec + 34, o->interval );
+		put_string( rec + 36, gf->symbol, 14, ' ' );
+		rec[50] = ' ';
+		rec[51] = ' ';
+	}
+
+	bool ok = write_file( o->dir, "MASTER", buf, len );
+	free( buf );
+	return ok;
+}
+
+
+static bool write_emaster( const gen_opts *o, const gen_file *files, int cnt )
+{
+	size_t len = (size_t)(cnt + 1) * EMASTER_REC_LEN;
+	char *buf = (char*) calloc( 1, len );
+
+	buf[0] = cnt;
+	buf[2] = cnt;
+	put_string( buf + 53, "atem msgen", 10, '\0' );
+	for( int i = 0; i < cnt; i++ ) {
+		const gen_file *gf = &files[i];
+		char *rec = buf + (i + 1) * EMASTER_REC_LEN;
+		put_uint16( rec, 0x3636 );
+		rec[2] = gf->number;
+		rec[6] = gf->cnt_fields;
+		rec[7] = gf->field_bitset;
+		rec[9] = ' ';
+		put_string( rec + 11, gf->symbol, 14, '\0' );
+		put_string( rec + 32, gf->name, 15, '\0' );
+		rec[60] = (o->interval > 0) ? 'I' : 'D';
+		put_uint16( rec + 62, o->interval );
+		put_float_ieee( rec + 64, gf->from_date - 19000000 );
+		put_float_ieee( rec + 68, gf->from_time );
+		put_float_ieee( rec + 72, gf->to_date - 19000000 );
+		put_float_ieee( rec + 76, gf->to_time );
+		put_int32( rec + 126, gf->from_date );
+		put_string( rec + 139, gf->name, 51, '\0' );
+	}
+
+	bool ok = write_file( o->dir, "EMASTER", buf, len );
+	free( buf );
+	return ok;
+}
+
+
+static bool write_xmaster( const gen_opts *o, const gen_file *files, int cnt )
+{
+	size_t len = (size_t)(cnt + 1) * XMASTER_REC_LEN;
+	char *buf = (char*) calloc( 1, len );
+
+	buf[0] = '\x5d';
+	buf[1] = '\xfe';
+	buf[2] = 'X';
+	buf[3] = 'M';
+	put_uint16( buf + 10, cnt );
+	put_uint16( buf + 14, cnt );
+	put_uint16( buf + 18, files[cnt - 1].number + 1 );
+	put_string( buf + 22, "atem msgen", 10, '\0' );
+	for( int i = 0; i < cnt; i++ ) {
+		const gen_file *gf = &files[i];
+		char *rec = buf + (i + 1) * XMASTER_REC_LEN;
+		rec[0] = '\x01';
+		put_string( rec + 1, gf->symbol, 14, '\0' );
+		put_string( rec + 16, gf->name, 45, '\0' );
+		rec[62] = (o->interval > 0) ? 'I' : 'D';
+		put_uint16( rec + 63, o->interval );
+		put_uint16( rec + 65, gf->number );
+		rec[70] = gf->field_bitset;
+		put_int32( rec + 80, gf->from_date );
+		put_int32( rec + 104, gf->to_date );
+		put_int32( rec + 108, gf->from_date );
+		put_int32( rec + 116, gf->to_date );
+	}
+
+	bool ok = write_file( o->dir, "XMASTER", buf, len );
+	free( buf );
+	return ok;
+}
+
+
+static bool generate( const gen_opts *o )
+{
+	if( mkdir( o->dir
+#if ! defined _WIN32
+		, 0777
+#endif
+		) != 0 && errno != EEXIST ) {
+		fprintf( stderr, "error: %s: %s\n", o->dir, strerror(errno) );
+		return false;
+	}
+
+	const bool intraday = o->interval > 0;
+	gen_file *files = (gen_file*) calloc( o->symbols, sizeof(gen_file) );
+
+	/* each defect hits one file chosen by the seed */
+	int defect_file[8];
+	for( int d = 0; d < 8; d++ ) {
+		defect_file[d] = 1 + rnd_range( o->symbols );
+	}
+
+	bool ok = true;
+	for( int i = 0; ok && i < o->symbols; i++ ) {
+		gen_file *gf = &files[i];
+		gf->number = i + 1;
+
+		gf->cnt_fields = o->fields;
+		if( gf->cnt_fields == 0 ) {
+			/* daily 5 - 7, intraday 5 - 8 fields */
+			gf->cnt_fields = 5 + i % (intraday ? 4 : 3);
+		}
+		gf->field_bitset = layout_bitset( gf->cnt_fields, intraday );
+		snprintf( gf->symbol, sizeof(gf->symbol), "SYN%05d", gf->number );
+		snprintf( gf->name, sizeof(gf->name), "Synthetic %d Inc", gf->number );
+
+		int defects = 0;
+		for( int d = 0; defect_names[d].name != NULL; d++ ) {
+			if( (o->defects & defect_names[d].flag)
+			    && defect_file[d] == gf->number ) {
+				defects |= defect_names[d].flag;
+			}
+		}
+		ok = write_dat( o, gf, defects );
+	}
+
+	int cnt_m = (o->symbols < MAX_MASTER_FILES) ? o->symbols : MAX_MASTER_FILES;
+	if( ok ) {
+		ok = write_master( o, files, cnt_m );
+	}
+	if( ok && !(o->defects & DF_NOEMASTER) ) {
+		ok = write_emaster( o, files, cnt_m );
+	}
+	if( ok && o->symbols > MAX_MASTER_FILES && !(o->defects & DF_NOXMASTER) ) {
+		ok = write_xmaster( o, files + MAX_MASTER_FILES,
+			o->symbols - MAX_MASTER_FILES );
+	}
+	if( ok && (o->defects & DF_ORPHAN) ) {
+		/* a dat file which is not referenced by any master file */
+		gen_file orphan = files[0];
+		orphan.number = (o->symbols < MAX_SYMBOLS) ? o->symbols + 1 : 1;
+		if( orphan.number != 1 ) {
+			ok = write_dat( o, &orphan, 0 );
+		}
+	}
+
+	free( files );
+	return ok;
+}
+
+
+static bool parse_defects( const char *list, int *defects )
+{
+	char *s = strdup( list );
+	char *saveptr = NULL;
+	bool ok = true;
+	for( char *t = strtok_r( s, ",", &saveptr ); t != NULL;
+	     t = strtok_r( NULL, ",", &saveptr ) ) {
+		int d = 0;
+		while( defect_names[d].name != NULL
+		       && strcmp( defect_names[d].name, t ) != 0 ) {
+			d++;
+		}
+		if( defect_names[d].name == NULL ) {
+			fprintf( stderr, "error: unknown defect: %s\n", t );
+			ok = false;
+			break;
+		}
+		*defects |= defect_names[d].flag;
+	}
+	free( s );
+	return ok;
+}
+
+
+static bool parse_int( const char *s, long min, long max, long *dst )
+{
+	char *end;
+	errno = 0;
+	long v = strtol( s, &end, 10 );
+	if( errno != 0 || *s == '\0' || *end != '\0' || v < min || v > max ) {
+		return false;
+	}
+	*dst = v;
+	return true;
+}
+
+
+static void usage( FILE *f )
+{
+	fprintf( f,
+"Usage: msgen [OPTION]... DIR\n"
+"Write a synthetic metastock directory (MASTER, EMASTER, XMASTER and data\n"
+"files) to DIR. The output only depends on the options.\n"
+"\n"
+"  -n, --symbols=N      number of data files 1-65535, default 10\n"
+"  -b, --bars=N         records per data file 1-65534, default 1000\n"
+"  -f, --fields=N       fields per record 5-8 (8 needs --intraday) or 0 to\n"
+"                       cycle through all layouts, default 7\n"
+"  -i, --intraday=MIN   intraday bars of MIN minutes instead of daily bars\n"
+"  -d, --date-from=DATE first date (YYYYMMDD), default 19900102\n"
+"  -s, --seed=N         random seed, default 1\n"
+"  -D, --defects=LIST   comma separated defects, each one hits one data\n"
+"                       file: truncated, badcount, missing, orphan, unsorted,\n"
+"                       noemaster, noxmaster, stale\n"
+"  -h, --help           show this help message\n" );
+}
+
+
+int main( int argc, char *argv[] )
+{
+	gen_opts o;
+	o.dir = NULL;
+	o.symbols = 10;
+	o.bars = 1000;
+	o.fields = 7;
+	o.interval = 0;
+	o.seed = 1;
+	o.date_from = 19900102;
+	o.defects = 0;
+
+	static const struct option long_opts[] = {
+		{ "symbols", required_argument, NULL, 'n' },
+		{ "bars", required_argument, NULL, 'b' },
+		{ "fields", required_argument, NULL, 'f' },
+		{ "intraday", required_argument, NULL, 'i' },
+		{ "date-from", required_argument, NULL, 'd' },
+		{ "seed", required_argument, NULL, 's' },
+		{ "defects", required_argument, NULL, 'D' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	int c;
+	long v;
+	bool ok = true;
+	while( ok && (c = getopt_long( argc, argv, "n:b:f:i:d:s:D:h",
+			long_opts, NULL )) != -1 ) {
+		switch( c ) {
+		case 'n':
+			ok = parse_int( optarg, 1, MAX_SYMBOLS, &v );
+			o.symbols = v;
+			break;
+		case 'b':
+			ok = parse_int( optarg, 1, MAX_BARS, &v );
+			o.bars = v;
+			break;
+		case 'f':
+			ok = parse_int( optarg, 0, 8, &v ) && (v == 0 || v >= 5);
+			o.fields = v;
+			break;
+		case 'i':
+			ok = parse_int( optarg, 1, 60, &v );
+			o.interval = v;
+			break;
+		case 'd':
+			ok = parse_int( optarg, 19000101, 20991231, &v )
+				&& v / 100 % 100 >= 1 && v / 100 % 100 <= 12
+				&& v % 100 >= 1 && v % 100 <= 28;
+			o.date_from = v;
+			break;
+		case 's':
+			ok = parse_int( optarg, 0, 0x7fffffffL, &v );
+			o.seed = v;
+			break;
+		case 'D':
+			ok = parse_defects( optarg, &o.defects );
+			break;
+		case 'h':
+			usage( stdout );
+			return 0;
+		default:
+			ok = false;
+		}
+		if( !ok && c != 'D' && c != '?' ) {
+			fprintf( stderr, "error: bad argument for -%c: %s\n", c, optarg );
+		}
+	}
+
+	if( ok && o.fields == 8 && o.interval == 0 ) {
+		fprintf( stderr, "error: 8 fields need --intraday\n" );
+		ok = false;
+	}
+	if( ok && optind + 1 != argc ) {
+		fprintf( stderr, "error: bad usage\n" );
+		ok = false;
+	}
+	if( !ok ) {
+		usage( stderr );
+		return 2;
+	}
+	o.dir = argv[optind];
+
+	/* never start xorshift with zero */
+	rnd_state = 0x9e3779b97f4a7c15ULL ^ o.seed;
+
+	return generate( &o ) ? 0 : 1;
+}
@@ -0,0 +1,575 @@
+/*** stats.cpp -- run time statistics and trace events
+ *
+ * Copyright (C) 2010-2016 Ruediger Meier
+ *
+ * Author:  Ruediger Meier <sweet_f_a@gmx.de>
+ *
+ * This file is part of atem.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of any contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ***/
+
+
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if ! defined _WIN32
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+#include "config.h"
+
+#if defined HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+
+
+ST_THREAD_LOCAL long long stats_counters[SC_COUNTER_COUNT];
+
+/* counters of finished worker threads */
+static long long worker_counters[SC_COUNTER_COUNT];
+#if defined HAVE_PTHREAD_H
+/* guards worker_counters, the thread list and the slowest files */
+static pthread_mutex_t worker_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+#define MAX_LEN_ST_NAME 31
+
+struct st_file
+{
+	int number;
+	char name[MAX_LEN_ST_NAME + 1];
+	char symbol[MAX_LEN_ST_NAME + 1];
+};
+
+struct st_slow_file
+{
+	double wall;
+	long long bytes;
+	long long records;
+	st_file file;
+};
+
+/* one complete trace event, phase ST_PHASE_COUNT is the whole file span */
+struct st_event
+{
+	int phase;
+	int file;
+	double ts;
+	double dur;
+	long long bytes_read;
+	long long bytes_written;
+};
+
+/* timings are taken when either --stats or --trace is given */
+static bool enabled = false;
+static bool stats_on = false;
+
+static double run_wall;
+static double run_cpu;
+
+/* phase timings of the main thread */
+static double phase_wall[ST_PHASE_COUNT];
+static double phase_cpu[ST_PHASE_COUNT];
+
+/* State of one thread. Trace events are buffered per thread and written
+   at exit, events refer to the thread's files. */
+struct st_thread
+{
+	int tid;
+	st_thread *next;
+
+	double phase_wall_start[ST_PHASE_COUNT];
+	double phase_cpu_start[ST_PHASE_COUNT];
+	long long phase_read_start[ST_PHASE_COUNT];
+	long long phase_written_start[ST_PHASE_COUNT];
+
+	st_file cur_file;
+	bool in_file;
+	double file_wall_start;
+	long long file_read_start;
+	long long file_written_start;
+	long long file_records_start;
+
+	st_event *events;
+	int events_len;
+	int events_size;
+	st_file *files;
+	int files_len;
+	int files_size;
+};
+
+/* all threads which took timings, the main thread (tid 1) first */
+static st_thread main_thread;
+static st_thread *last_thread = &main_thread;
+static ST_THREAD_LOCAL st_thread *self = NULL;
+
+/* the slowest files, sorted descending by wall time */
+static st_slow_file *slowest_files = NULL;
+static int slowest_len = 0;
+static int slowest_size = 0;
+
+static FILE *trace_out = NULL;
+
+
+static inline void lock()
+{
+#if defined HAVE_PTHREAD_H
+	pthread_mutex_lock( &worker_lock );
+#endif
+}
+
+static inline void unlock()
+{
+#if defined HAVE_PTHREAD_H
+	pthread_mutex_unlock( &worker_lock );
+#endif
+}
+
+
+static const char *phase_names[ST_PHASE_COUNT] = {
+	"find_files",
+	"read_masters",
+	"parse_masters",
+	"open_data",
+	"read_data",
+	"decode",
+	"format",
+	"write"
+};
+
+
+static double wall_time()
+{
+#if defined CLOCK_MONOTONIC
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+	struct timeval tv;
+	gettimeofday( &tv, NULL );
+	return tv.tv_sec + tv.tv_usec / 1e6;
+#endif
+}
+
+static double cpu_time()
+{
+#if defined CLOCK_PROCESS_CPUTIME_ID
+	struct timespec ts;
+	clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+	return (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/**
+ * return peak resident set size in KiB or -1 if unknown
+ */
+static long peak_rss()
+{
+#if ! defined _WIN32
+	struct rusage ru;
+	if( getrusage( RUSAGE_SELF, &ru ) != 0 ) {
+		return -1;
+	}
+#if defined __APPLE__
+	return ru.ru_maxrss / 1024;
+#else
+	return ru.ru_maxrss;
+#endif
+#else
+	return -1;
+#endif
+}
+
+
+static void enable()
+{
+	if( !enabled ) {
+		enabled = true;
+		main_thread.tid = 1;
+		self = &main_thread;
+		run_wall = wall_time();
+		run_cpu = cpu_time();
+	}
+}
+
+/**
+ * the calling thread's state, worker threads get theirs on first use
+ */
+static st_thread* this_thread()
+{
+	if( self == NULL ) {
+		self = (st_thread*) calloc( 1, sizeof(st_thread) );
+		lock();
+		self->tid = last_thread->tid + 1;
+		last_thread->next = self;
+		last_thread = self;
+		unlock();
+	}
+	return self;
+}
+
+/**
+ * start collecting timings, keep track of the given number of slowest files
+ */
+void stats_init( int slowest )
+{
+	enable();
+	stats_on = true;
+
+	if( slowest > 0 ) {
+		slowest_files =
+			(st_slow_file*) malloc( slowest * sizeof(st_slow_file) );
+		slowest_size = slowest;
+	}
+}
+
+
+/**
+ * start recording trace events to be written to file at exit, returns false
+ * with errno set if file can't be opened
+ */
+bool trace_init( const char *file )
+{
+	trace_out = fopen( file, "wb" );
+	if( trace_out == NULL ) {
+		return false;
+	}
+	enable();
+	return true;
+}
+
+
+static void add_event( st_thread *t, int phase, double start, double end,
+	long long bytes_read, long long bytes_written )
+{
+	if( t->events_len == t->events_size ) {
+		t->events_size = (t->events_size > 0) ? 2 * t->events_size : 1024;
+		t->events = (st_event*) realloc( t->events,
+			t->events_size * sizeof(st_event) );
+	}
+	st_event *ev = &t->events[t->events_len++];
+	ev->phase = phase;
+	ev->file = t->in_file ? t->files_len - 1 : -1;
+	ev->ts = start - run_wall;
+	ev->dur = end - start;
+	ev->bytes_read = bytes_read;
+	ev->bytes_written = bytes_written;
+}
+
+
+/**
+ * Phases of worker threads are traced, but only the main thread's ones are
+ * summed up by --stats. It waits for the workers within a phase.
+ */
+void stats_phase_begin( st_phase p )
+{
+	if( !enabled ) {
+		return;
+	}
+	st_thread *t = this_thread();
+	t->phase_wall_start[p] = wall_time();
+	if( t == &main_thread ) {
+		t->phase_cpu_start[p] = cpu_time();
+	}
+	t->phase_read_start[p] = stats_counters[SC_BYTES_READ];
+	t->phase_written_start[p] = stats_counters[SC_BYTES_WRITTEN];
+}
+
+
+void stats_phase_end( st_phase p )
+{
+	if( !enabled ) {
+		return;
+	}
+	st_thread *t = this_thread();
+	double wall = wall_time();
+	if( t == &main_thread ) {
+		phase_wall[p] += wall - t->phase_wall_start[p];
+		phase_cpu[p] += cpu_time() - t->phase_cpu_start[p];
+	}
+
+	if( trace_out != NULL ) {
+		add_event( t, p, t->phase_wall_start[p], wall,
+			stats_counters[SC_BYTES_READ] - t->phase_read_start[p],
+			stats_counters[SC_BYTES_WRITTEN] - t->phase_written_start[p] );
+	}
+}
+
+
+static void copy_name( char *dst, const char *src )
+{
+	strncpy( dst, src, MAX_LEN_ST_NAME );
+	dst[MAX_LEN_ST_NAME] = '\0';
+}
+
+/**
+ * following phases of the calling thread belong to this data file until
+ * stats_file_end()
+ */
+void stats_file_begin( int number, const char *name, const char *symbol )
+{
+	if( !enabled ) {
+		return;
+	}
+	st_thread *t = this_thread();
+	t->in_file = true;
+	t->cur_file.number = number;
+	copy_name( t->cur_file.name, name );
+	copy_name( t->cur_file.symbol, symbol );
+
+	if( trace_out != NULL ) {
+		if( t->files_len == t->files_size ) {
+			t->files_size = (t->files_size > 0) ? 2 * t->files_size : 256;
+			t->files = (st_file*) realloc( t->files,
+				t->files_size * sizeof(st_file) );
+		}
+		t->files[t->files_len++] = t->cur_file;
+	}
+
+	t->file_wall_start = wall_time();
+	t->file_read_start = stats_counters[SC_BYTES_READ];
+	t->file_written_start = stats_counters[SC_BYTES_WRITTEN];
+	t->file_records_start = stats_counters[SC_RECORDS_DECODED];
+}
+
+
+static void add_slow_file( const st_thread *t, double wall )
+{
+	int i = slowest_len;
+	if( i == slowest_size ) {
+		if( wall <= slowest_files[i - 1].wall ) {
+			return;
+		}
+		i--;
+	} else {
+		slowest_len++;
+	}
+	for( ; i > 0 && slowest_files[i - 1].wall < wall; i-- ) {
+		slowest_files[i] = slowest_files[i - 1];
+	}
+
+	st_slow_file *sf = &slowest_files[i];
+	sf->wall = wall;
+	sf->bytes = stats_counters[SC_BYTES_READ] - t->file_read_start;
+	sf->records = stats_counters[SC_RECORDS_DECODED] - t->file_records_start;
+	sf->file = t->cur_file;
+}
+
+void stats_file_end()
+{
+	if( !enabled ) {
+		return;
+	}
+	st_thread *t = this_thread();
+	double wall = wall_time();
+
+	if( slowest_size > 0 ) {
+		lock();
+		add_slow_file( t, wall - t->file_wall_start );
+		unlock();
+	}
+	if( trace_out != NULL ) {
+		add_event( t, ST_PHASE_COUNT, t->file_wall_start, wall,
+			stats_counters[SC_BYTES_READ] - t->file_read_start,
+			stats_counters[SC_BYTES_WRITTEN] - t->file_written_start );
+	}
+	t->in_file = false;
+}
+
+
+static void print_json_string( FILE *f, const char *s )
+{
+	fputc( '"', f );
+	for( ; *s != '\0'; s++ ) {
+		unsigned char c = *s;
+		if( c == '"' || c == '\\' ) {
+			fputc( '\\', f );
+			fputc( c, f );
+		} else if( c < 0x20 ) {
+			fprintf( f, "\\u%04x", c );
+		} else {
+			fputc( c, f );
+		}
+	}
+	fputc( '"', f );
+}
+
+
+/**
+ * Add the counters of the calling worker thread to the totals, must be
+ * called before it exits. Phase timings are taken by the main thread only,
+ * it waits for the workers within a phase.
+ */
+void stats_thread_end()
+{
+	lock();
+	for( int i = 0; i < SC_COUNTER_COUNT; i++ ) {
+		worker_counters[i] += stats_counters[i];
+		stats_counters[i] = 0;
+	}
+	unlock();
+	/* its trace events are kept until trace_write() */
+	if( self != &main_thread ) {
+		self = NULL;
+	}
+}
+
+
+/**
+ * print all collected statistics as one JSON object, called by the main
+ * thread after all workers have finished
+ */
+void stats_print( FILE *f )
+{
+	if( !stats_on ) {
+		return;
+	}
+	long long c[SC_COUNTER_COUNT];
+	for( int i = 0; i < SC_COUNTER_COUNT; i++ ) {
+		c[i] = stats_counters[i] + worker_counters[i];
+	}
+
+	fprintf( f, "{\n" );
+	fprintf( f, "  \"wall_s\": %.6f,\n", wall_time() - run_wall );
+	fprintf( f, "  \"cpu_s\": %.6f,\n", cpu_time() - run_cpu );
+	fprintf( f, "  \"peak_rss_kb\": %ld,\n", peak_rss() );
+
+	fprintf( f, "  \"phases\": {\n" );
+	for( int p = 0; p < ST_PHASE_COUNT; p++ ) {
+		fprintf( f, "    \"%s\": {\"wall_s\": %.6f, \"cpu_s\": %.6f}%s\n",
+			phase_names[p], phase_wall[p], phase_cpu[p],
+			p + 1 < ST_PHASE_COUNT ? "," : "" );
+	}
+	fprintf( f, "  },\n" );
+
+	fprintf( f, "  \"bytes_read\": %lld,\n", c[SC_BYTES_READ] );
+	fprintf( f, "  \"bytes_written\": %lld,\n", c[SC_BYTES_WRITTEN] );
+	fprintf( f, "  \"files_read\": %lld,\n", c[SC_FILES_READ] );
+	fprintf( f, "  \"records\": {\"decoded\": %lld, \"filtered\": %lld, "
+		"\"printed\": %lld},\n", c[SC_RECORDS_DECODED],
+		c[SC_RECORDS_FILTERED], c[SC_RECORDS_PRINTED] );
+	fprintf( f, "  \"files_skipped\": {\"excluded\": %lld, \"missing\": %lld, "
+		"\"unusable\": %lld, \"pruned\": %lld},\n", c[SC_SKIP_EXCLUDED],
+		c[SC_SKIP_MISSING], c[SC_SKIP_UNUSABLE], c[SC_SKIP_PRUNED] );
+	fprintf( f, "  \"files_truncated\": %lld,\n", c[SC_TRUNCATED] );
+	fprintf( f, "  \"cache\": {\"hits\": %lld, \"misses\": %lld, "
+		"\"stored\": %lld},\n", c[SC_CACHE_HITS], c[SC_CACHE_MISSES],
+		c[SC_CACHE_STORED] );
+	fprintf( f, "  \"zone_maps\": {\"hits\": %lld, \"misses\": %lld, "
+		"\"stored\": %lld, \"blocks_pruned\": %lld},\n", c[SC_ZONES_HITS],
+		c[SC_ZONES_MISSES], c[SC_ZONES_STORED], c[SC_ZONES_PRUNED] );
+
+	fprintf( f, "  \"slowest_files\": [" );
+	for( int i = 0; i < slowest_len; i++ ) {
+		const st_slow_file *sf = &slowest_files[i];
+		fprintf( f, "%s\n    {\"file\": ", i > 0 ? "," : "" );
+		print_json_string( f, sf->file.name );
+		fprintf( f, ", \"symbol\": " );
+		print_json_string( f, sf->file.symbol );
+		fprintf( f, ", \"wall_s\": %.6f, \"bytes\": %lld, \"records\": %lld}",
+			sf->wall, sf->bytes, sf->records );
+	}
+	fprintf( f, "%s]\n", slowest_len > 0 ? "\n  " : "" );
+	fprintf( f, "}\n" );
+}
+
+
+/**
+ * Write all buffered events of all threads in Chrome's trace event format
+ * (complete events, timestamps in microseconds), loadable by
+ * chrome://tracing or Perfetto. Must be called after all worker threads
+ * have finished. Returns false with errno set on write errors.
+ */
+bool trace_write()
+{
+	if( trace_out == NULL ) {
+		return true;
+	}
+	FILE *f = trace_out;
+#if ! defined _WIN32
+	long pid = getpid();
+#else
+	long pid = 1;
+#endif
+
+	fprintf( f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n" );
+	fprintf( f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %ld, "
+		"\"tid\": 1, \"args\": {\"name\": \"atem\"}}", pid );
+	for( const st_thread *t = main_thread.next; t != NULL; t = t->next ) {
+		fprintf( f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", "
+			"\"pid\": %ld, \"tid\": %d, \"args\": {\"name\": \"worker %d\"}}",
+			pid, t->tid, t->tid - 1 );
+	}
+	for( const st_thread *t = &main_thread; t != NULL; t = t->next )
+	for( int i = 0; i < t->events_len; i++ ) {
+		const st_event *ev = &t->events[i];
+		const st_file *fi = (ev->file >= 0) ? &t->files[ev->file] : NULL;
+
+		fprintf( f, ",\n{\"name\": " );
+		if( ev->phase == ST_PHASE_COUNT ) {
+			print_json_string( f, fi->name );
+		} else {
+			print_json_string( f, phase_names[ev->phase] );
+		}
+		fprintf( f, ", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, "
+			"\"dur\": %.3f, \"pid\": %ld, \"tid\": %d, \"args\": {",
+			(ev->phase == ST_PHASE_COUNT) ? "file" : "stage",
+			ev->ts * 1e6, ev->dur * 1e6, pid, t->tid );
+		const char *sep = "";
+		if( fi != NULL ) {
+			fprintf( f, "\"file_number\": %d, \"symbol\": ", fi->number );
+			print_json_string( f, fi->symbol );
+			sep = ", ";
+		}
+		if( ev->bytes_read > 0 ) {
+			fprintf( f, "%s\"bytes_read\": %lld", sep, ev->bytes_read );
+			sep = ", ";
+		}
+		if( ev->bytes_written > 0 ) {
+			fprintf( f, "%s\"bytes_written\": %lld", sep, ev->bytes_written );
+		}
+		fprintf( f, "}}" );
+	}
+	fprintf( f, "\n]}\n" );
+
+	bool ok = !ferror( f );
+	if( fclose( f ) != 0 ) {
+		ok = false;
+	}
+	trace_out = NULL;
+	return ok;
+}
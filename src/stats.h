@@ -0,0 +1,105 @@
+/*** stats.h -- run time statistics and trace events
+ *
+ * Copyright (C) 2010-2016 Ruediger Meier
+ *
+ * Author:  Ruediger Meier <sweet_f_a@gmx.de>
+ *
+ * This file is part of atem.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of any contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ***/
+
+#ifndef ATEM_STATS_H
+#define ATEM_STATS_H
+
+#include <stdio.h>
+
+
+enum st_phase {
+	ST_FIND_FILES,
+	ST_READ_MASTERS,
+	ST_PARSE_MASTERS,
+	ST_OPEN_DATA,
+	ST_READ_DATA,
+	ST_DECODE,
+	ST_FORMAT,
+	ST_WRITE,
+	ST_PHASE_COUNT
+};
+
+enum st_counter {
+	SC_BYTES_READ,
+	SC_BYTES_WRITTEN,
+	SC_FILES_READ,
+	SC_RECORDS_DECODED,
+	SC_RECORDS_FILTERED,
+	SC_RECORDS_PRINTED,
+	SC_SKIP_EXCLUDED,
+	SC_SKIP_MISSING,
+	SC_SKIP_UNUSABLE,
+	SC_SKIP_PRUNED,
+	SC_TRUNCATED,
+	SC_CACHE_HITS,
+	SC_CACHE_MISSES,
+	SC_CACHE_STORED,
+	SC_ZONES_HITS,
+	SC_ZONES_MISSES,
+	SC_ZONES_STORED,
+	SC_ZONES_PRUNED,
+	SC_COUNTER_COUNT
+};
+
+/* worker threads count into their own copy, see stats_thread_end() */
+#if defined __GNUC__
+#define ST_THREAD_LOCAL __thread
+#else
+#define ST_THREAD_LOCAL
+#endif
+
+extern ST_THREAD_LOCAL long long stats_counters[SC_COUNTER_COUNT];
+
+/* counters are cheap and always maintained, in any thread */
+inline void stats_count( st_counter c, long long n )
+{
+	stats_counters[c] += n;
+}
+
+void stats_init( int slowest );
+bool trace_init( const char *file );
+void stats_phase_begin( st_phase p );
+void stats_phase_end( st_phase p );
+void stats_file_begin( int number, const char *name, const char *symbol );
+void stats_file_end();
+void stats_thread_end();
+void stats_print( FILE *f );
+bool trace_write();
+
+
+
+#endif
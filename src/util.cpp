@@ -37,18 +37,32 @@
 
 #include "util.h"
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
 
 #include "config.h"
 
+/* benchmarks build the sprintf variant regardless of configure */
+#if defined NO_FAST_PRINTING
+	#undef FAST_PRINTING
+#endif
+
 
 #if defined FAST_PRINTING
 	#define itoa_int32 itoa
 	#define itoa_int64 ltoa
 	#include "itoa.c"
 	#include "ftoa.c"
+
+static inline int int64toa( char *s, int64_t n )
+{
+	return itoa_int64( s, n );
+}
 #else
-	#include <stdio.h>
 
 int itoa( char *s, int n )
 {
@@ -59,6 +73,17 @@ int ltoa( char *s, long n )
 	return sprintf( s, "%ld", n );
 }
 
+template <int PRECISION>
+int ftoa_fixed( char *s, float f )
+{
+	return sprintf( s, "%.*f", PRECISION, f );
+}
+
+static inline int int64toa( char *s, int64_t n )
+{
+	return sprintf( s, "%lld", (long long) n );
+}
+
 int ftoa(char *s, float f )
 {
 	return sprintf( s, "%.5f", f );
@@ -71,6 +96,249 @@ int ftoa_prec_f0(char *s, float f )
 #endif
 
 
+static const ftoa_func ftoa_fixed_funcs[MAX_FTOA_PRECISION + 1] = {
+	ftoa_prec_f0,
+	ftoa_fixed<1>,
+	ftoa_fixed<2>,
+	ftoa_fixed<3>,
+	ftoa_fixed<4>,
+	ftoa,
+	ftoa_fixed<6>,
+	ftoa_fixed<7>,
+	ftoa_fixed<8>,
+	ftoa_fixed<9>
+};
+
+/**
+ * return the printing function for a fixed number of decimals
+ */
+ftoa_func ftoa_precision( int prec )
+{
+	assert( prec >= 0 && prec <= MAX_FTOA_PRECISION );
+	return ftoa_fixed_funcs[prec];
+}
+
+
+/**
+ * print x rounded to an integer, ties to even. Values beyond int64
+ * saturate, NaN is 0.
+ */
+static int dtoa_rounded( char *s, double x )
+{
+	double a = (x < 0) ? -x : x;
+	int64_t n;
+
+	if( !(a < 9223372036854775807.0) ) {
+		/* also NaN */
+		n = (x != x) ? 0 : 9223372036854775807LL;
+	} else {
+		/* exact for products of floats and sums of whole numbers */
+		double r = (a < 4503599627370496.0) ? floor( a + 0.5 ) : a;
+		if( r - a == 0.5 && fmod( r, 2.0 ) != 0.0 ) {
+			r -= 1.0;
+		}
+		n = (int64_t) r;
+	}
+	return int64toa( s, (x < 0) ? -n : n );
+}
+
+/**
+ * ftoa_scaled: print f * 10^SCALE rounded to an integer, like "%.<SCALE>f"
+ * would print it without the point. The product is exact in double for
+ * SCALE <= 9.
+ */
+template <int SCALE>
+int ftoa_scaled( char *s, float f )
+{
+	static const double p10[MAX_FTOA_PRECISION + 1] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+	return dtoa_rounded( s, (double)f * p10[SCALE] );
+}
+
+/**
+ * print a double rounded to an integer, like "%.0f" for values within int64
+ */
+int dtoa_prec_f0( char *s, double d )
+{
+	return dtoa_rounded( s, d );
+}
+
+static const ftoa_func ftoa_scaled_funcs[MAX_FTOA_PRECISION + 1] = {
+	ftoa_scaled<0>,
+	ftoa_scaled<1>,
+	ftoa_scaled<2>,
+	ftoa_scaled<3>,
+	ftoa_scaled<4>,
+	ftoa_scaled<5>,
+	ftoa_scaled<6>,
+	ftoa_scaled<7>,
+	ftoa_scaled<8>,
+	ftoa_scaled<9>
+};
+
+/**
+ * return the printing function for integers scaled by 10^scale
+ */
+ftoa_func ftoa_scale( int scale )
+{
+	assert( scale >= 0 && scale <= MAX_FTOA_PRECISION );
+	return ftoa_scaled_funcs[scale];
+}
+
+/* there is no printf equivalent, always use our own */
+#include "ftoa_shortest.c"
+
+
+/*
+ * The dtoa functions print doubles like their ftoa counterparts print
+ * floats. They are used for the volume sums of --resample which may not be
+ * exact as float, so they prefer exactness to speed.
+ */
+
+/**
+ * print a double with a fixed number of decimals, like "%.<PRECISION>f"
+ */
+template <int PRECISION>
+int dtoa_fixed( char *s, double d )
+{
+	return sprintf( s, "%.*f", PRECISION, d );
+}
+
+int dtoa( char *s, double d )
+{
+	return dtoa_fixed<5>( s, d );
+}
+
+static const dtoa_func dtoa_fixed_funcs[MAX_FTOA_PRECISION + 1] = {
+	dtoa_prec_f0,
+	dtoa_fixed<1>,
+	dtoa_fixed<2>,
+	dtoa_fixed<3>,
+	dtoa_fixed<4>,
+	dtoa,
+	dtoa_fixed<6>,
+	dtoa_fixed<7>,
+	dtoa_fixed<8>,
+	dtoa_fixed<9>
+};
+
+/**
+ * like ftoa_precision() for doubles
+ */
+dtoa_func dtoa_precision( int prec )
+{
+	assert( prec >= 0 && prec <= MAX_FTOA_PRECISION );
+	return dtoa_fixed_funcs[prec];
+}
+
+/**
+ * dtoa_scaled: print d * 10^SCALE rounded to an integer like ftoa_scaled.
+ * The product of a double is not exact, its rounding error decides only
+ * if the rounded product is a tie.
+ */
+template <int SCALE>
+int dtoa_scaled( char *s, double d )
+{
+	static const double p10[MAX_FTOA_PRECISION + 1] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+	double x = d * p10[SCALE];
+	double err = fma( d, p10[SCALE], -x );
+	if( err != 0.0 && x - floor( x ) == 0.5 ) {
+		x = nextafter( x, (err > 0) ? HUGE_VAL : -HUGE_VAL );
+	}
+	return dtoa_rounded( s, x );
+}
+
+static const dtoa_func dtoa_scaled_funcs[MAX_FTOA_PRECISION + 1] = {
+	dtoa_scaled<0>,
+	dtoa_scaled<1>,
+	dtoa_scaled<2>,
+	dtoa_scaled<3>,
+	dtoa_scaled<4>,
+	dtoa_scaled<5>,
+	dtoa_scaled<6>,
+	dtoa_scaled<7>,
+	dtoa_scaled<8>,
+	dtoa_scaled<9>
+};
+
+/**
+ * like ftoa_scale() for doubles
+ */
+dtoa_func dtoa_scale( int scale )
+{
+	assert( scale >= 0 && scale <= MAX_FTOA_PRECISION );
+	return dtoa_scaled_funcs[scale];
+}
+
+/**
+ * dtoa_shortest: print the shortest decimal which reads back (strtod) as
+ * the same double, in plain notation like ftoa_shortest. The digits are
+ * searched by "%.*e", at most 17 are needed.
+ */
+int dtoa_shortest( char *s, double d )
+{
+	char e[32];
+	int prec;
+
+	if( !isfinite( d ) ) {
+		return ftoa_shortest( s, (float)d );
+	}
+	for( prec = 0; prec < 16; prec++ ) {
+		snprintf( e, sizeof(e), "%.*e", prec, d );
+		if( strtod( e, NULL ) == d ) {
+			break;
+		}
+	}
+	if( prec == 16 ) {
+		snprintf( e, sizeof(e), "%.16e", d );
+	}
+
+	/* e is [-]D[.DDD]e<+|->XX, collect its digits without trailing zeros */
+	const char *c = e;
+	char *p = s;
+	if( *c == '-' ) {
+		*p++ = *c++;
+	}
+	char dig[18];
+	int n = 0;
+	for( ; *c != 'e'; c++ ) {
+		if( *c != '.' ) {
+			dig[n++] = *c;
+		}
+	}
+	while( n > 1 && dig[n - 1] == '0' ) {
+		n--;
+	}
+	const int exp10 = atoi( c + 1 ) - (n - 1);
+
+	if( dig[0] == '0' ) {
+		*p++ = '0';
+	} else if( exp10 >= 0 ) {
+		memcpy( p, dig, n );
+		p += n;
+		memset( p, '0', exp10 );
+		p += exp10;
+	} else if( n + exp10 > 0 ) {
+		/* point within the digits */
+		int int_len = n + exp10;
+		memcpy( p, dig, int_len );
+		p += int_len;
+		*p++ = '.';
+		memcpy( p, dig + int_len, -exp10 );
+		p += -exp10;
+	} else {
+		*p++ = '0';
+		*p++ = '.';
+		memset( p, '0', -exp10 - n );
+		p += -exp10 - n;
+		memcpy( p, dig, n );
+		p += n;
+	}
+	*p = '\0';
+	return p - s;
+}
+
 
 
 int itodatestr( char *s, unsigned int n )
@@ -157,3 +425,75 @@ int itotimestr( char *s, unsigned int n )
 #endif
 	return 8;
 }
+
+
+/**
+ * seconds since 1970-01-01 00:00:00 of date YYYYMMDD and time HHMMSS, taken
+ * as UTC, without mktime(). Returns false if date is not valid.
+ */
+bool epoch_seconds( int64_t *secs, int date, int time )
+{
+	static const int days_before_month[13] = {
+		0, 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334 };
+
+	if( date <= 0 || date >= 100000000 ) {
+		return false;
+	}
+	const int y = date / 10000;
+	const int m = date / 100 % 100;
+	const int d = date % 100;
+	if( y < 1 || m < 1 || m > 12 ) {
+		return false;
+	}
+
+	/* leap days of the years before y, 477 of them before 1970 */
+	const int yb = y - 1;
+	const int leaps = yb / 4 - yb / 100 + yb / 400 - 477;
+	const bool leap = (y % 4 == 0 && (y % 100 != 0 || y % 400 == 0));
+	int64_t days = (int64_t)365 * (y - 1970) + leaps + days_before_month[m]
+		+ (leap && m > 2) + d - 1;
+
+	if( time < 0 || time >= 1000000 ) {
+		time = 0;
+	}
+	*secs = days * 86400 + (time / 10000) * 3600 + (time / 100 % 100) * 60
+		+ time % 100;
+	return true;
+}
+
+template <int64_t MUL>
+int tstoa_epoch( char *s, int date, int time )
+{
+	int64_t secs;
+	if( !epoch_seconds( &secs, date, time ) ) {
+		/* empty field */
+		return 0;
+	}
+	return int64toa( s, secs * MUL );
+}
+
+/* YYYY-MM-DDTHH:MM:SS */
+static int tstoa_iso( char *s, int date, int time )
+{
+	int len = itodatestr( s, date );
+	s[len++] = 'T';
+	return len + itotimestr( s + len, time );
+}
+
+/**
+ * return the printing function for timestamps of unit "s", "ms", "ns" (since
+ * epoch) or "iso" (ISO-8601 date and time), NULL for unknown units
+ */
+tstoa_func tstoa_unit( const char *unit )
+{
+	if( strcmp( unit, "s" ) == 0 ) {
+		return tstoa_epoch<1>;
+	} else if( strcmp( unit, "ms" ) == 0 ) {
+		return tstoa_epoch<1000>;
+	} else if( strcmp( unit, "ns" ) == 0 ) {
+		return tstoa_epoch<1000000000>;
+	} else if( strcmp( unit, "iso" ) == 0 ) {
+		return tstoa_iso;
+	}
+	return NULL;
+}
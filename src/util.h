@@ -38,6 +38,7 @@
 #ifndef ATEM_UTILS_H
 #define ATEM_UTILS_H
 
+#include <stdint.h>
 
 
 
@@ -76,8 +77,29 @@ extern int ltoa( char *s, long n );
 extern int itodatestr( char *s, unsigned int n );
 extern int itotimestr( char *s, unsigned int n );
 
+typedef int (*ftoa_func)(char*, float);
+
+/* decimals of the fixed precision printing functions, default is 5 */
+#define MAX_FTOA_PRECISION 9
+
 extern int ftoa(char *s, float f );
 extern int ftoa_prec_f0(char *s, float f );
+extern int dtoa_prec_f0( char *s, double d );
+extern int ftoa_shortest( char *s, float f );
+extern ftoa_func ftoa_precision( int prec );
+extern ftoa_func ftoa_scale( int scale );
+
+typedef int (*dtoa_func)(char*, double);
+
+extern int dtoa( char *s, double d );
+extern int dtoa_shortest( char *s, double d );
+extern dtoa_func dtoa_precision( int prec );
+extern dtoa_func dtoa_scale( int scale );
+
+typedef int (*tstoa_func)(char*, int date, int time);
+
+extern tstoa_func tstoa_unit( const char *unit );
+extern bool epoch_seconds( int64_t *secs, int date, int time );
 
 
 
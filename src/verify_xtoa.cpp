@@ -0,0 +1,602 @@
+/*** verify_xtoa.cpp -- exhaustive checks of the fast printing functions
+ *
+ * Copyright (C) 2010-2016 Ruediger Meier
+ *
+ * Author:  Ruediger Meier <sweet_f_a@gmx.de>
+ *
+ * This file is part of atem.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of any contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ***/
+
+
+/* like test_xtoa.c we include the sources, built with FAST_PRINTING */
+#include "util.cpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#if defined HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+
+#define BUF_LEN 512
+/* values per work unit */
+#define CHUNK_SIZE (1 << 20)
+#define MAX_SEGMENTS 64
+
+enum vfunc {
+	VF_FTOA,
+	VF_FTOA_PREC_F0,
+	VF_FTOA_FIXED,
+	VF_FTOA_SCALED,
+	VF_FTOA_SHORTEST,
+	VF_ITOA,
+	VF_LTOA,
+	VF_DATE,
+	VF_TIME,
+	VF_TIMESTAMP,
+	VF_COUNT
+};
+
+static const char *vfunc_names[VF_COUNT] = {
+	"ftoa",
+	"ftoa_prec_f0",
+	"ftoa_fixed",
+	"ftoa_scaled",
+	"ftoa_shortest",
+	"itoa",
+	"ltoa",
+	"itodatestr",
+	"itotimestr",
+	"tstoa_epoch"
+};
+
+/* inclusive ranges of inputs, floats are given as bit patterns */
+struct segment
+{
+	int64_t lo;
+	int64_t hi;
+};
+
+struct vresult
+{
+	long long checked;
+	long long mismatches;
+	double seconds;
+};
+
+
+static int stride = 1;
+static tstoa_func tstoa_seconds;
+static int max_report = 20;
+
+static segment segments[VF_COUNT][MAX_SEGMENTS];
+static int cnt_segments[VF_COUNT];
+static vresult results[VF_COUNT];
+
+/* next work unit: function, segment and value */
+static int next_func;
+static int next_seg;
+static int64_t next_val;
+static bool next_done;
+
+#if defined HAVE_PTHREAD_H
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK() pthread_mutex_lock( &lock )
+#define UNLOCK() pthread_mutex_unlock( &lock )
+#else
+#define LOCK()
+#define UNLOCK()
+#endif
+
+
+static void add_segment( int f, int64_t lo, int64_t hi )
+{
+	segment *s = &segments[f][cnt_segments[f]++];
+	s->lo = lo;
+	s->hi = hi;
+}
+
+
+/**
+ * Set up the checked input ranges. Floats are checked for all bit patterns
+ * below 2^64, ftoa() prints ULONG_MAX above (and for NaN and INF).
+ * ftoa_fixed() and ftoa_scaled() are checked with precision 1 to 9 for
+ * every 9th input each.
+ * ftoa_shortest() is always checked for all floats.
+ */
+static void init_segments( bool all_floats )
+{
+	add_segment( VF_FTOA_SHORTEST, 0, 0xffffffffLL );
+	/* |f| < 2^32, so f * 10^9 fits int64 */
+	add_segment( VF_FTOA_SCALED, 0, 0x4f7fffffLL );
+	add_segment( VF_FTOA_SCALED, 0x80000000LL, 0xcf7fffffLL );
+	for( int f = VF_FTOA; f <= VF_FTOA_FIXED; f++ ) {
+		if( all_floats ) {
+			add_segment( f, 0, 0xffffffffLL );
+		} else {
+			add_segment( f, 0, 0x5f7fffffLL );
+			add_segment( f, 0x80000000LL, 0xdf7fffffLL );
+		}
+	}
+
+	add_segment( VF_ITOA, INT_MIN, INT_MAX );
+
+	add_segment( VF_LTOA, INT_MIN, INT_MAX );
+	if( sizeof(long) > 4 ) {
+		const int64_t e = 1 << 24;
+		add_segment( VF_LTOA, LONG_MIN, LONG_MIN + e );
+		add_segment( VF_LTOA, LONG_MAX - e, LONG_MAX );
+		/* carries around powers of ten beyond 32 bit */
+		int64_t p = 10000000000LL;
+		for( int i = 10; i <= 18; i++, p *= 10 ) {
+			add_segment( VF_LTOA, p - e, p + e );
+			add_segment( VF_LTOA, -p - e, -p + e );
+		}
+	}
+
+	const int64_t e = 1 << 16;
+	add_segment( VF_DATE, 0, 100000000 + e );
+	add_segment( VF_DATE, UINT_MAX - e, UINT_MAX );
+	add_segment( VF_TIME, 0, 1000000 + e );
+	add_segment( VF_TIME, UINT_MAX - e, UINT_MAX );
+	add_segment( VF_TIMESTAMP, -e, 100000000 + e );
+}
+
+
+/* reference implementations of the date and time formatters */
+static int ref_datestr( char *s, unsigned int n )
+{
+	if( n == 0 || n >= 100000000 ) {
+		return sprintf( s, "0000-00-00" );
+	}
+	return sprintf( s, "%04u-%02u-%02u", n / 10000, n / 100 % 100, n % 100 );
+}
+
+static int ref_timestr( char *s, unsigned int n )
+{
+	if( n == 0 || n >= 1000000 ) {
+		return sprintf( s, "00:00:00" );
+	}
+	return sprintf( s, "%02u:%02u:%02u", n / 10000, n / 100 % 100, n % 100 );
+}
+
+
+/**
+ * reference for ftoa_shortest: the fewest "%.*e" digits which strtof reads
+ * back as f, printed without exponent and trailing zeros
+ */
+static int ref_shortest( char *s, float f )
+{
+	char e[BUF_LEN];
+	int prec = 0;
+	if( f != f ) {
+		return sprintf( s, "nan" );
+	}
+	if( f == 0.0f ) {
+		return sprintf( s, "%s", signbit(f) ? "-0" : "0" );
+	}
+	if( f - f != 0.0f ) {
+		return sprintf( s, "%s", f < 0 ? "-inf" : "inf" );
+	}
+	while( sprintf( e, "%.*e", prec, f ), strtof( e, NULL ) != f ) {
+		prec++;
+	}
+
+	/* e is like [-]d.ddde[+-]xx */
+	char *p = s;
+	const char *d = e;
+	if( *d == '-' ) {
+		*p++ = *d++;
+	}
+	char digits[16];
+	int n = 0;
+	for( ; *d != 'e'; d++ ) {
+		if( *d != '.' ) {
+			digits[n++] = *d;
+		}
+	}
+	while( n > 1 && digits[n - 1] == '0' ) {
+		n--;
+	}
+	/* position of the point relative to the first digit */
+	int point = atoi( d + 1 ) + 1;
+	if( point <= 0 ) {
+		p += sprintf( p, "0." );
+		for( int i = point; i < 0; i++ ) {
+			*p++ = '0';
+		}
+		memcpy( p, digits, n );
+		p += n;
+	} else if( point >= n ) {
+		memcpy( p, digits, n );
+		p += n;
+		for( int i = n; i < point; i++ ) {
+			*p++ = '0';
+		}
+	} else {
+		memcpy( p, digits, point );
+		p += point;
+		*p++ = '.';
+		memcpy( p, digits + point, n - point );
+		p += n - point;
+	}
+	*p = '\0';
+	return p - s;
+}
+
+
+/**
+ * reference for ftoa_scaled: "%.*f" without point and leading zeros
+ */
+static int ref_scaled( char *s, float f, int scale )
+{
+	char e[BUF_LEN];
+	sprintf( e, "%.*f", scale, f );
+
+	char *p = s;
+	const char *d = e;
+	if( *d == '-' ) {
+		*p++ = *d++;
+	}
+	for( ; *d != '\0'; d++ ) {
+		if( *d == '.' || (*d == '0' && (p == s || p[-1] == '-')) ) {
+			continue;
+		}
+		*p++ = *d;
+	}
+	if( p == s || p[-1] == '-' ) {
+		/* zero, also "-0.000" */
+		p = s;
+		*p++ = '0';
+	}
+	*p = '\0';
+	return p - s;
+}
+
+
+/**
+ * reference for timestamps in seconds, time is v * 7919 mod 10^6
+ */
+static int ref_timestamp( char *s, int date, int time )
+{
+	int y = date / 10000;
+	int m = date / 100 % 100;
+	if( date <= 0 || date >= 100000000 || y < 1 || m < 1 || m > 12 ) {
+		return 0;
+	}
+	struct tm t;
+	memset( &t, 0, sizeof(t) );
+	t.tm_year = y - 1900;
+	t.tm_mon = m - 1;
+	t.tm_mday = date % 100;
+	t.tm_hour = time / 10000;
+	t.tm_min = time / 100 % 100;
+	t.tm_sec = time % 100;
+	return sprintf( s, "%lld", (long long) timegm( &t ) );
+}
+
+
+static void report( int f, int64_t v, const char *exp, int exp_len,
+	const char *got, int got_len )
+{
+	LOCK();
+	if( results[f].mismatches++ < max_report ) {
+		if( f <= VF_FTOA_SHORTEST ) {
+			printf( "MISMATCH\t%s\t0x%08llx", vfunc_names[f],
+				(unsigned long long) v );
+		} else {
+			printf( "MISMATCH\t%s\t%lld", vfunc_names[f], (long long) v );
+		}
+		printf( "\t%.*s\t%.*s\n", exp_len, exp, got_len, got );
+	}
+	UNLOCK();
+}
+
+
+#define CHECK( _exp_len_, _got_len_ ) \
+	if( (_exp_len_) != (_got_len_) || memcmp( exp, got, _got_len_ ) != 0 ) { \
+		report( f, v, exp, _exp_len_, got, _got_len_ ); \
+	}
+
+/**
+ * check inputs lo to hi, returns the number of checked values
+ */
+static long long check_range( int f, int64_t lo, int64_t hi )
+{
+	char exp[BUF_LEN];
+	char got[BUF_LEN];
+	long long cnt = 0;
+	union {
+		uint32_t L;
+		float F;
+	} x;
+
+	for( int64_t v = lo; ; v += stride ) {
+		switch( f ) {
+		case VF_FTOA:
+			x.L = (uint32_t) v;
+			CHECK( sprintf( exp, "%.5f", x.F ), ftoa( got, x.F ) );
+			break;
+		case VF_FTOA_PREC_F0:
+			x.L = (uint32_t) v;
+			CHECK( sprintf( exp, "%.0f", x.F ), ftoa_prec_f0( got, x.F ) );
+			break;
+		case VF_FTOA_FIXED:
+			x.L = (uint32_t) v;
+			CHECK( sprintf( exp, "%.*f", (int)(1 + v % 9), x.F ),
+				ftoa_precision( 1 + v % 9 )( got, x.F ) );
+			break;
+		case VF_FTOA_SCALED:
+			x.L = (uint32_t) v;
+			CHECK( ref_scaled( exp, x.F, (int)(1 + v % 9) ),
+				ftoa_scale( 1 + v % 9 )( got, x.F ) );
+			break;
+		case VF_FTOA_SHORTEST:
+			x.L = (uint32_t) v;
+			CHECK( ref_shortest( exp, x.F ), ftoa_shortest( got, x.F ) );
+			break;
+		case VF_ITOA:
+			CHECK( sprintf( exp, "%d", (int) v ), itoa( got, (int) v ) );
+			break;
+		case VF_LTOA:
+			CHECK( sprintf( exp, "%ld", (long) v ), ltoa( got, (long) v ) );
+			break;
+		case VF_DATE:
+			CHECK( ref_datestr( exp, (unsigned int) v ),
+				itodatestr( got, (unsigned int) v ) );
+			break;
+		case VF_TIME:
+			CHECK( ref_timestr( exp, (unsigned int) v ),
+				itotimestr( got, (unsigned int) v ) );
+			break;
+		case VF_TIMESTAMP:
+			CHECK( ref_timestamp( exp, (int) v, (int)(v * 7919 % 1000000) ),
+				tstoa_seconds( got, (int) v, (int)(v * 7919 % 1000000) ) );
+			break;
+		}
+		cnt++;
+		if( hi - v < stride ) {
+			break;
+		}
+	}
+	return cnt;
+}
+
+#undef CHECK
+
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/**
+ * take the next work unit, returns false when all is done
+ */
+static bool next_unit( int *f, int64_t *lo, int64_t *hi )
+{
+	bool ok = false;
+	LOCK();
+	while( !next_done && !ok ) {
+		if( next_seg >= cnt_segments[next_func] ) {
+			next_seg = 0;
+			if( ++next_func >= VF_COUNT ) {
+				next_done = true;
+			} else if( cnt_segments[next_func] > 0 ) {
+				next_val = segments[next_func][0].lo;
+			}
+			continue;
+		}
+		const segment *s = &segments[next_func][next_seg];
+		*f = next_func;
+		*lo = next_val;
+		if( s->hi - next_val < (int64_t) CHUNK_SIZE * stride ) {
+			*hi = s->hi;
+			if( ++next_seg < cnt_segments[next_func] ) {
+				next_val = segments[next_func][next_seg].lo;
+			}
+		} else {
+			*hi = next_val + (int64_t) CHUNK_SIZE * stride - 1;
+			next_val = *hi + 1;
+		}
+		ok = true;
+	}
+	UNLOCK();
+	return ok;
+}
+
+
+static void* worker( void * )
+{
+	int f;
+	int64_t lo, hi;
+	while( next_unit( &f, &lo, &hi ) ) {
+		double start = now();
+		long long cnt = check_range( f, lo, hi );
+		double t = now() - start;
+		LOCK();
+		results[f].checked += cnt;
+		results[f].seconds += t;
+		UNLOCK();
+	}
+	return NULL;
+}
+
+
+static void usage( FILE *f )
+{
+	fprintf( f,
+"Usage: verify_xtoa [OPTION]...\n"
+"Compare the fast printing functions against printf for all (or every\n"
+"--stride'th) input. Mismatches are printed as\n"
+"  MISMATCH<TAB>function<TAB>input<TAB>expected<TAB>got\n"
+"followed by one line per function\n"
+"  SUMMARY<TAB>function<TAB>checked<TAB>mismatches<TAB>cpu_seconds\n"
+"Exit status is 1 if there were mismatches.\n"
+"\n"
+"  -f, --func=LIST      comma separated functions, default: all of\n"
+"                       ftoa,ftoa_prec_f0,ftoa_fixed,ftoa_scaled,\n"
+"                       ftoa_shortest,itoa,ltoa,itodatestr,itotimestr,\n"
+"                       tstoa_epoch\n"
+"  -j, --threads=N      worker threads, default: number of cpus\n"
+"  -s, --stride=N       check every N'th input only, default: 1\n"
+"  -a, --all-floats     check ftoa for NaN, INF and floats >= 2^64 too\n"
+"  -m, --max-report=N   print max N mismatches per function, default: 20\n"
+"  -h, --help           show this help message\n" );
+}
+
+
+int main( int argc, char *argv[] )
+{
+	static const struct option long_opts[] = {
+		{ "func", required_argument, NULL, 'f' },
+		{ "threads", required_argument, NULL, 'j' },
+		{ "stride", required_argument, NULL, 's' },
+		{ "all-floats", no_argument, NULL, 'a' },
+		{ "max-report", required_argument, NULL, 'm' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+
+	const char *funcs = NULL;
+	bool all_floats = false;
+	long threads = sysconf( _SC_NPROCESSORS_ONLN );
+	int c;
+	while( (c = getopt_long( argc, argv, "f:j:s:am:h", long_opts, NULL ))
+			!= -1 ) {
+		switch( c ) {
+		case 'f':
+			funcs = optarg;
+			break;
+		case 'j':
+			threads = atol( optarg );
+			break;
+		case 's':
+			stride = atoi( optarg );
+			break;
+		case 'a':
+			all_floats = true;
+			break;
+		case 'm':
+			max_report = atoi( optarg );
+			break;
+		case 'h':
+			usage( stdout );
+			return 0;
+		default:
+			usage( stderr );
+			return 2;
+		}
+	}
+	if( optind != argc || stride < 1 || max_report < 0 ) {
+		usage( stderr );
+		return 2;
+	}
+	if( threads < 1 ) {
+		threads = 1;
+	}
+
+	init_segments( all_floats );
+	tstoa_seconds = tstoa_unit( "s" );
+
+	if( funcs != NULL ) {
+		bool selected[VF_COUNT];
+		memset( selected, 0, sizeof(selected) );
+		char *s = strdup( funcs );
+		char *saveptr = NULL;
+		for( char *t = strtok_r( s, ",", &saveptr ); t != NULL;
+		     t = strtok_r( NULL, ",", &saveptr ) ) {
+			int f = 0;
+			while( f < VF_COUNT && strcmp( vfunc_names[f], t ) != 0 ) {
+				f++;
+			}
+			if( f == VF_COUNT ) {
+				fprintf( stderr, "error: unknown function: %s\n", t );
+				return 2;
+			}
+			selected[f] = true;
+		}
+		free( s );
+		for( int f = 0; f < VF_COUNT; f++ ) {
+			if( !selected[f] ) {
+				cnt_segments[f] = 0;
+			}
+		}
+	}
+
+	next_func = 0;
+	while( next_func < VF_COUNT && cnt_segments[next_func] == 0 ) {
+		next_func++;
+	}
+	next_done = (next_func == VF_COUNT);
+	if( !next_done ) {
+		next_val = segments[next_func][0].lo;
+	}
+
+#if defined HAVE_PTHREAD_H
+	pthread_t *tids = (pthread_t*) malloc( threads * sizeof(pthread_t) );
+	for( long i = 0; i < threads; i++ ) {
+		if( pthread_create( &tids[i], NULL, worker, NULL ) != 0 ) {
+			fprintf( stderr, "error: can't create thread\n" );
+			return 2;
+		}
+	}
+	for( long i = 0; i < threads; i++ ) {
+		pthread_join( tids[i], NULL );
+	}
+	free( tids );
+#else
+	worker( NULL );
+#endif
+
+	int ret = 0;
+	for( int f = 0; f < VF_COUNT; f++ ) {
+		if( cnt_segments[f] == 0 ) {
+			continue;
+		}
+		printf( "SUMMARY\t%s\t%lld\t%lld\t%.1f\n", vfunc_names[f],
+			results[f].checked, results[f].mismatches, results[f].seconds );
+		if( results[f].mismatches > 0 ) {
+			ret = 1;
+		}
+	}
+	return ret;
+}
@@ -0,0 +1,588 @@
+/*** where.cpp -- filter expressions over data columns
+ *
+ * Copyright (C) 2010-2016 Ruediger Meier
+ *
+ * Author:  Ruediger Meier <sweet_f_a@gmx.de>
+ *
+ * This file is part of atem.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of any contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ***/
+
+#include "where.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <math.h>
+#include <assert.h>
+
+#include "config.h"
+
+
+
+enum wh_token {
+	TK_END,
+	TK_NUM,
+	TK_COL,
+	TK_LPAREN,
+	TK_RPAREN,
+	TK_ADD,
+	TK_SUB,
+	TK_MUL,
+	TK_DIV,
+	TK_LT,
+	TK_LE,
+	TK_GT,
+	TK_GE,
+	TK_EQ,
+	TK_NE,
+	TK_AND,
+	TK_OR,
+	TK_NOT
+};
+
+/* comparison and arithmetic ops use the same order as their tokens */
+enum wh_op {
+	OP_NUM,
+	OP_COL,
+	OP_NEG,
+	OP_ADD,
+	OP_SUB,
+	OP_MUL,
+	OP_DIV,
+	OP_LT,
+	OP_LE,
+	OP_GT,
+	OP_GE,
+	OP_EQ,
+	OP_NE,
+	OP_AND,
+	OP_OR,
+	OP_NOT
+};
+
+struct wh_insn
+{
+	int op;
+	int col;
+	double num;
+};
+
+
+void wh_ranges_unknown( wh_range *ranges )
+{
+	for( int i = 0; i < WH_COLUMNS; i++ ) {
+		ranges[i].lo = -HUGE_VAL;
+		ranges[i].hi = HUGE_VAL;
+	}
+}
+
+static int data_field_to_column( unsigned int fld )
+{
+	switch( fld ) {
+	case D_DAT: return WH_DATE;
+	case D_TIM: return WH_TIME;
+	case D_OPE: return WH_OPEN;
+	case D_HIG: return WH_HIGH;
+	case D_LOW: return WH_LOW;
+	case D_CLO: return WH_CLOSE;
+	case D_VOL: return WH_VOLUME;
+	case D_OPI: return WH_OPENINT;
+	default: return -1;
+	}
+}
+
+static inline double bar_value( const ms_bar *bar, int col )
+{
+	switch( col ) {
+	case WH_DATE: return bar->date;
+	case WH_TIME: return bar->time;
+	case WH_OPEN: return bar->open;
+	case WH_HIGH: return bar->high;
+	case WH_LOW: return bar->low;
+	case WH_CLOSE: return bar->close;
+	case WH_VOLUME: return bar->volume;
+	default: return bar->openint;
+	}
+}
+
+/* parse n digits */
+static bool scan_digits( const char *s, int n, int *value )
+{
+	*value = 0;
+	for( int i = 0; i < n; i++ ) {
+		if( !isdigit( (unsigned char)s[i] ) ) {
+			return false;
+		}
+		*value = *value * 10 + (s[i] - '0');
+	}
+	return true;
+}
+
+/**
+ * date literals YYYY-MM-DD become YYYYMMDD like the date column, time
+ * literals HH:MM[:SS] become HHMMSS, returns the length or 0
+ */
+static int scan_date_time( const char *s, double *value )
+{
+	int y, m, d;
+	if( scan_digits( s, 4, &y ) && s[4] == '-' && scan_digits( s + 5, 2, &m )
+			&& s[7] == '-' && scan_digits( s + 8, 2, &d )
+			&& !isdigit( (unsigned char)s[10] ) ) {
+		if( m < 1 || m > 12 || d < 1 || d > 31 ) {
+			return 0;
+		}
+		*value = y * 10000 + m * 100 + d;
+		return 10;
+	}
+
+	int h, sec = 0;
+	int len = isdigit( (unsigned char)s[1] ) ? 2 : 1;
+	if( scan_digits( s, len, &h ) && s[len] == ':'
+			&& scan_digits( s + len + 1, 2, &m ) ) {
+		len += 3;
+		if( s[len] == ':' && scan_digits( s + len + 1, 2, &sec ) ) {
+			len += 3;
+		}
+		if( isdigit( (unsigned char)s[len] ) || h > 23 || m > 59 || sec > 59 ) {
+			return 0;
+		}
+		*value = h * 10000 + m * 100 + sec;
+		return len;
+	}
+	return 0;
+}
+
+
+
+Where::Where() :
+	code( (wh_insn*) malloc( WH_MAX_CODE * sizeof(wh_insn) ) ),
+	code_len( 0 ),
+	depth( 0 ),
+	max_depth( 0 ),
+	pos( NULL ),
+	tok( TK_END ),
+	tok_col( 0 ),
+	tok_num( 0 )
+{
+	error[0] = '\0';
+	tok_str[0] = '\0';
+}
+
+Where::~Where()
+{
+	free( code );
+}
+
+
+bool Where::compile( const char *expr )
+{
+	code_len = depth = max_depth = 0;
+	pos = expr;
+	if( !nextToken() || !parseOr() ) {
+		return false;
+	}
+	if( tok != TK_END ) {
+		setError( "unexpected token", tok_str );
+		return false;
+	}
+	assert( depth == 1 );
+	return true;
+}
+
+
+bool Where::nextToken()
+{
+	while( isspace( (unsigned char)*pos ) ) {
+		pos++;
+	}
+
+	const char *begin = pos;
+	const char c = *pos;
+	tok = TK_END;
+	if( c == '\0' ) {
+		tok = TK_END;
+	} else if( isdigit( (unsigned char)c )
+			|| (c == '.' && isdigit( (unsigned char)pos[1] )) ) {
+		int len = scan_date_time( pos, &tok_num );
+		if( len > 0 ) {
+			pos += len;
+		} else {
+			char *end;
+			tok_num = strtod( pos, &end );
+			pos = end;
+		}
+		tok = TK_NUM;
+	} else if( isalpha( (unsigned char)c ) || c == '_' ) {
+		while( isalnum( (unsigned char)*pos ) || *pos == '_' ) {
+			pos++;
+		}
+	} else if( strchr( "<>=!&|", c ) != NULL ) {
+		pos++;
+		if( *pos == '=' || (c == '<' && *pos == '>')
+				|| ((c == '&' || c == '|') && *pos == c) ) {
+			pos++;
+		}
+	} else {
+		pos++;
+	}
+
+	int len = pos - begin;
+	if( len >= (int)sizeof(tok_str) ) {
+		len = sizeof(tok_str) - 1;
+	}
+	memcpy( tok_str, begin, len );
+	tok_str[len] = '\0';
+	if( tok == TK_NUM || c == '\0' ) {
+		return true;
+	}
+
+	if( isalpha( (unsigned char)c ) || c == '_' ) {
+		if( strcasecmp( tok_str, "and" ) == 0 ) {
+			tok = TK_AND;
+		} else if( strcasecmp( tok_str, "or" ) == 0 ) {
+			tok = TK_OR;
+		} else if( strcasecmp( tok_str, "not" ) == 0 ) {
+			tok = TK_NOT;
+		} else {
+			tok_col = data_field_to_column( str_to_data_field( tok_str ) );
+			if( tok_col < 0 ) {
+				setError( "unknown column", tok_str );
+				return false;
+			}
+			tok = TK_COL;
+		}
+		return true;
+	}
+
+	static const struct { const char *s; int tok; } ops[] = {
+		{ "(", TK_LPAREN }, { ")", TK_RPAREN }, { "+", TK_ADD },
+		{ "-", TK_SUB }, { "*", TK_MUL }, { "/", TK_DIV }, { "<", TK_LT },
+		{ "<=", TK_LE }, { ">", TK_GT }, { ">=", TK_GE }, { "=", TK_EQ },
+		{ "==", TK_EQ }, { "!=", TK_NE }, { "<>", TK_NE }, { "&&", TK_AND },
+		{ "||", TK_OR }, { "!", TK_NOT } };
+	for( unsigned int i = 0; i < sizeof(ops) / sizeof(ops[0]); i++ ) {
+		if( strcmp( tok_str, ops[i].s ) == 0 ) {
+			tok = ops[i].tok;
+			return true;
+		}
+	}
+	setError( "unexpected token", tok_str );
+	return false;
+}
+
+
+bool Where::emit( int op, int col, double num )
+{
+	if( code_len >= WH_MAX_CODE ) {
+		setError( "expression too long" );
+		return false;
+	}
+	if( op == OP_NUM || op == OP_COL ) {
+		depth++;
+	} else if( op != OP_NEG && op != OP_NOT ) {
+		depth--;
+	}
+	if( depth > WH_MAX_STACK ) {
+		setError( "expression too deeply nested" );
+		return false;
+	}
+	if( depth > max_depth ) {
+		max_depth = depth;
+	}
+	code[code_len].op = op;
+	code[code_len].col = col;
+	code[code_len].num = num;
+	code_len++;
+	return true;
+}
+
+
+bool Where::parseOr()
+{
+	if( !parseAnd() ) {
+		return false;
+	}
+	while( tok == TK_OR ) {
+		if( !nextToken() || !parseAnd() || !emit( OP_OR ) ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Where::parseAnd()
+{
+	if( !parseNot() ) {
+		return false;
+	}
+	while( tok == TK_AND ) {
+		if( !nextToken() || !parseNot() || !emit( OP_AND ) ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Where::parseNot()
+{
+	if( tok == TK_NOT ) {
+		return nextToken() && parseNot() && emit( OP_NOT );
+	}
+	return parseCmp();
+}
+
+bool Where::parseCmp()
+{
+	if( !parseSum() ) {
+		return false;
+	}
+	if( tok >= TK_LT && tok <= TK_NE ) {
+		int op = OP_LT + (tok - TK_LT);
+		return nextToken() && parseSum() && emit( op );
+	}
+	return true;
+}
+
+bool Where::parseSum()
+{
+	if( !parseTerm() ) {
+		return false;
+	}
+	while( tok == TK_ADD || tok == TK_SUB ) {
+		int op = OP_ADD + (tok - TK_ADD);
+		if( !nextToken() || !parseTerm() || !emit( op ) ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Where::parseTerm()
+{
+	if( !parseUnary() ) {
+		return false;
+	}
+	while( tok == TK_MUL || tok == TK_DIV ) {
+		int op = OP_MUL + (tok - TK_MUL);
+		if( !nextToken() || !parseUnary() || !emit( op ) ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Where::parseUnary()
+{
+	if( tok == TK_SUB ) {
+		return nextToken() && parseUnary() && emit( OP_NEG );
+	}
+	return parsePrimary();
+}
+
+bool Where::parsePrimary()
+{
+	if( tok == TK_NUM ) {
+		return emit( OP_NUM, 0, tok_num ) && nextToken();
+	} else if( tok == TK_COL ) {
+		return emit( OP_COL, tok_col ) && nextToken();
+	} else if( tok == TK_LPAREN ) {
+		if( !nextToken() || !parseOr() ) {
+			return false;
+		}
+		if( tok != TK_RPAREN ) {
+			setError( "missing ')' before", tok == TK_END ? "end" : tok_str );
+			return false;
+		}
+		return nextToken();
+	}
+	setError( "unexpected", tok == TK_END ? "end" : tok_str );
+	return false;
+}
+
+
+/**
+ * evaluate the expression for one bar, non-zero numbers are true
+ */
+bool Where::match( const ms_bar *bar ) const
+{
+	double stack[WH_MAX_STACK];
+	double *sp = stack - 1;
+
+	for( const wh_insn *in = code; in < code + code_len; in++ ) {
+		switch( in->op ) {
+		case OP_NUM: *++sp = in->num; break;
+		case OP_COL: *++sp = bar_value( bar, in->col ); break;
+		case OP_NEG: sp[0] = -sp[0]; break;
+		case OP_ADD: sp--; sp[0] = sp[0] + sp[1]; break;
+		case OP_SUB: sp--; sp[0] = sp[0] - sp[1]; break;
+		case OP_MUL: sp--; sp[0] = sp[0] * sp[1]; break;
+		case OP_DIV: sp--; sp[0] = sp[0] / sp[1]; break;
+		case OP_LT: sp--; sp[0] = sp[0] < sp[1]; break;
+		case OP_LE: sp--; sp[0] = sp[0] <= sp[1]; break;
+		case OP_GT: sp--; sp[0] = sp[0] > sp[1]; break;
+		case OP_GE: sp--; sp[0] = sp[0] >= sp[1]; break;
+		case OP_EQ: sp--; sp[0] = sp[0] == sp[1]; break;
+		case OP_NE: sp--; sp[0] = sp[0] != sp[1]; break;
+		case OP_AND: sp--; sp[0] = sp[0] != 0 && sp[1] != 0; break;
+		case OP_OR: sp--; sp[0] = sp[0] != 0 || sp[1] != 0; break;
+		case OP_NOT: sp[0] = sp[0] == 0; break;
+		}
+	}
+	assert( sp == stack );
+	return sp[0] != 0;
+}
+
+
+/* truth values of interval evaluation, any value may be possible */
+#define R_FALSE( _r_ ) ( (_r_).lo == 0 && (_r_).hi == 0 )
+#define R_TRUE( _r_ ) ( (_r_).lo > 0 || (_r_).hi < 0 )
+
+static inline void r_set( wh_range *r, double lo, double hi )
+{
+	/* NaNs make everything possible */
+	if( lo != lo || hi != hi ) {
+		lo = -HUGE_VAL;
+		hi = HUGE_VAL;
+	}
+	r->lo = lo;
+	r->hi = hi;
+}
+
+static inline void r_bool( wh_range *r, bool can_false, bool can_true )
+{
+	r->lo = can_false ? 0 : 1;
+	r->hi = can_true ? 1 : 0;
+}
+
+static inline double min4( double a, double b, double c, double d )
+{
+	double m = a < b ? a : b;
+	m = m < c ? m : c;
+	return m < d ? m : d;
+}
+
+static inline double max4( double a, double b, double c, double d )
+{
+	double m = a > b ? a : b;
+	m = m > c ? m : c;
+	return m > d ? m : d;
+}
+
+/**
+ * Evaluate the expression for value ranges of the columns. Returns false
+ * only if no bar within these ranges can match.
+ */
+bool Where::mayMatch( const wh_range *ranges ) const
+{
+	wh_range stack[WH_MAX_STACK];
+	wh_range *sp = stack - 1;
+
+	for( const wh_insn *in = code; in < code + code_len; in++ ) {
+		const wh_range *b = sp;
+		const wh_range *a = sp - 1;
+		switch( in->op ) {
+		case OP_NUM:
+			sp++;
+			r_set( sp, in->num, in->num );
+			continue;
+		case OP_COL:
+			*++sp = ranges[in->col];
+			continue;
+		case OP_NEG:
+			r_set( sp, -b->hi, -b->lo );
+			continue;
+		case OP_NOT:
+			r_bool( sp, !R_FALSE(*b), !R_TRUE(*b) );
+			continue;
+		}
+
+		wh_range r;
+		switch( in->op ) {
+		case OP_ADD: r_set( &r, a->lo + b->lo, a->hi + b->hi ); break;
+		case OP_SUB: r_set( &r, a->lo - b->hi, a->hi - b->lo ); break;
+		case OP_MUL:
+			r_set( &r, min4( a->lo * b->lo, a->lo * b->hi, a->hi * b->lo,
+					a->hi * b->hi ),
+				max4( a->lo * b->lo, a->lo * b->hi, a->hi * b->lo,
+					a->hi * b->hi ) );
+			break;
+		case OP_DIV:
+			if( b->lo <= 0 && b->hi >= 0 ) {
+				r_set( &r, -HUGE_VAL, HUGE_VAL );
+			} else {
+				r_set( &r, min4( a->lo / b->lo, a->lo / b->hi,
+						a->hi / b->lo, a->hi / b->hi ),
+					max4( a->lo / b->lo, a->lo / b->hi,
+						a->hi / b->lo, a->hi / b->hi ) );
+			}
+			break;
+		case OP_LT: r_bool( &r, a->hi >= b->lo, a->lo < b->hi ); break;
+		case OP_LE: r_bool( &r, a->hi > b->lo, a->lo <= b->hi ); break;
+		case OP_GT: r_bool( &r, a->lo <= b->hi, a->hi > b->lo ); break;
+		case OP_GE: r_bool( &r, a->lo < b->hi, a->hi >= b->lo ); break;
+		case OP_EQ:
+			r_bool( &r, a->lo != a->hi || b->lo != b->hi || a->lo != b->lo,
+				a->lo <= b->hi && b->lo <= a->hi );
+			break;
+		case OP_NE:
+			r_bool( &r, a->lo <= b->hi && b->lo <= a->hi,
+				a->lo != a->hi || b->lo != b->hi || a->lo != b->lo );
+			break;
+		case OP_AND:
+			r_bool( &r, R_FALSE(*a) || R_FALSE(*b) || !R_TRUE(*a)
+				|| !R_TRUE(*b), !R_FALSE(*a) && !R_FALSE(*b) );
+			break;
+		case OP_OR:
+			r_bool( &r, !R_TRUE(*a) && !R_TRUE(*b),
+				!R_FALSE(*a) || !R_FALSE(*b) );
+			break;
+		}
+		*--sp = r;
+	}
+	assert( sp == stack );
+	return !R_FALSE( stack[0] );
+}
+
+
+const char* Where::lastError() const
+{
+	return error;
+}
+
+void Where::setError( const char* e1, const char* e2 ) const
+{
+	if( e2 == NULL || *e2 == '\0' ) {
+		snprintf( error, WH_ERROR_LENGTH, "%s", e1);
+	} else {
+		snprintf( error, WH_ERROR_LENGTH, "%s: %s", e1, e2 );
+	}
+}
@@ -0,0 +1,121 @@
+/*** where.h -- filter expressions over data columns
+ *
+ * Copyright (C) 2010-2016 Ruediger Meier
+ *
+ * Author:  Ruediger Meier <sweet_f_a@gmx.de>
+ *
+ * This file is part of atem.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of any contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ***/
+
+#ifndef ATEM_WHERE_H
+#define ATEM_WHERE_H
+
+#include "ms_file.h"
+
+
+/* limits of compiled expressions */
+#define WH_MAX_CODE 128
+#define WH_MAX_STACK 32
+#define WH_ERROR_LENGTH 256
+
+/* data columns usable in expressions */
+enum wh_column {
+	WH_DATE,
+	WH_TIME,
+	WH_OPEN,
+	WH_HIGH,
+	WH_LOW,
+	WH_CLOSE,
+	WH_VOLUME,
+	WH_OPENINT,
+	WH_COLUMNS
+};
+
+/* known value range of a column, e.g. from master files or zone maps */
+struct wh_range
+{
+	double lo;
+	double hi;
+};
+
+void wh_ranges_unknown( wh_range *ranges );
+
+struct wh_insn;
+
+
+/**
+ * A boolean expression over the columns of a bar like
+ * "close > 5 and volume >= 1e5 and time >= 09:30". It is compiled once to
+ * postfix code which is evaluated per bar.
+ */
+class Where
+{
+	public:
+		Where();
+		~Where();
+
+		bool compile( const char *expr );
+		bool match( const ms_bar *bar ) const;
+		bool mayMatch( const wh_range *ranges ) const;
+
+		const char* lastError() const;
+
+	private:
+		bool parseOr();
+		bool parseAnd();
+		bool parseNot();
+		bool parseCmp();
+		bool parseSum();
+		bool parseTerm();
+		bool parseUnary();
+		bool parsePrimary();
+		bool nextToken();
+		bool emit( int op, int col = 0, double num = 0 );
+		void setError( const char* e1, const char* e2 = "" ) const;
+
+		wh_insn *code;
+		int code_len;
+		int depth;
+		int max_depth;
+
+		/* tokenizer state while compiling */
+		const char *pos;
+		int tok;
+		int tok_col;
+		double tok_num;
+		char tok_str[32];
+
+		mutable char error[WH_ERROR_LENGTH];
+};
+
+
+
+#endif
@@ -0,0 +1,142 @@
+/*** workers.cpp -- run independent work items on a pool of threads
+ *
+ * Copyright (C) 2010-2016 Ruediger Meier
+ *
+ * Author:  Ruediger Meier <sweet_f_a@gmx.de>
+ *
+ * This file is part of atem.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the author nor the names of any contributors
+ *    may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR
+ * BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN
+ * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ ***/
+
+#include "workers.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "stats.h"
+#include "config.h"
+
+#if defined HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+
+
+/* shared by the threads of one run_workers() call */
+struct work_queue
+{
+	int items;
+	int next;
+	work_func func;
+	void *arg;
+#if defined HAVE_PTHREAD_H
+	pthread_mutex_t lock;
+#endif
+};
+
+
+/**
+ * number of online cpus, at least 1
+ */
+int default_threads()
+{
+#if defined _SC_NPROCESSORS_ONLN
+	long n = sysconf( _SC_NPROCESSORS_ONLN );
+	if( n > 0 ) {
+		return n;
+	}
+#endif
+	return 1;
+}
+
+
+#if defined HAVE_PTHREAD_H
+static void* worker( void *arg )
+{
+	work_queue *q = (work_queue*) arg;
+	for(;;) {
+		pthread_mutex_lock( &q->lock );
+		int item = q->next++;
+		pthread_mutex_unlock( &q->lock );
+		if( item >= q->items ) {
+			break;
+		}
+		q->func( q->arg, item );
+	}
+	stats_thread_end();
+	return NULL;
+}
+#endif
+
+
+/**
+ * Call func( arg, item ) for all items from 0 to items - 1, on up to
+ * threads threads. Items are handed out in order one by one, so slow items
+ * don't hold back the others. func must not touch state shared with other
+ * items. Without threads all items run in the calling thread. Worker
+ * threads may count statistics, they are added up when they exit.
+ */
+void run_workers( int items, int threads, work_func func, void *arg )
+{
+	if( threads > items ) {
+		threads = items;
+	}
+
+#if defined HAVE_PTHREAD_H
+	if( threads > 1 ) {
+		work_queue q;
+		q.items = items;
+		q.next = 0;
+		q.func = func;
+		q.arg = arg;
+		pthread_mutex_init( &q.lock, NULL );
+
+		pthread_t *tids = (pthread_t*) malloc( threads * sizeof(pthread_t) );
+		int started = 0;
+		while( started < threads
+				&& pthread_create( &tids[started], NULL, worker, &q ) == 0 ) {
+			started++;
+		}
+		for( int i = 0; i < started; i++ ) {
+			pthread_join( tids[i], NULL );
+		}
+		free( tids );
+		pthread_mutex_destroy( &q.lock );
+		if( started > 0 ) {
+			return;
+		}
+		/* no thread at all, q.next is still 0 */
+	}
+#endif
+
+	for( int i = 0; i < items; i++ ) {
+		func( arg, i );
+	}
+}
@@ -0,0 +1,197 @@
+#!/bin/sh
+
+usage()
+{
+	cat <<EOF
+`basename ${0}` [OPTION]...
+
+Run atem against a generated metastock directory in several configurations
+and report rows/s and MB/s of the fastest of some runs. Results are compared
+against a baseline file, exit status is 1 if any configuration got slower
+than the threshold allows.
+
+--builddir DIR     specify where atem and msgen can be found
+--baseline FILE    baseline results, default: atem-bench.baseline
+--save             write the results as new baseline
+--threshold PCT    allowed throughput regression in percent, default: 10
+--symbols N        data files to generate, default: 200
+--bars N           records per data file, default: 10000
+--runs N           runs per configuration, default: 3
+
+-h, --help         print a short help screen
+EOF
+}
+
+baseline="atem-bench.baseline"
+save=""
+threshold=10
+symbols=200
+bars=10000
+runs=3
+
+while test ${#} -gt 0; do
+	case "${1}" in
+	"-h"|"--help")
+		usage
+		exit 0
+		;;
+	"--builddir")
+		builddir="${2}"
+		shift 2
+		;;
+	"--baseline")
+		baseline="${2}"
+		shift 2
+		;;
+	"--save")
+		save=1
+		shift
+		;;
+	"--threshold")
+		threshold="${2}"
+		shift 2
+		;;
+	"--symbols")
+		symbols="${2}"
+		shift 2
+		;;
+	"--bars")
+		bars="${2}"
+		shift 2
+		;;
+	"--runs")
+		runs="${2}"
+		shift 2
+		;;
+	*)
+		echo "`basename ${0}`: unknown option '${1}'" >&2
+		exit 1
+		;;
+	esac
+done
+
+ATEM="${builddir:-.}/atem"
+MSGEN="${builddir:-.}/msgen"
+for tool in "${ATEM}" "${MSGEN}"; do
+	if ! test -x "${tool}"; then
+		echo "`basename ${0}`: ${tool} not found" >&2
+		exit 1
+	fi
+done
+
+BENCH_TMPDIR="atem-bench.tmpd"
+mkdir -p "${BENCH_TMPDIR}" || exit 1
+stats="${BENCH_TMPDIR}/stats.json"
+outfile="${BENCH_TMPDIR}/out"
+results="${BENCH_TMPDIR}/results"
+: > "${results}"
+
+## generated data is reused as long as the size does not change
+msdir="${BENCH_TMPDIR}/msdir_${symbols}x${bars}"
+if ! test -d "${msdir}"; then
+	echo "generating ${symbols} x ${bars} records in ${msdir}"
+	"${MSGEN}" -n "${symbols}" -b "${bars}" -f 0 "${msdir}" || exit 1
+fi
+
+## about the middle of the daily data (261 week days per year from 1990 on)
+mid_year=`expr 1990 + ${bars} / 522`
+
+
+## run atem once and print its wall time, output goes to sink
+run_atem()
+{
+	local sink="${1}"
+	shift
+
+	case "${sink}" in
+	"null")
+		"${ATEM}" --stats --stats-slowest=0 "${@}" \
+			> /dev/null 2> "${stats}"
+		;;
+	"file")
+		"${ATEM}" --stats --stats-slowest=0 "${@}" \
+			> "${outfile}" 2> "${stats}"
+		;;
+	"pipe")
+		"${ATEM}" --stats --stats-slowest=0 "${@}" \
+			2> "${stats}" | cat > /dev/null
+		;;
+	esac || return 1
+	sed -n 's/^  "wall_s": \([0-9.]*\),$/\1/p' "${stats}"
+}
+
+## run_config NAME SINK [ATEM ARGS]...
+run_config()
+{
+	local name="${1}"
+	local sink="${2}"
+	local rows bytes best wall i
+	shift 2
+
+	# reference run to count output
+	"${ATEM}" "${@}" "${msdir}" > "${outfile}" 2> /dev/null || return 1
+	rows=`wc -l < "${outfile}"`
+	bytes=`wc -c < "${outfile}"`
+
+	best=""
+	i=0
+	while test ${i} -lt ${runs}; do
+		wall=`run_atem "${sink}" "${@}" "${msdir}"` || return 1
+		best=`awk -v b="${best}" -v w="${wall}" \
+			'BEGIN { print (b == "" || w < b) ? w : b }'`
+		i=`expr ${i} + 1`
+	done
+
+	awk -v n="${name}" -v r="${rows}" -v b="${bytes}" -v w="${best}" \
+		'BEGIN { if (w <= 0) w = 1e-6;
+		printf "%s %.0f %.2f\n", n, r / w, b / w / 1e6 }' >> "${results}"
+}
+
+run_config "default" null || exit 1
+run_config "default_file" file || exit 1
+run_config "default_pipe" pipe || exit 1
+run_config "narrow" null -f symbol,date,close || exit 1
+run_config "date_from" null --date-from=${mid_year}-01-01 || exit 1
+run_config "symbols" null --symbols || exit 1
+run_config "jsonl" null --output-format=jsonl || exit 1
+run_config "scan" null --scan || exit 1
+
+
+## compare with baseline
+if ! test -r "${baseline}"; then
+	: > "${BENCH_TMPDIR}/nobaseline"
+	cmp_file="${BENCH_TMPDIR}/nobaseline"
+else
+	cmp_file="${baseline}"
+fi
+
+echo "# ${symbols} data files x ${bars} records, best of ${runs} runs"
+awk -v t="${threshold}" '
+	FILENAME == ARGV[1] { base[$1] = $2; next }
+	BEGIN {
+		printf "%-14s %14s %10s %14s %9s\n", "config", "rows/s", "MB/s",
+			"baseline", "change"
+	}
+	{
+		change = ""
+		status = ""
+		if ($1 in base && base[$1] > 0) {
+			d = ($2 - base[$1]) * 100 / base[$1]
+			change = sprintf("%+.1f%%", d)
+			if (d < -t) {
+				status = "  REGRESSION"
+				fail = 1
+			}
+		}
+		printf "%-14s %14s %10s %14s %9s%s\n", $1, $2, $3,
+			($1 in base) ? base[$1] : "-", change, status
+	}
+	END { exit fail }' "${cmp_file}" "${results}"
+ret=${?}
+
+if test -n "${save}"; then
+	cp "${results}" "${baseline}" || exit 1
+	echo "baseline saved to ${baseline}"
+fi
+
+exit ${ret}